@@ -0,0 +1,632 @@
+// Headless decoder benchmark: drives FFmpegDecoder with null audio and video sinks
+// and reports throughput, dropped frames, seek latency and peak memory use.
+// With --simulate the decoder runs on a virtual clock, with given decoding and rendering costs,
+// so that the frame drop, drift and seek latency limits can be checked reproducibly.
+
+#include "synthetic.h"
+
+#include "../video/decoderinterface.h"
+#include "../video/audioplayer.h"
+#include "../video/clock.h"
+#include "../video/tracing.h"
+
+#include <boost/log/core/core.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#include <process.h>
+#else
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+int processId()
+{
+#ifdef _WIN32
+    return _getpid();
+#else
+    return getpid();
+#endif
+}
+
+IClock::duration toDuration(double seconds)
+{
+    return boost::chrono::duration_cast<IClock::duration>(boost::chrono::duration<double>(seconds));
+}
+
+// Consumes audio either at the rate a sound card would, going by clock, or as fast as it comes
+class NullAudioPlayer : public IAudioPlayer
+{
+public:
+    NullAudioPlayer(bool realTime, IClock& clock) : m_realTime(realTime), m_clock(clock) {}
+
+    void SetCallback(IAudioPlayerCallback* callback) override { m_callback = callback; }
+
+    void InitializeThread() override {}
+    void DeinitializeThread() override {}
+
+    void Close() override {}
+    bool Open(int bytesPerSample, int channels, int* samplesPerSec) override
+    {
+        m_frameSize = bytesPerSample * channels;
+        m_samplesPerSec = *samplesPerSec;
+        m_restart = true;
+        m_opened = true;
+        return m_frameSize > 0 && m_samplesPerSec > 0;
+    }
+
+    bool opened() const { return m_opened; }
+
+    void SetVolume(double volume) override { m_volume = volume; }
+    double GetVolume() const override { return m_volume; }
+
+    void WaveOutReset() override { m_restart = true; }
+    void WaveOutPause() override { m_restart = true; }
+    void WaveOutRestart() override { m_restart = true; }
+
+    bool WriteAudio(uint8_t* /*write_data*/, int64_t write_size) override
+    {
+        const double frame_clock = double(write_size / m_frameSize) / m_samplesPerSec;
+
+        if (m_realTime)
+        {
+            // Blocks while more than the device latency is buffered
+            const auto latency = boost::chrono::milliseconds(50);
+            const auto now = m_clock.now();
+            if (m_restart.exchange(false) || m_playedUntil < now)
+            {
+                m_playedUntil = now;
+            }
+            m_playedUntil += toDuration(frame_clock);
+            if (m_playedUntil - latency > now)
+            {
+                m_clock.sleepFor(m_playedUntil - latency - now);
+            }
+        }
+
+        m_callback->AppendFrameClock(frame_clock);
+        return true;
+    }
+
+private:
+    const bool m_realTime;
+    IClock& m_clock;
+    IAudioPlayerCallback* m_callback = nullptr;
+    int m_frameSize = 0;
+    int m_samplesPerSec = 0;
+    double m_volume = 1.;
+    std::atomic_bool m_restart{ true };
+    std::atomic_bool m_opened{ false };
+    IClock::time_point m_playedUntil;
+};
+
+// Takes the frame data the way a display would and releases the frame after the rendering cost
+class NullFrameListener : public IFrameListener
+{
+public:
+    NullFrameListener(IClock& clock, double renderCost) : m_clock(clock), m_renderCost(toDuration(renderCost)) {}
+
+    void updateFrame(IFrameDecoder* decoder, unsigned int /*generation*/) override
+    {
+        FrameRenderingData data;
+        if (decoder->getFrameRenderingData(&data))
+        {
+            m_lastFrameSize = { data.width, data.height };
+        }
+    }
+
+    void drawFrame(IFrameDecoder* decoder, unsigned int generation) override
+    {
+        if (m_renderCost > IClock::duration::zero())
+        {
+            m_clock.sleepFor(m_renderCost);
+        }
+        ++m_framesShown;
+        decoder->finishedDisplayingFrame(generation);
+    }
+
+    void decoderClosing() override {}
+
+    uint64_t framesShown() const { return m_framesShown; }
+    std::pair<int, int> lastFrameSize() const { return m_lastFrameSize; }
+
+private:
+    IClock& m_clock;
+    const IClock::duration m_renderCost;
+    std::atomic<uint64_t> m_framesShown{ 0 };
+    std::pair<int, int> m_lastFrameSize{};  // display thread
+};
+
+class BenchListener : public FrameDecoderListener
+{
+public:
+    void onEndOfStream(int idx, bool error) override
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (idx == 0)
+        {
+            m_finished = true;
+            m_error = error;
+        }
+        m_cv.notify_all();
+    }
+
+    void onSeekFrameShown(double latency, bool /*exact*/) override
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_seekLatencies.push_back(latency);
+        m_cv.notify_all();
+    }
+
+    // Returns false on timeout
+    template<typename P>
+    bool waitFor(Clock::time_point until, P predicate)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        return m_cv.wait_until(lock, until, [this, &predicate] { return predicate(*this); });
+    }
+
+    size_t seeksShown()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_seekLatencies.size();
+    }
+
+    bool finished()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_finished;
+    }
+
+    // Guarded by m_mutex; accessed through waitFor() or after closing
+    bool m_finished = false;
+    bool m_error = false;
+    std::vector<double> m_seekLatencies;
+
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+};
+
+struct Options
+{
+    std::vector<std::string> urls;
+    bool fast = false;
+    bool realTimeAudio = true;
+    bool audioSet = false;
+    int seeks = 0;
+    double maxSeconds = 0;
+    double minFps = 0;
+    int frameQueueDepth = 0;
+    bool hwAccelerated = false;
+    bool memoryMapped = false;
+    std::string probeCachePath;
+    std::string tracePath;
+    bool verbose = false;
+
+    bool simulate = false;
+    double syntheticSeconds = 0;
+    double decodeCost = 0;      // seconds
+    double renderCost = 0;
+    int maxDropped = -1;
+    double maxDrift = 0;
+    double maxSeekLatency = 0;
+};
+
+void usage()
+{
+    std::cerr <<
+        "Usage: DecoderBench [options] <url> [<audio url>]\n"
+        "       DecoderBench [options] --synthetic=SEC\n"
+        "  --fast             decode as fast as possible, ignoring presentation times\n"
+        "  --audio=MODE       realtime (default unless --fast) or unthrottled\n"
+        "  --seeks=N          seek to N spread out positions and measure the latency\n"
+        "  --duration=SEC     stop after SEC seconds of wall time\n"
+        "  --min-fps=FPS      exit with code 2 if fewer frames per second were shown\n"
+        "  --queue-depth=N    decoded frames queued for the display\n"
+        "  --hwaccel          use hardware decoding where available\n"
+        "  --mmap             read local files through a memory mapping\n"
+        "  --probe-cache=FILE remember the stream layouts in FILE, so that reopening needs a minimal probe\n"
+        "  --trace=FILE       write a Chrome trace of the pipeline\n"
+        "  --verbose          keep the decoder log\n"
+        "  --synthetic=SEC    play a generated MPEG stream of SEC seconds instead of a url\n"
+        "  --simulate         run on a virtual clock; --duration is virtual time then\n"
+        "  --decode-cost=MS   clock time every decoded video frame takes\n"
+        "  --render-cost=MS   clock time every shown frame takes\n"
+        "  --max-dropped=N    exit with code 2 if more than N frames were dropped\n"
+        "  --max-drift=MS     exit with code 2 if the audio drifted further off\n"
+        "  --max-seek-latency=MS  exit with code 2 if a seek took longer\n";
+}
+
+bool parseOptions(int argc, char* argv[], Options& options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        const auto value = [&arg]
+        {
+            const auto pos = arg.find('=');
+            return (pos == std::string::npos) ? std::string() : arg.substr(pos + 1);
+        };
+        const auto is = [&arg](const char* name)
+        {
+            return arg.compare(0, strlen(name), name) == 0;
+        };
+
+        if (arg == "--fast")
+            options.fast = true;
+        else if (is("--audio="))
+        {
+            const auto mode = value();
+            if (mode != "realtime" && mode != "unthrottled")
+                return false;
+            options.realTimeAudio = mode == "realtime";
+            options.audioSet = true;
+        }
+        else if (is("--seeks="))
+            options.seeks = std::atoi(value().c_str());
+        else if (is("--duration="))
+            options.maxSeconds = std::atof(value().c_str());
+        else if (is("--min-fps="))
+            options.minFps = std::atof(value().c_str());
+        else if (is("--queue-depth="))
+            options.frameQueueDepth = std::atoi(value().c_str());
+        else if (arg == "--hwaccel")
+            options.hwAccelerated = true;
+        else if (arg == "--mmap")
+            options.memoryMapped = true;
+        else if (is("--probe-cache="))
+            options.probeCachePath = value();
+        else if (is("--trace="))
+            options.tracePath = value();
+        else if (arg == "--verbose")
+            options.verbose = true;
+        else if (arg == "--simulate")
+            options.simulate = true;
+        else if (is("--synthetic="))
+            options.syntheticSeconds = std::atof(value().c_str());
+        else if (is("--decode-cost="))
+            options.decodeCost = std::atof(value().c_str()) / 1000;
+        else if (is("--render-cost="))
+            options.renderCost = std::atof(value().c_str()) / 1000;
+        else if (is("--max-dropped="))
+            options.maxDropped = std::atoi(value().c_str());
+        else if (is("--max-drift="))
+            options.maxDrift = std::atof(value().c_str()) / 1000;
+        else if (is("--max-seek-latency="))
+            options.maxSeekLatency = std::atof(value().c_str()) / 1000;
+        else if (is("--"))
+            return false;
+        else
+            options.urls.push_back(arg);
+    }
+
+    if (options.fast && !options.audioSet)
+    {
+        options.realTimeAudio = false;
+    }
+
+    if (options.simulate && options.fast)
+    {
+        return false;
+    }
+
+    return (options.syntheticSeconds > 0) ? options.urls.empty()
+        : !options.urls.empty() && options.urls.size() <= 2;
+}
+
+// Bytes
+uint64_t peakResidentSetSize()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters{};
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    {
+        return counters.PeakWorkingSetSize;
+    }
+    return 0;
+#else
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss;
+#else
+    return uint64_t(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+// Wall time run; seeks wait for the playback to settle in real time
+double runRealTime(IFrameDecoder& decoder, const Options& options,
+    NullFrameListener& frameListener, BenchListener& decoderListener, int& seeksFailed)
+{
+    const auto start = Clock::now();
+    const auto deadline = (options.maxSeconds > 0)
+        ? start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(options.maxSeconds))
+        : Clock::time_point::max();
+
+    decoder.play();
+
+    // Seeks are spread over the file in a fixed pseudo-random order, so that runs are comparable
+    std::minstd_rand random(12345);
+    std::uniform_real_distribution<double> positions(0.05, 0.95);
+    for (int i = 0; i < options.seeks && Clock::now() < deadline; ++i)
+    {
+        // Let playback settle first
+        const auto shown = frameListener.framesShown();
+        decoderListener.waitFor(std::min(deadline, Clock::now() + std::chrono::seconds(5)),
+            [&frameListener, shown](const BenchListener& listener)
+            {
+                return listener.m_finished || frameListener.framesShown() >= shown + 10;
+            });
+
+        const auto seeksDone = decoderListener.seeksShown();
+        if (!decoder.seekByPercent(positions(random)))
+        {
+            ++seeksFailed;
+            continue;
+        }
+        if (!decoderListener.waitFor(std::min(deadline, Clock::now() + std::chrono::seconds(10)),
+            [seeksDone](const BenchListener& listener) { return listener.m_seekLatencies.size() > seeksDone; }))
+        {
+            ++seeksFailed;
+        }
+    }
+
+    decoderListener.waitFor(deadline, [](const BenchListener& listener) { return listener.m_finished; });
+
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Virtual time run. The clock jumps to the earliest deadline once the display, the audio sink
+// and the video thread, either paying its decoding cost or waiting for the frame queue, all wait for it,
+// or after SETTLE_TIME of real time, e.g. while the display waits for a frame still being decoded.
+// Decoding and conversion take no virtual time beyond the given costs.
+double runSimulation(IFrameDecoder& decoder, const Options& options, VirtualClock& clock,
+    const NullAudioPlayer& audioPlayer, NullFrameListener& frameListener, BenchListener& decoderListener,
+    int& seeksFailed)
+{
+    const auto SETTLE_TIME = std::chrono::milliseconds(20);
+    const auto STEP = boost::chrono::milliseconds(1);
+    const auto SEEK_TIMEOUT = boost::chrono::seconds(10);
+
+    const auto start = clock.now();
+    const auto deadline = (options.maxSeconds > 0)
+        ? start + toDuration(options.maxSeconds) : IClock::time_point::max();
+
+    decoder.play();
+
+    // Same seek positions as in real time; the next seek follows 10 frames after the previous one is shown
+    std::minstd_rand random(12345);
+    std::uniform_real_distribution<double> positions(0.05, 0.95);
+    int seeksIssued = 0;
+    bool seekPending = false;
+    size_t seeksDone = 0;
+    uint64_t settledAt = 0;
+    IClock::time_point seekTime;
+
+    while (!decoderListener.finished() && clock.now() < deadline)
+    {
+        if (seekPending)
+        {
+            const bool shown = decoderListener.seeksShown() > seeksDone;
+            if (shown || clock.now() - seekTime > SEEK_TIMEOUT)
+            {
+                seeksFailed += shown ? 0 : 1;
+                seekPending = false;
+                settledAt = frameListener.framesShown();
+            }
+        }
+        else if (seeksIssued < options.seeks && frameListener.framesShown() >= settledAt + 10)
+        {
+            ++seeksIssued;
+            seeksDone = decoderListener.seeksShown();
+            seekPending = decoder.seekByPercent(positions(random));
+            seekTime = clock.now();
+            seeksFailed += seekPending ? 0 : 1;
+        }
+
+        const size_t threads = 2 + (audioPlayer.opened() ? 1 : 0);
+        const auto settleUntil = Clock::now() + SETTLE_TIME;
+        while (clock.waiters() < threads && Clock::now() < settleUntil)
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+
+        const auto now = clock.now();
+        const auto next = clock.nextDeadline();
+        clock.advanceTo((next > now && next != IClock::time_point::max()) ? std::min(next, deadline) : now + STEP);
+    }
+
+    return boost::chrono::duration<double>(clock.now() - start).count();
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+    {
+        usage();
+        return 1;
+    }
+
+    boost::log::core::get()->set_logging_enabled(options.verbose);
+
+    if (!options.tracePath.empty())
+    {
+        tracing::setEnabled(true);
+    }
+
+    std::string syntheticPath;
+    if (options.syntheticSeconds > 0)
+    {
+        SyntheticStream stream;
+        stream.seconds = options.syntheticSeconds;
+        // Unique per process, as benchmarks may run in parallel
+        syntheticPath = (std::filesystem::temp_directory_path()
+            / ("DecoderBench-synthetic-" + std::to_string(processId()) + ".mpg")).string();
+        if (!WriteSyntheticStream(syntheticPath, stream))
+        {
+            std::cerr << "Failed to write " << syntheticPath << '\n';
+            return 1;
+        }
+        options.urls.push_back(syntheticPath);
+    }
+
+    // Outlives the decoder
+    VirtualClock virtualClock;
+    IClock& clock = options.simulate ? static_cast<IClock&>(virtualClock) : GetSystemClock();
+
+    auto audioPlayer = std::make_unique<NullAudioPlayer>(options.realTimeAudio, clock);
+    const NullAudioPlayer& audioSink = *audioPlayer;
+    auto decoder = GetFrameDecoder(std::move(audioPlayer));
+
+    NullFrameListener frameListener(clock, options.renderCost);
+    BenchListener decoderListener;
+    decoder->setFrameListener(&frameListener);
+    decoder->setDecoderListener(&decoderListener);
+    decoder->SetFrameFormat(IFrameDecoder::PIX_FMT_YUV420P, false);
+    decoder->setHwAccelerated(options.hwAccelerated);
+    decoder->setMemoryMappedInput(options.memoryMapped);
+    if (!options.probeCachePath.empty())
+    {
+        decoder->setProbeCacheFile(options.probeCachePath);
+    }
+    decoder->setFreeRunning(options.fast);
+    decoder->setClock(&clock);
+    decoder->setSimulatedDecodeCost(options.decodeCost);
+    if (options.frameQueueDepth > 0)
+    {
+        decoder->setFrameQueueDepth(options.frameQueueDepth);
+    }
+
+    const auto openStart = Clock::now();
+    const bool opened = (options.urls.size() == 1)
+        ? decoder->openUrls({ options.urls[0] })
+        : decoder->openUrls({ options.urls[0], options.urls[1] });
+    if (!opened)
+    {
+        std::cerr << "Failed to open " << options.urls[0] << '\n';
+        return 1;
+    }
+    const double openTime = std::chrono::duration<double>(Clock::now() - openStart).count();
+
+    int seeksFailed = 0;
+    const double elapsed = options.simulate
+        ? runSimulation(*decoder, options, virtualClock, audioSink, frameListener, decoderListener, seeksFailed)
+        : runRealTime(*decoder, options, frameListener, decoderListener, seeksFailed);
+
+    const auto framesShown = frameListener.framesShown();
+    const auto metrics = decoder->getMetrics();
+    const auto presentation = decoder->getPresentationStats();
+
+    decoder->close();
+
+    if (!syntheticPath.empty())
+    {
+        std::remove(syntheticPath.c_str());
+    }
+
+    if (!options.tracePath.empty())
+    {
+        std::ofstream trace(options.tracePath);
+        tracing::writeChromeTrace(trace);
+    }
+
+    const auto frameSize = frameListener.lastFrameSize();
+    const double fps = (elapsed > 0) ? framesShown / elapsed : 0;
+
+    std::cout << "url: " << options.urls[0] << '\n'
+        << "mode: " << (options.fast ? "fast" : options.simulate ? "simulated" : "paced")
+        << ", audio " << (options.realTimeAudio ? "realtime" : "unthrottled") << '\n'
+        << "frame size: " << frameSize.first << 'x' << frameSize.second << '\n'
+        << "open time: " << openTime << " s\n"
+        << "elapsed: " << elapsed << " s" << (decoderListener.m_finished ? "" : " (stopped before the end)") << '\n'
+        << "frames decoded: " << metrics.framesDecoded << " (" << (elapsed > 0 ? metrics.framesDecoded / elapsed : 0) << " fps)\n"
+        << "frames shown: " << framesShown << " (" << fps << " fps)\n"
+        << "frames dropped: " << metrics.framesHardSkipped + metrics.framesDropped + metrics.framesAbandoned
+        << " (hard skip " << metrics.framesHardSkipped
+        << ", display " << metrics.framesDropped
+        << ", abandoned " << metrics.framesAbandoned << ")\n"
+        << "late frames: " << presentation.framesLate << '\n'
+        << "audio drift: max " << metrics.maxAudioDrift * 1000 << " ms\n"
+        << "decode time: mean " << metrics.meanDecodeTime * 1000 << " ms, max " << metrics.maxDecodeTime * 1000 << " ms\n"
+        << "conversion time: mean " << metrics.meanConversionTime * 1000 << " ms, max " << metrics.maxConversionTime * 1000 << " ms\n";
+
+    if (options.seeks > 0)
+    {
+        const auto& latencies = decoderListener.m_seekLatencies;
+        std::cout << "seeks: " << latencies.size() << " of " << options.seeks;
+        if (!latencies.empty())
+        {
+            double sum = 0;
+            for (double latency : latencies)
+                sum += latency;
+            std::cout << ", latency min " << *std::min_element(latencies.begin(), latencies.end()) * 1000
+                << " ms, mean " << sum / latencies.size() * 1000
+                << " ms, max " << *std::max_element(latencies.begin(), latencies.end()) * 1000 << " ms";
+        }
+        std::cout << '\n';
+    }
+
+    std::cout << "peak RSS: " << peakResidentSetSize() / (1024 * 1024) << " MiB\n";
+
+    if (decoderListener.m_error)
+    {
+        std::cerr << "Stream ended with an error\n";
+        return 1;
+    }
+
+    int result = 0;
+    if (options.minFps > 0 && fps < options.minFps)
+    {
+        std::cerr << "Below the minimum of " << options.minFps << " fps\n";
+        result = 2;
+    }
+
+    const auto framesDropped = metrics.framesHardSkipped + metrics.framesDropped + metrics.framesAbandoned;
+    if (options.maxDropped >= 0 && framesDropped > uint64_t(options.maxDropped))
+    {
+        std::cerr << "Dropped more than " << options.maxDropped << " frames\n";
+        result = 2;
+    }
+
+    if (options.maxDrift > 0 && metrics.maxAudioDrift > options.maxDrift)
+    {
+        std::cerr << "Audio drifted more than " << options.maxDrift * 1000 << " ms\n";
+        result = 2;
+    }
+
+    const auto& latencies = decoderListener.m_seekLatencies;
+    if (options.maxSeekLatency > 0 && (seeksFailed > 0
+        || (!latencies.empty() && *std::max_element(latencies.begin(), latencies.end()) > options.maxSeekLatency)))
+    {
+        std::cerr << "A seek took longer than " << options.maxSeekLatency * 1000 << " ms\n";
+        result = 2;
+    }
+
+    return result;
+}
@@ -0,0 +1,290 @@
+// Micro-benchmarks of the per-frame and per-buffer kernels of the player
+
+#include "frameconversion.h"
+#include "fqueue.h"
+#include "ordered_scoped_token.h"
+
+#include "../QtPlayer/audiovolume.h"
+#include "../QtPlayer/rgbtoyuv.h"
+
+#include "../audio/smbPitchShift.h"
+
+extern "C" {
+#include <libswscale/swscale.h>
+}
+
+#include <benchmark/benchmark.h>
+
+#include <cmath>
+#include <memory>
+#include <random>
+#include <type_traits>
+#include <vector>
+
+namespace {
+
+enum { NUM_CHANNELS = 8, FFT_SIZE = 4096, SAMPLE_RATE = 48000 };
+
+template<typename T>
+std::vector<T> randomSamples(size_t size, int bits)
+{
+    std::minstd_rand random(12345);
+    std::vector<T> result(size);
+    for (auto& v : result)
+    {
+        v = T(random() & ((1u << bits) - 1));
+    }
+    return result;
+}
+
+void setFrameCounters(benchmark::State& state, int64_t bytesPerIteration)
+{
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(state.iterations() * bytesPerIteration);
+}
+
+// Frame dimensions: 1080p and 4K
+void FrameSizes(benchmark::internal::Benchmark* benchmark)
+{
+    benchmark->Args({ 1920, 1080 })->Args({ 3840, 2160 })->Unit(benchmark::kMicrosecond);
+}
+
+
+void BM_Convert16To8Plane(benchmark::State& state)
+{
+    const int width = state.range(0);
+    const int height = state.range(1);
+    const auto src = randomSamples<uint16_t>(size_t(width) * height, 10);
+    std::vector<uint8_t> dst(size_t(width) * height);
+
+    for (auto _ : state)
+    {
+        Convert16To8Plane(src.data(), width, dst.data(), width, 16384, width, height);
+        benchmark::ClobberMemory();
+    }
+    setFrameCounters(state, int64_t(width) * height * 2);
+}
+BENCHMARK(BM_Convert16To8Plane)->Apply(FrameSizes);
+
+void BM_I010ToI420(benchmark::State& state)
+{
+    const int width = state.range(0);
+    const int height = state.range(1);
+    const size_t lumaSize = size_t(width) * height;
+    const auto srcY = randomSamples<uint16_t>(lumaSize, 10);
+    const auto srcU = randomSamples<uint16_t>(lumaSize / 4, 10);
+    const auto srcV = randomSamples<uint16_t>(lumaSize / 4, 10);
+    std::vector<uint8_t> dstY(lumaSize), dstU(lumaSize / 4), dstV(lumaSize / 4);
+
+    for (auto _ : state)
+    {
+        I010ToI420(srcY.data(), width, srcU.data(), width / 2, srcV.data(), width / 2,
+            dstY.data(), width, dstU.data(), width / 2, dstV.data(), width / 2, width, height);
+        benchmark::ClobberMemory();
+    }
+    setFrameCounters(state, int64_t(lumaSize) * 3);
+}
+BENCHMARK(BM_I010ToI420)->Apply(FrameSizes);
+
+void BM_P016ToI420(benchmark::State& state)
+{
+    const int width = state.range(0);
+    const int height = state.range(1);
+    const size_t lumaSize = size_t(width) * height;
+    const auto srcY = randomSamples<uint16_t>(lumaSize, 16);
+    const auto srcUV = randomSamples<uint16_t>(lumaSize / 2, 16);
+    std::vector<uint8_t> dstY(lumaSize), dstU(lumaSize / 4), dstV(lumaSize / 4);
+
+    for (auto _ : state)
+    {
+        P016ToI420(srcY.data(), width, srcUV.data(), width,
+            dstY.data(), width, dstU.data(), width / 2, dstV.data(), width / 2, width, height);
+        benchmark::ClobberMemory();
+    }
+    setFrameCounters(state, int64_t(lumaSize) * 3);
+}
+BENCHMARK(BM_P016ToI420)->Apply(FrameSizes);
+
+// A decoded 10 bit frame to the display format: the HighBitDepthToI420() fast path
+// for AV_PIX_FMT_YUV420P, swscale for the others
+void BM_FrameToImage(benchmark::State& state)
+{
+    const int width = state.range(0);
+    const int height = state.range(1);
+    const auto pixelFormat = static_cast<AVPixelFormat>(state.range(2));
+
+    AVFramePtr decoded(av_frame_alloc());
+    decoded->format = AV_PIX_FMT_YUV420P10LE;
+    decoded->width = width;
+    decoded->height = height;
+    if (av_frame_get_buffer(decoded.get(), FrameBufferPool::ALIGN) < 0)
+    {
+        state.SkipWithError("av_frame_get_buffer failed");
+        return;
+    }
+    for (int plane = 0; plane < 3; ++plane)
+    {
+        const int planeHeight = plane ? height / 2 : height;
+        const auto samples = randomSamples<uint16_t>(decoded->linesize[plane] / 2 * planeHeight, 10);
+        std::copy(samples.begin(), samples.end(), reinterpret_cast<uint16_t*>(decoded->data[plane]));
+    }
+
+    FrameBufferPool bufferPool;
+    VideoFrame videoFrame;
+    videoFrame.m_bufferPool = &bufferPool;
+    SwsContext* swsContext = nullptr;
+
+    for (auto _ : state)
+    {
+        if (!frameToImage(videoFrame, decoded, swsContext, pixelFormat, 0))
+        {
+            state.SkipWithError("frameToImage failed");
+            break;
+        }
+        benchmark::ClobberMemory();
+    }
+    sws_freeContext(swsContext);
+    setFrameCounters(state, int64_t(width) * height * 3);
+}
+BENCHMARK(BM_FrameToImage)
+    ->Args({ 1920, 1080, AV_PIX_FMT_YUV420P })->Args({ 3840, 2160, AV_PIX_FMT_YUV420P })
+    ->Args({ 1920, 1080, AV_PIX_FMT_RGB24 })->Args({ 3840, 2160, AV_PIX_FMT_RGB24 })
+    ->Unit(benchmark::kMicrosecond);
+
+void BM_BgraToI420(benchmark::State& state)
+{
+    const int width = state.range(0);
+    const int height = state.range(1);
+    const size_t lumaSize = size_t(width) * height;
+    const auto src = randomSamples<uint8_t>(lumaSize * 4, 8);
+    std::vector<uint8_t> dstY(lumaSize), dstU(lumaSize / 4), dstV(lumaSize / 4);
+
+    for (auto _ : state)
+    {
+        BgraToI420(src.data(), width * 4, dstY.data(), width,
+            dstU.data(), width / 2, dstV.data(), width / 2, width, height);
+        benchmark::ClobberMemory();
+    }
+    setFrameCounters(state, int64_t(lumaSize) * 4);
+}
+BENCHMARK(BM_BgraToI420)->Apply(FrameSizes);
+
+
+// PortAudioPlayer::WriteAudio() volume scaling of an 8 channel buffer
+void BM_ScaleVolume(benchmark::State& state)
+{
+    const size_t count = size_t(state.range(0)) * NUM_CHANNELS;
+    auto samples = randomSamples<int16_t>(count, 15);
+
+    for (auto _ : state)
+    {
+        ScaleVolume(samples.data(), count, 0.99);
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * count);
+    state.SetBytesProcessed(state.iterations() * count * sizeof(int16_t));
+}
+BENCHMARK(BM_ScaleVolume)->Arg(1024)->Arg(FFT_SIZE);
+
+void BM_SmbFft(benchmark::State& state)
+{
+    const long size = state.range(0);
+    std::vector<float> buffer(2 * size);
+    std::minstd_rand random(12345);
+    for (long i = 0; i < size; ++i)
+    {
+        buffer[2 * i] = float(random()) / random.max() - 0.5f;
+    }
+
+    for (auto _ : state)
+    {
+        smbFft(buffer.data(), size, -1);
+        smbFft(buffer.data(), size, 1);
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * 2);
+}
+BENCHMARK(BM_SmbFft)->Arg(FFT_SIZE);
+
+// The AudioPitchDecorator setup: one shifter per channel, 4096 point FFT, 16x oversampling
+void BM_SmbPitchShift(benchmark::State& state)
+{
+    const long numSamples = state.range(0);
+    std::vector<CSmbPitchShift> shifters(NUM_CHANNELS);
+    std::vector<std::vector<float>> channels(NUM_CHANNELS, std::vector<float>(numSamples));
+    for (int channel = 0; channel < NUM_CHANNELS; ++channel)
+    {
+        for (long i = 0; i < numSamples; ++i)
+        {
+            channels[channel][i] = 0.5f * std::sin(0.01f * (channel + 1) * i);
+        }
+    }
+
+    for (auto _ : state)
+    {
+        for (int channel = 0; channel < NUM_CHANNELS; ++channel)
+        {
+            shifters[channel].smbPitchShift(
+                1.25f, numSamples, FFT_SIZE, 16, SAMPLE_RATE, channels[channel].data(), channels[channel].data());
+        }
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * numSamples * NUM_CHANNELS);
+}
+BENCHMARK(BM_SmbPitchShift)->Arg(FFT_SIZE)->Unit(benchmark::kMicrosecond);
+
+
+// Uncontended ring operations; the batch argument is the number of packets pushed before popping
+void BM_FQueuePushPop(benchmark::State& state)
+{
+    const int batch = state.range(0);
+    FQueue queue(batch);
+    queue.setLimits(1e6, int64_t(1) << 40);
+    AVPacket packet{};
+    packet.size = 4096;
+    packet.duration = 1;
+    packet.pos = -1;
+    unsigned int generation = 0;
+    int64_t dts = 0;
+
+    for (auto _ : state)
+    {
+        for (int i = 0; i < batch; ++i)
+        {
+            packet.dts = dts++;
+            queue.push(packet, AVRational{ 1, 90000 }, generation, std::false_type());
+        }
+        AVPacket popped;
+        for (int i = 0; i < batch; ++i)
+        {
+            queue.pop(popped, generation);
+        }
+        benchmark::DoNotOptimize(popped);
+    }
+    state.SetItemsProcessed(state.iterations() * batch);
+}
+BENCHMARK(BM_FQueuePushPop)->Arg(1)->Arg(64);
+
+// The handoff between the video thread and the conversion workers: every thread takes a token
+// and enters the ordered section with it
+void BM_OrderedScopedToken(benchmark::State& state)
+{
+    static std::unique_ptr<OrderedScopedTokenGenerator> generator;
+    if (state.thread_index() == 0)
+    {
+        generator = std::make_unique<OrderedScopedTokenGenerator>();
+    }
+
+    for (auto _ : state)
+    {
+        auto token = generator->generate();
+        auto scope = token.lock();
+        benchmark::DoNotOptimize(scope.valid());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_OrderedScopedToken)->Threads(1)->Threads(4)->UseRealTime();
+
+} // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,264 @@
+#include "synthetic.h"
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+}
+
+#include <cmath>
+#include <memory>
+
+namespace {
+
+enum { SAMPLE_RATE = 48000, CHANNELS = 2 };
+
+const double PI = 3.14159265358979323846;
+
+struct CodecContextDeleter
+{
+    void operator()(AVCodecContext* context) const { avcodec_free_context(&context); }
+};
+
+struct FrameDeleter
+{
+    void operator()(AVFrame* frame) const { av_frame_free(&frame); }
+};
+
+struct PacketDeleter
+{
+    void operator()(AVPacket* packet) const { av_packet_free(&packet); }
+};
+
+struct OutputContextDeleter
+{
+    void operator()(AVFormatContext* context) const
+    {
+        if (context->pb != nullptr)
+        {
+            avio_closep(&context->pb);
+        }
+        avformat_free_context(context);
+    }
+};
+
+typedef std::unique_ptr<AVCodecContext, CodecContextDeleter> CodecContextPtr;
+typedef std::unique_ptr<AVFrame, FrameDeleter> FramePtr;
+typedef std::unique_ptr<AVPacket, PacketDeleter> PacketPtr;
+
+struct Output
+{
+    CodecContextPtr codecContext;
+    AVStream* stream = nullptr;
+    FramePtr frame;
+    int64_t nextPts = 0;
+};
+
+bool addStream(AVFormatContext* formatContext, Output& output, AVCodecID codecId,
+    const SyntheticStream& parameters)
+{
+    const AVCodec* codec = avcodec_find_encoder(codecId);
+    if (codec == nullptr)
+    {
+        return false;
+    }
+
+    output.codecContext.reset(avcodec_alloc_context3(codec));
+    output.frame.reset(av_frame_alloc());
+    output.stream = avformat_new_stream(formatContext, nullptr);
+    if (!output.codecContext || !output.frame || output.stream == nullptr)
+    {
+        return false;
+    }
+
+    auto* context = output.codecContext.get();
+    auto* frame = output.frame.get();
+    if (codec->type == AVMEDIA_TYPE_VIDEO)
+    {
+        context->width = parameters.width;
+        context->height = parameters.height;
+        context->pix_fmt = AV_PIX_FMT_YUV420P;
+        context->time_base = AVRational{ 1, parameters.fps };
+        context->framerate = AVRational{ parameters.fps, 1 };
+        context->gop_size = parameters.fps;
+        context->bit_rate = int64_t(parameters.width) * parameters.height * parameters.fps / 8;
+
+        frame->format = context->pix_fmt;
+        frame->width = context->width;
+        frame->height = context->height;
+    }
+    else
+    {
+        context->sample_fmt = AV_SAMPLE_FMT_S16;
+        context->sample_rate = SAMPLE_RATE;
+        context->time_base = AVRational{ 1, SAMPLE_RATE };
+        context->bit_rate = 192000;
+#if LIBAVUTIL_VERSION_MAJOR < 57
+        context->channels = CHANNELS;
+        context->channel_layout = av_get_default_channel_layout(CHANNELS);
+#else
+        av_channel_layout_default(&context->ch_layout, CHANNELS);
+#endif
+    }
+
+    if (formatContext->oformat->flags & AVFMT_GLOBALHEADER)
+    {
+        context->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    }
+
+    if (avcodec_open2(context, codec, nullptr) < 0
+        || avcodec_parameters_from_context(output.stream->codecpar, context) < 0)
+    {
+        return false;
+    }
+    output.stream->time_base = context->time_base;
+
+    if (codec->type == AVMEDIA_TYPE_AUDIO)
+    {
+        frame->format = context->sample_fmt;
+        frame->sample_rate = context->sample_rate;
+        frame->nb_samples = context->frame_size;
+#if LIBAVUTIL_VERSION_MAJOR < 57
+        frame->channels = CHANNELS;
+        frame->channel_layout = context->channel_layout;
+#else
+        av_channel_layout_copy(&frame->ch_layout, &context->ch_layout);
+#endif
+    }
+
+    return av_frame_get_buffer(frame, 0) >= 0;
+}
+
+// A gradient moving by a pixel per frame, so that every frame differs
+void fillVideoFrame(AVFrame* frame, int64_t index)
+{
+    for (int y = 0; y < frame->height; ++y)
+    {
+        uint8_t* row = frame->data[0] + y * frame->linesize[0];
+        for (int x = 0; x < frame->width; ++x)
+        {
+            row[x] = uint8_t(x + y + index);
+        }
+    }
+    for (int plane = 1; plane < 3; ++plane)
+    {
+        for (int y = 0; y < frame->height / 2; ++y)
+        {
+            uint8_t* row = frame->data[plane] + y * frame->linesize[plane];
+            for (int x = 0; x < frame->width / 2; ++x)
+            {
+                row[x] = uint8_t(128 + plane * (x - y) + index * 2);
+            }
+        }
+    }
+}
+
+// 440 Hz
+void fillAudioFrame(AVFrame* frame, int64_t firstSample)
+{
+    auto* samples = reinterpret_cast<int16_t*>(frame->data[0]);
+    for (int i = 0; i < frame->nb_samples; ++i)
+    {
+        const auto value = int16_t(8000 * std::sin(2 * PI * 440 * (firstSample + i) / SAMPLE_RATE));
+        for (int channel = 0; channel < CHANNELS; ++channel)
+        {
+            *samples++ = value;
+        }
+    }
+}
+
+// frame is nullptr to flush the encoder
+bool encode(AVFormatContext* formatContext, Output& output, AVFrame* frame, AVPacket* packet)
+{
+    if (avcodec_send_frame(output.codecContext.get(), frame) < 0)
+    {
+        return false;
+    }
+
+    int ret;
+    while ((ret = avcodec_receive_packet(output.codecContext.get(), packet)) == 0)
+    {
+        av_packet_rescale_ts(packet, output.codecContext->time_base, output.stream->time_base);
+        packet->stream_index = output.stream->index;
+        if (av_interleaved_write_frame(formatContext, packet) < 0)
+        {
+            return false;
+        }
+    }
+    return ret == AVERROR(EAGAIN) || ret == AVERROR_EOF;
+}
+
+} // namespace
+
+bool WriteSyntheticStream(const std::string& path, const SyntheticStream& parameters)
+{
+    AVFormatContext* formatContext = nullptr;
+    if (avformat_alloc_output_context2(&formatContext, nullptr, "mpeg", path.c_str()) < 0)
+    {
+        return false;
+    }
+    std::unique_ptr<AVFormatContext, OutputContextDeleter> formatContextGuard(formatContext);
+
+    Output video;
+    Output audio;
+    if (!addStream(formatContext, video, AV_CODEC_ID_MPEG1VIDEO, parameters)
+        || (parameters.audio && !addStream(formatContext, audio, AV_CODEC_ID_MP2, parameters)))
+    {
+        return false;
+    }
+
+    if (avio_open(&formatContext->pb, path.c_str(), AVIO_FLAG_WRITE) < 0
+        || avformat_write_header(formatContext, nullptr) < 0)
+    {
+        return false;
+    }
+
+    PacketPtr packet(av_packet_alloc());
+    const int64_t numFrames = std::llround(parameters.seconds * parameters.fps);
+    const int64_t numSamples = std::llround(parameters.seconds * SAMPLE_RATE);
+
+    // Interleaved by presentation time
+    for (;;)
+    {
+        const bool videoLeft = video.nextPts < numFrames;
+        const bool audioLeft = parameters.audio && audio.nextPts < numSamples;
+        if (!videoLeft && !audioLeft)
+        {
+            break;
+        }
+
+        const bool writeVideo = videoLeft && (!audioLeft
+            || av_compare_ts(video.nextPts, video.codecContext->time_base,
+                audio.nextPts, audio.codecContext->time_base) <= 0);
+        Output& output = writeVideo ? video : audio;
+        AVFrame* frame = output.frame.get();
+        if (av_frame_make_writable(frame) < 0)
+        {
+            return false;
+        }
+
+        if (writeVideo)
+        {
+            fillVideoFrame(frame, output.nextPts);
+            frame->pts = output.nextPts++;
+        }
+        else
+        {
+            fillAudioFrame(frame, output.nextPts);
+            frame->pts = output.nextPts;
+            output.nextPts += frame->nb_samples;
+        }
+
+        if (!encode(formatContext, output, frame, packet.get()))
+        {
+            return false;
+        }
+    }
+
+    if (!encode(formatContext, video, nullptr, packet.get())
+        || (parameters.audio && !encode(formatContext, audio, nullptr, packet.get())))
+    {
+        return false;
+    }
+
+    return av_write_trailer(formatContext) >= 0;
+}
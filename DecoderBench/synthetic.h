@@ -0,0 +1,17 @@
+#pragma once
+
+#include <string>
+
+// Parameters of a generated test stream
+struct SyntheticStream
+{
+    int width = 640;
+    int height = 360;
+    int fps = 25;
+    double seconds = 10;
+    bool audio = true; // 48 kHz stereo tone
+};
+
+// Encodes a moving test pattern, and a tone, into an MPEG program stream at path,
+// so that simulations don't depend on media files; returns false on failure
+bool WriteSyntheticStream(const std::string& path, const SyntheticStream& stream);
@@ -263,6 +263,10 @@ void CDialogBarPlayerControl::OnHScroll(UINT nSBCode, UINT nPos, CScrollBar* pSc
                     break;
 
                 case SB_THUMBTRACK:
+                    if (!m_tracking)
+                    {
+                        m_pDoc->setScrubbing(true);
+                    }
                     m_pDoc->seekByPercent(m_progressSlider.GetPos() / double(RANGE_MAX));
                     m_tracking = true;
                     break;
@@ -272,6 +276,10 @@ void CDialogBarPlayerControl::OnHScroll(UINT nSBCode, UINT nPos, CScrollBar* pSc
                     break;
 
                 case SB_ENDSCROLL:
+                    if (m_tracking)
+                    {
+                        m_pDoc->setScrubbing(false);
+                    }
                     m_tracking = false;
                     break;
             }
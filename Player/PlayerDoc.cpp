@@ -29,6 +29,7 @@
 #include "FrameTransformer.h"
 
 #include <propkey.h>
+#include <Shlobj.h>
 #include <memory>
 
 #include <boost/icl/interval_map.hpp>
@@ -168,6 +169,19 @@ CString getScriptTempPath()
     return szTempPath;
 }
 
+// In the app-data folder; empty if it can't be created
+CString getProbeCachePath()
+{
+    TCHAR szPath[MAX_PATH]{};
+    if (!SHGetSpecialFolderPath(nullptr, szPath, CSIDL_LOCAL_APPDATA, TRUE))
+        return {};
+    PathAppend(szPath, _T("FFMPEG Player"));
+    if (!CreateDirectory(szPath, nullptr) && GetLastError() != ERROR_ALREADY_EXISTS)
+        return {};
+    PathAppend(szPath, _T("probecache.txt"));
+    return szPath;
+}
+
 
 // A function that locks a file for writing but leaves it unmodified
 HANDLE lockFile(LPCTSTR fileName)
@@ -379,6 +393,12 @@ CPlayerDoc::CPlayerDoc()
         m_bUsingHHO = !!pApp->GetProfileInt(szPlayerInitFlags, szUsingHHO, false);
         m_videoFilter = pApp->GetProfileString(szPlayerState, szVideoFilter, _T(""));
     }
+
+    const CString probeCachePath = getProbeCachePath();
+    if (!probeCachePath.IsEmpty())
+    {
+        m_frameDecoder->setProbeCacheFile(std::string(CT2A(probeCachePath, CP_UTF8)));
+    }
 }
 
 CPlayerDoc::~CPlayerDoc()
@@ -1156,6 +1176,11 @@ bool CPlayerDoc::seekByPercent(double percent)
     return m_frameDecoder->seekByPercent(percent);
 }
 
+void CPlayerDoc::setScrubbing(bool scrubbing)
+{
+    m_frameDecoder->setScrubbing(scrubbing);
+}
+
 void CPlayerDoc::seekToEnd()
 {
     if (m_autoPlay && m_currentTime - m_startTime > 5) // enable after 5 seconds
@@ -89,6 +89,7 @@ public:
     bool nextFrame();
     bool prevFrame();
     bool seekByPercent(double percent);
+    void setScrubbing(bool scrubbing);
     void seekToEnd();
     void setVolume(double volume);
 
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Scales interleaved signed 16 bit samples in place; WriteAudio applies it to every audio buffer
+inline void ScaleVolume(int16_t* samples, size_t count, double volume)
+{
+    for (size_t i = 0; i < count; ++i) {
+        samples[i] *= volume;
+    }
+}
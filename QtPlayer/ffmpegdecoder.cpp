@@ -6,11 +6,20 @@
 
 #include "videodisplay.h"
 
+#include <QDir>
+#include <QStandardPaths>
+
 FFmpegDecoderWrapper::FFmpegDecoderWrapper()
     : m_frameDecoder(
         GetFrameDecoder(std::make_unique<PortAudioPlayer>()))
 {
     m_frameDecoder->setDecoderListener(this);
+
+    const QString cacheDir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+    if (!cacheDir.isEmpty() && QDir().mkpath(cacheDir))
+    {
+        m_frameDecoder->setProbeCacheFile(QDir(cacheDir).filePath(QStringLiteral("probecache.txt")).toStdString());
+    }
 }
 
 FFmpegDecoderWrapper::~FFmpegDecoderWrapper() = default;
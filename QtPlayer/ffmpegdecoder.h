@@ -33,6 +33,7 @@ public:
         emit volumeChanged(volume);
     }
     bool seekByPercent(float percent) { return m_frameDecoder->seekByPercent(percent); }
+    void setScrubbing(bool scrubbing) { m_frameDecoder->setScrubbing(scrubbing); }
 
     double volume() const { return m_frameDecoder->volume(); }
     bool isPlaying() const { return m_frameDecoder->isPlaying(); }
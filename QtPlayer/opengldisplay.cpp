@@ -1,15 +1,21 @@
 #include "opengldisplay.h"
+#include "rgbtoyuv.h"
 
 // https://github.com/MasterAler/SampleYUVRenderer
 
+#include <QOpenGLBuffer>
 #include <QOpenGLShader>
 #include <QOpenGLTexture>
 #include <QCoreApplication>
+#include <QGenericMatrix>
 #include <QResizeEvent>
+#include <QVector3D>
 
 #include <algorithm>
 #include <atomic>
+#include <condition_variable>
 #include <mutex>
+#include <thread>
 
 
 enum {
@@ -18,27 +24,204 @@ PROGRAM_TEXCOORD_ATTRIBUTE = 1,
 
 ATTRIB_VERTEX = 0,
 ATTRIB_TEXTURE = 1,
+
+PIXEL_BUFFER_RING_SIZE = 3,
+};
+
+// Fragment shaders by the chroma plane layout
+enum ShaderVariant {
+SHADER_PLANAR,          // U and V planes
+SHADER_SEMI_PLANAR_8,   // 8 bit UV plane in a luminance alpha texture
+SHADER_SEMI_PLANAR_16,  // 16 bit UV plane in an RG16 texture
+SHADER_VARIANT_COUNT
 };
 
+// Desktop GL only; 16 bit layouts aren't offered with GLES
+#ifndef GL_RED
+#define GL_RED 0x1903
+#endif
+#ifndef GL_RG
+#define GL_RG 0x8227
+#endif
+#ifndef GL_R16
+#define GL_R16 0x822A
+#endif
+#ifndef GL_RG16
+#define GL_RG16 0x822C
+#endif
+
+namespace {
+
+struct TexturePlane
+{
+    GLsizei width;
+    GLsizei height;
+    GLint internalFormat;
+    GLenum format;
+    GLenum type;
+    int bytesPerPixel;
+};
+
+struct TextureLayout
+{
+    int numPlanes;
+    TexturePlane planes[3];
+    ShaderVariant shader;
+    float sampleScale; // brings LSB aligned samples to the full texture range
+};
+
+TextureLayout GetTextureLayout(FrameRenderingData::Layout layout, GLsizei width, GLsizei height)
+{
+    const TexturePlane luma8{ width, height, GL_LUMINANCE, GL_LUMINANCE, GL_UNSIGNED_BYTE, 1 };
+    const TexturePlane luma16{ width, height, GL_R16, GL_RED, GL_UNSIGNED_SHORT, 2 };
+    const GLsizei chromaWidth = (width + 1) / 2;
+    const GLsizei chromaHeight = (height + 1) / 2;
+    const float lsb10Scale = 65535.F / 1023;
+
+    switch (layout)
+    {
+    case FrameRenderingData::LAYOUT_NV12:
+        return { 2, { luma8,
+            { chromaWidth, chromaHeight, GL_LUMINANCE_ALPHA, GL_LUMINANCE_ALPHA, GL_UNSIGNED_BYTE, 2 } },
+            SHADER_SEMI_PLANAR_8, 1.F };
+    case FrameRenderingData::LAYOUT_P010:
+        return { 2, { luma16,
+            { chromaWidth, chromaHeight, GL_RG16, GL_RG, GL_UNSIGNED_SHORT, 4 } },
+            SHADER_SEMI_PLANAR_16, 1.F };
+    case FrameRenderingData::LAYOUT_YUV420P10:
+        return { 3, { luma16,
+            { chromaWidth, chromaHeight, GL_R16, GL_RED, GL_UNSIGNED_SHORT, 2 },
+            { chromaWidth, chromaHeight, GL_R16, GL_RED, GL_UNSIGNED_SHORT, 2 } },
+            SHADER_PLANAR, lsb10Scale };
+    case FrameRenderingData::LAYOUT_YUV444P:
+        return { 3, { luma8, luma8, luma8 }, SHADER_PLANAR, 1.F };
+    case FrameRenderingData::LAYOUT_YUV444P10:
+        return { 3, { luma16, luma16, luma16 }, SHADER_PLANAR, lsb10Scale };
+    default: // YUV420P
+        return { 3, { luma8,
+            { chromaWidth, chromaHeight, GL_LUMINANCE, GL_LUMINANCE, GL_UNSIGNED_BYTE, 1 },
+            { chromaWidth, chromaHeight, GL_LUMINANCE, GL_LUMINANCE, GL_UNSIGNED_BYTE, 1 } },
+            SHADER_PLANAR, 1.F };
+    }
+}
+
+// YCbCr to RGB: rgb = colorMatrix * (yuv - colorOffset)
+void GetColorConversion(FrameRenderingData::ColorMatrix matrix, bool fullRange,
+    QMatrix3x3& colorMatrix, QVector3D& colorOffset)
+{
+    float kr, kb;
+    switch (matrix)
+    {
+    case FrameRenderingData::COLOR_MATRIX_BT709: kr = 0.2126F; kb = 0.0722F; break;
+    case FrameRenderingData::COLOR_MATRIX_BT2020: kr = 0.2627F; kb = 0.0593F; break;
+    default: kr = 0.299F; kb = 0.114F; break;
+    }
+    const float kg = 1.F - kr - kb;
+
+    // Limited range stretched to full
+    const float yScale = fullRange ? 1.F : 255.F / 219;
+    const float cScale = fullRange ? 1.F : 255.F / 224;
+
+    const float values[] = {
+        yScale, 0.F, 2.F * (1.F - kr) * cScale,
+        yScale, -2.F * kb * (1.F - kb) / kg * cScale, -2.F * kr * (1.F - kr) / kg * cScale,
+        yScale, 2.F * (1.F - kb) * cScale, 0.F,
+    };
+    colorMatrix = QMatrix3x3(values);
+    colorOffset = QVector3D(fullRange ? 0.F : 16.F / 255, 128.F / 255, 128.F / 255);
+}
+
+QByteArray FragmentShaderSource(bool isOpenGLES, ShaderVariant variant)
+{
+    QByteArray result = isOpenGLES ? "precision mediump float;\n" : "";
+    result += "varying vec2 textureOut; \
+    uniform sampler2D tex_y; \
+    uniform sampler2D tex_u; \
+    uniform sampler2D tex_v; \
+    uniform mat3 colorMatrix; \
+    uniform vec3 colorOffset; \
+    uniform float sampleScale; \
+    void main(void) \
+    { \
+        vec3 yuv; \
+        yuv.x = texture2D(tex_y, textureOut).r; ";
+    switch (variant)
+    {
+    case SHADER_SEMI_PLANAR_8:
+        result += "yuv.yz = texture2D(tex_u, textureOut).ra; ";
+        break;
+    case SHADER_SEMI_PLANAR_16:
+        result += "yuv.yz = texture2D(tex_u, textureOut).rg; ";
+        break;
+    default:
+        result += "yuv.y = texture2D(tex_u, textureOut).r; \
+        yuv.z = texture2D(tex_v, textureOut).r; ";
+        break;
+    }
+    result += "gl_FragColor = vec4(colorMatrix * (yuv * sampleScale - colorOffset), 1); \
+    }";
+    return result;
+}
+
+} // namespace
+
 struct OpenGLDisplay::OpenGLDisplayImpl
 {
     GLvoid*                 mBufYuv{nullptr};
     unsigned int mFrameSize{0};
 
+    // Decoded frame displayed without copying; takes precedence over mBufYuv
+    FrameRenderingHandle    mFrame;
+    std::atomic_bool        mRowLengthSupported{ false }; // GL_UNPACK_ROW_LENGTH: desktop GL or GLES 3
+
+    // Bumped on every new picture; paints without a new one don't upload
+    unsigned int            mFrameSerial{0};
+    unsigned int            mUploadedSerial{0};
+    GLsizei                 mTextureW{0}, mTextureH{0}; // texture storage size
+
+    // Pixel unpack buffers per plane, used in turn by the consecutive uploads
+    QOpenGLBuffer           mPixelBuffers[PIXEL_BUFFER_RING_SIZE][3];
+    int                     mPixelBufferIndex{0};
+    bool                    mPixelBuffersSupported{false};
+
     QOpenGLShader*          mVShader;
-    QOpenGLShader*          mFShader;
-    QOpenGLShaderProgram*   mShaderProgram;
+
+    struct ShaderProgram
+    {
+        QOpenGLShaderProgram* program;
+        int textureUniformY, textureUniformU, textureUniformV;
+        int colorMatrixUniform, colorOffsetUniform, sampleScaleUniform;
+    };
+    ShaderProgram           mShaderPrograms[SHADER_VARIANT_COUNT];
 
     QOpenGLTexture*         mTextureY;
     QOpenGLTexture*         mTextureU;
     QOpenGLTexture*         mTextureV;
 
     GLuint                  id_y, id_u, id_v;
-    int                     textureUniformY, textureUniformU, textureUniformV;
     GLsizei                 mVideoW, mVideoH;
 
+    // Plane layout and colour metadata of the current picture
+    FrameRenderingData::Layout      mLayout{ FrameRenderingData::LAYOUT_FRAME_FORMAT };
+    FrameRenderingData::ColorMatrix mColorMatrix{ FrameRenderingData::COLOR_MATRIX_BT601 };
+    bool                            mFullRange{ false };
+    FrameRenderingData::Layout      mTextureLayout{ FrameRenderingData::LAYOUT_FRAME_FORMAT };
+
+    std::atomic_uint        mNativeFrameLayouts{ 0 }; // supported by the context
+
     std::mutex m_mutex;
 
+    // Still pictures are converted on a worker thread; the latest one wins
+    std::thread             mPictureThread;
+    std::mutex              mPictureMutex;
+    std::condition_variable mPictureCV;
+    QImage                  mPendingPicture;
+    unsigned int            mPendingSerial{0};
+    bool                    mStopping{false};
+    std::atomic_uint        mPictureSerial{0}; // bumped by pictures and decoded frames alike
+    GLvoid*                 mSpareBuf{nullptr}; // worker's, swapped with mBufYuv
+    unsigned int            mSpareSize{0};
+
     float m_aspectRatio{ 0.75F };
 
     std::atomic_bool m_pendingUpdate = false;
@@ -55,6 +238,28 @@ OpenGLDisplay::OpenGLDisplay(QWidget* parent)
 
 OpenGLDisplay::~OpenGLDisplay()
 {
+    {
+        std::lock_guard<std::mutex> lock(impl->mPictureMutex);
+        impl->mStopping = true;
+    }
+    impl->mPictureCV.notify_all();
+    if (impl->mPictureThread.joinable())
+    {
+        impl->mPictureThread.join();
+    }
+    delete[] reinterpret_cast<unsigned char*>(impl->mSpareBuf);
+
+    // GL objects have to be freed in their context
+    makeCurrent();
+    for (auto& pixelBuffers : impl->mPixelBuffers)
+    {
+        for (auto& pixelBuffer : pixelBuffers)
+        {
+            pixelBuffer.destroy();
+        }
+    }
+    doneCurrent();
+
     delete[] reinterpret_cast<unsigned char*>(impl->mBufYuv);
 }
 
@@ -107,75 +312,41 @@ void OpenGLDisplay::initializeGL()
         throw OpenGlException();
     }
 
-    // Initialize the fragment shader function yuv converted to rgb
-    impl->mFShader = new QOpenGLShader(QOpenGLShader::Fragment, this);
-
-    // Fragment shader source code
-
-    const char *fsrc = (context()->isOpenGLES())
-    ? "precision mediump float; \
-    varying vec2 textureOut; \
-    uniform sampler2D tex_y; \
-    uniform sampler2D tex_u; \
-    uniform sampler2D tex_v; \
-    void main(void) \
-    { \
-        vec3 yuv; \
-        vec3 rgb; \
-        yuv.x = texture2D(tex_y, textureOut).r; \
-        yuv.y = texture2D(tex_u, textureOut).r - 0.5; \
-        yuv.z = texture2D(tex_v, textureOut).r - 0.5; \
-        rgb = mat3( 1,       1,         1, \
-                    0,       -0.39465,  2.03211, \
-                    1.13983, -0.58060,  0) * yuv; \
-        gl_FragColor = vec4(rgb, 1); \
-    }"
-    : "varying vec2 textureOut; \
-    uniform sampler2D tex_y; \
-    uniform sampler2D tex_u; \
-    uniform sampler2D tex_v; \
-    void main(void) \
-    { \
-        vec3 yuv; \
-        vec3 rgb; \
-        yuv.x = texture2D(tex_y, textureOut).r; \
-        yuv.y = texture2D(tex_u, textureOut).r - 0.5; \
-        yuv.z = texture2D(tex_v, textureOut).r - 0.5; \
-        rgb = mat3( 1,       1,         1, \
-                    0,       -0.39465,  2.03211, \
-                    1.13983, -0.58060,  0) * yuv; \
-        gl_FragColor = vec4(rgb, 1); \
-    }";
-
-    bCompile = impl->mFShader->compileSourceCode(fsrc);
-    if(!bCompile)
+    // Fragment shaders converting yuv to rgb, by the chroma plane layout
+    for (int variant = 0; variant < SHADER_VARIANT_COUNT; ++variant)
     {
-        throw OpenGlException();
+        auto fShader = new QOpenGLShader(QOpenGLShader::Fragment, this);
+        if (!fShader->compileSourceCode(FragmentShaderSource(context()->isOpenGLES(), ShaderVariant(variant))))
+        {
+            throw OpenGlException();
+        }
+
+        auto& shaderProgram = impl->mShaderPrograms[variant];
+        // Create a shader program container
+        shaderProgram.program = new QOpenGLShaderProgram(this);
+        // Add the fragment shader to the program container
+        shaderProgram.program->addShader(fShader);
+        // Add a vertex shader to the program container
+        shaderProgram.program->addShader(impl->mVShader);
+        // Bind the property vertexIn to the specified location ATTRIB_VERTEX, this property
+        // has a declaration in the vertex shader source
+        shaderProgram.program->bindAttributeLocation("vertexIn", ATTRIB_VERTEX);
+        // Bind the attribute textureIn to the specified location ATTRIB_TEXTURE, the attribute
+        // has a declaration in the vertex shader source
+        shaderProgram.program->bindAttributeLocation("textureIn", ATTRIB_TEXTURE);
+        //Link all the shader programs added to
+        shaderProgram.program->link();
+        // Read the position of the data variables tex_y, tex_u, tex_v in the shader, the declaration
+        // of these variables can be seen in
+        // fragment shader source
+        shaderProgram.textureUniformY = shaderProgram.program->uniformLocation("tex_y");
+        shaderProgram.textureUniformU = shaderProgram.program->uniformLocation("tex_u");
+        shaderProgram.textureUniformV = shaderProgram.program->uniformLocation("tex_v");
+        shaderProgram.colorMatrixUniform = shaderProgram.program->uniformLocation("colorMatrix");
+        shaderProgram.colorOffsetUniform = shaderProgram.program->uniformLocation("colorOffset");
+        shaderProgram.sampleScaleUniform = shaderProgram.program->uniformLocation("sampleScale");
     }
     
-    // Create a shader program container
-    impl->mShaderProgram = new QOpenGLShaderProgram(this);
-    // Add the fragment shader to the program container
-    impl->mShaderProgram->addShader(impl->mFShader);
-    // Add a vertex shader to the program container
-    impl->mShaderProgram->addShader(impl->mVShader);
-    // Bind the property vertexIn to the specified location ATTRIB_VERTEX, this property
-    // has a declaration in the vertex shader source
-    impl->mShaderProgram->bindAttributeLocation("vertexIn", ATTRIB_VERTEX);
-    // Bind the attribute textureIn to the specified location ATTRIB_TEXTURE, the attribute 
-    // has a declaration in the vertex shader source
-    impl->mShaderProgram->bindAttributeLocation("textureIn", ATTRIB_TEXTURE);
-    //Link all the shader programs added to
-    impl->mShaderProgram->link();
-    //activate all links
-    impl->mShaderProgram->bind();
-    // Read the position of the data variables tex_y, tex_u, tex_v in the shader, the declaration
-    // of these variables can be seen in 
-    // fragment shader source 
-    impl->textureUniformY = impl->mShaderProgram->uniformLocation("tex_y");
-    impl->textureUniformU = impl->mShaderProgram->uniformLocation("tex_u");
-    impl->textureUniformV = impl->mShaderProgram->uniformLocation("tex_v");
-    
     //Vertex matrix
     static const GLfloat vertexVertices[] = {
         -1.0F, -1.0F,
@@ -216,65 +387,245 @@ void OpenGLDisplay::initializeGL()
     // Get the texture index value of the returned v component
     impl->id_v = impl->mTextureV->textureId();
 
+    impl->mRowLengthSupported = !context()->isOpenGLES() || context()->format().majorVersion() >= 3;
+
+    // Pixel unpack buffers: desktop GL 2.1 or GLES 3, available with Mesa llvmpipe as well
+    impl->mPixelBuffersSupported = impl->mRowLengthSupported;
+    for (auto& pixelBuffers : impl->mPixelBuffers)
+    {
+        for (auto& pixelBuffer : pixelBuffers)
+        {
+            pixelBuffer = QOpenGLBuffer(QOpenGLBuffer::PixelUnpackBuffer);
+            pixelBuffer.setUsagePattern(QOpenGLBuffer::StreamDraw);
+            if (!impl->mPixelBuffersSupported || !pixelBuffer.create())
+            {
+                impl->mPixelBuffersSupported = false;
+            }
+        }
+    }
+    impl->mPixelBufferIndex = 0;
+    impl->mTextureW = impl->mTextureH = 0;
+
+    // Layouts sampled directly; they need a frame handle, hence row length support
+    unsigned int nativeFrameLayouts = 0;
+    if (impl->mRowLengthSupported)
+    {
+        nativeFrameLayouts = (1u << FrameRenderingData::LAYOUT_NV12) | (1u << FrameRenderingData::LAYOUT_YUV444P);
+        // 16 bit normalized textures
+        if (!context()->isOpenGLES()
+            && (context()->format().majorVersion() >= 3 || context()->hasExtension("GL_ARB_texture_rg")))
+        {
+            nativeFrameLayouts |= (1u << FrameRenderingData::LAYOUT_P010)
+                | (1u << FrameRenderingData::LAYOUT_YUV420P10) | (1u << FrameRenderingData::LAYOUT_YUV444P10);
+        }
+    }
+    impl->mNativeFrameLayouts = nativeFrameLayouts;
+    if (m_decoder != nullptr)
+    {
+        m_decoder->getFrameDecoder()->setNativeFrameLayouts(nativeFrameLayouts);
+    }
+
     glClearColor (0.3, 0.3, 0.3, 0.0); // set the background color
 //    qDebug("addr=%x id_y = %d id_u=%d id_v=%d\n", this, impl->id_y, impl->id_u, impl->id_v);
 }
 
+void OpenGLDisplay::allocateTextures(FrameRenderingData::Layout frameLayout, GLsizei width, GLsizei height)
+{
+    const auto layout = GetTextureLayout(frameLayout, width, height);
+    const GLuint ids[] = { impl->id_y, impl->id_u, impl->id_v };
+    for (int i = 0; i < layout.numPlanes; ++i)
+    {
+        const auto& plane = layout.planes[i];
+        glActiveTexture(GL_TEXTURE0 + i);
+        glBindTexture(GL_TEXTURE_2D, ids[i]);
+        // Storage only; filled by glTexSubImage2D
+        glTexImage2D(GL_TEXTURE_2D, 0, plane.internalFormat, plane.width, plane.height, 0,
+            plane.format, plane.type, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+
+    impl->mTextureW = width;
+    impl->mTextureH = height;
+    impl->mTextureLayout = frameLayout;
+}
+
+// Every plane is streamed through the next pixel buffer of the ring: the texture transfer from it
+// runs asynchronously, and the driver doesn't have to wait for the previous ones to finish.
+// Planes are read from client memory directly if the buffers are unavailable
+void OpenGLDisplay::uploadTextures(FrameRenderingData::Layout frameLayout, GLsizei width, GLsizei height,
+    const unsigned char* const planes[3], const GLint strides[3])
+{
+    const auto layout = GetTextureLayout(frameLayout, width, height);
+    const GLuint ids[] = { impl->id_y, impl->id_u, impl->id_v };
+
+    // Fixes abnormality with 174x100 yuv data
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+    glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+
+    auto& pixelBuffers = impl->mPixelBuffers[impl->mPixelBufferIndex];
+    impl->mPixelBufferIndex = (impl->mPixelBufferIndex + 1) % PIXEL_BUFFER_RING_SIZE;
+
+    for (int i = 0; i < layout.numPlanes; ++i)
+    {
+        const auto& plane = layout.planes[i];
+        const int rowSize = plane.width * plane.bytesPerPixel;
+        const int size = rowSize * plane.height;
+        const GLvoid* pixels = planes[i];
+        GLint rowLength = strides[i] / plane.bytesPerPixel;
+
+        QOpenGLBuffer* pixelBuffer = nullptr;
+        if (impl->mPixelBuffersSupported)
+        {
+            pixelBuffer = &pixelBuffers[i];
+            pixelBuffer->bind();
+            pixelBuffer->allocate(size); // orphans the previous storage
+            auto mapped = static_cast<unsigned char*>(pixelBuffer->mapRange(0, size,
+                QOpenGLBuffer::RangeWrite | QOpenGLBuffer::RangeInvalidateBuffer));
+            if (mapped != nullptr)
+            {
+                // Tightly packed rows
+                if (strides[i] == rowSize)
+                {
+                    memcpy(mapped, planes[i], size);
+                }
+                else
+                {
+                    auto src = planes[i];
+                    for (int j = 0; j < plane.height; ++j)
+                    {
+                        memcpy(mapped, src, rowSize);
+                        mapped += rowSize;
+                        src += strides[i];
+                    }
+                }
+                pixelBuffer->unmap();
+
+                pixels = nullptr; // offset in the bound buffer
+                rowLength = 0;
+            }
+            else
+            {
+                pixelBuffer->release();
+                pixelBuffer = nullptr;
+            }
+        }
+
+        glActiveTexture(GL_TEXTURE0 + i);
+        glBindTexture(GL_TEXTURE_2D, ids[i]);
+        if (impl->mRowLengthSupported)
+        {
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, rowLength);
+        }
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, plane.width, plane.height, plane.format, plane.type, pixels);
+
+        if (pixelBuffer != nullptr)
+        {
+            pixelBuffer->release();
+        }
+    }
+    if (impl->mRowLengthSupported)
+    {
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    }
+}
+
 void OpenGLDisplay::paintGL()
 {
     std::unique_lock<std::mutex> lock(impl->m_mutex);
 
-    if (!impl->mBufYuv) {
+    // Snapshot of the current picture, so that a decoded frame can be uploaded without the lock
+    const FrameRenderingHandle frame = impl->mFrame;
+    const GLsizei videoW = impl->mVideoW;
+    const GLsizei videoH = impl->mVideoH;
+    const auto frameLayout = impl->mLayout;
+    const auto frameSerial = impl->mFrameSerial;
+    QMatrix3x3 colorMatrix;
+    QVector3D colorOffset;
+    GetColorConversion(impl->mColorMatrix, impl->mFullRange, colorMatrix, colorOffset);
+
+    const unsigned char* planes[3];
+    GLint strides[3];
+    if (frame)
+    {
+        for (int i = 0; i < 3; ++i)
+        {
+            planes[i] = frame->image[i];
+            strides[i] = frame->pitch[i];
+        }
+    }
+    else if (impl->mBufYuv)
+    {
+        const int chromaWidth = (impl->mVideoW + 1) / 2;
+        const int chromaSize = chromaWidth * ((impl->mVideoH + 1) / 2);
+        planes[0] = static_cast<const unsigned char*>(impl->mBufYuv);
+        planes[1] = planes[0] + impl->mVideoW * impl->mVideoH;
+        planes[2] = planes[1] + chromaSize;
+        strides[0] = impl->mVideoW;
+        strides[1] = strides[2] = chromaWidth;
+    }
+    else
+    {
         return;
     }
 
+    // The decoded frame is kept alive by its handle; the still picture buffer is reused
+    // by convertPictures(), so it's read under the lock
+    if (frame)
+    {
+        lock.unlock();
+    }
+
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
 
-    // Load y data texture
-    // Activate the texture unit GL_TEXTURE0
-    glActiveTexture(GL_TEXTURE0);
-    // Use the texture generated from y to generate texture
-    glBindTexture(GL_TEXTURE_2D, impl->id_y);
+    // Texture storage is kept while the video size and layout don't change
+    if (impl->mTextureW != videoW || impl->mTextureH != videoH || impl->mTextureLayout != frameLayout)
+    {
+        allocateTextures(frameLayout, videoW, videoH);
+        impl->mUploadedSerial = frameSerial - 1;
+    }
 
-    // Fixes abnormality with 174x100 yuv data
-    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
-    glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
-    glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+    // Repaints on resize or expose reuse the textures
+    if (impl->mUploadedSerial != frameSerial)
+    {
+        uploadTextures(frameLayout, videoW, videoH, planes, strides);
+        impl->mUploadedSerial = frameSerial;
+    }
+
+    if (lock.owns_lock())
+    {
+        lock.unlock();
+    }
+
+    const auto layout = GetTextureLayout(frameLayout, videoW, videoH);
 
-    // Use the memory mBufYuv data to create a real y data texture
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, impl->mVideoW, impl->mVideoH, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, impl->mBufYuv);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    // Load u data texture
-    glActiveTexture(GL_TEXTURE1);//Activate texture unit GL_TEXTURE1
+    auto& shaderProgram = impl->mShaderPrograms[layout.shader];
+    shaderProgram.program->bind();
+
+    // Bind y, u and v textures to the texture units 0, 1 and 2
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, impl->id_y);
+    glActiveTexture(GL_TEXTURE1);
     glBindTexture(GL_TEXTURE_2D, impl->id_u);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, impl->mVideoW/2, impl->mVideoH/2
-                 , 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, static_cast<char*>(impl->mBufYuv) + impl->mVideoW * impl->mVideoH);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    // Load v data texture
-    glActiveTexture(GL_TEXTURE2);//Activate texture unit GL_TEXTURE2
+    glActiveTexture(GL_TEXTURE2);
     glBindTexture(GL_TEXTURE_2D, impl->id_v);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, impl->mVideoW / 2, impl->mVideoH / 2
-                 , 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, static_cast<char*>(impl->mBufYuv) + impl->mVideoW * impl->mVideoH * 5/4);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
     // Specify y texture to use the new value can only use 0, 1, 2, etc. to represent
     // the index of the texture unit, this is the place where opengl is not humanized
     //0 corresponds to the texture unit GL_TEXTURE0 1 corresponds to the
     // texture unit GL_TEXTURE1 2 corresponds to the texture unit GL_TEXTURE2
-    glUniform1i(impl->textureUniformY, 0);
+    glUniform1i(shaderProgram.textureUniformY, 0);
     // Specify the u texture to use the new value
-    glUniform1i(impl->textureUniformU, 1);
+    glUniform1i(shaderProgram.textureUniformU, 1);
     // Specify v texture to use the new value
-    glUniform1i(impl->textureUniformV, 2);
+    glUniform1i(shaderProgram.textureUniformV, 2);
+    // Colour conversion from the frame metadata
+    shaderProgram.program->setUniformValue(shaderProgram.colorMatrixUniform, colorMatrix);
+    shaderProgram.program->setUniformValue(shaderProgram.colorOffsetUniform, colorOffset);
+    shaderProgram.program->setUniformValue(shaderProgram.sampleScaleUniform, layout.sampleScale);
     // Use the vertex array way to draw graphics
     glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 
@@ -285,17 +636,52 @@ void OpenGLDisplay::paintGL()
 
 void OpenGLDisplay::updateFrame(IFrameDecoder* decoder, unsigned int generation)
 {
+    ++impl->mPictureSerial; // a still picture being converted is outdated now
+
+    // Keep a reference to the decoded frame instead of copying it if planes with padded rows can be uploaded
+    if (impl->mRowLengthSupported)
+    {
+        if (auto frame = decoder->getFrameRenderingHandle())
+        {
+            finishedDisplayingFrame(generation);
+
+            std::unique_lock<std::mutex> lock(impl->m_mutex);
+
+            impl->m_aspectRatio = float(frame->height) / frame->width;
+
+            impl->mVideoW = frame->width;
+            impl->mVideoH = frame->height;
+            impl->mLayout = frame->layout;
+            impl->mColorMatrix = frame->colorMatrix;
+            impl->mFullRange = frame->fullRange;
+
+            std::swap(impl->mFrame, frame);
+            ++impl->mFrameSerial;
+
+            lock.unlock();
+            return; // the previous frame is released here, outside the lock
+        }
+    }
+
     FrameRenderingData data;
     if (decoder->getFrameRenderingData(&data))
     {
         std::unique_lock<std::mutex> lock(impl->m_mutex);
 
+        impl->mFrame.reset();
+        ++impl->mFrameSerial;
+
         impl->m_aspectRatio = float(data.height) / data.width;
 
         impl->mVideoW = data.width;
         impl->mVideoH = data.height;
+        impl->mLayout = FrameRenderingData::LAYOUT_FRAME_FORMAT;
+        impl->mColorMatrix = data.colorMatrix;
+        impl->mFullRange = data.fullRange;
 
-        InitDrawBuffer(data.height * data.width * 3 / 2);
+        const int chromaWidth = (data.width + 1) / 2;
+        const int chromaHeight = (data.height + 1) / 2;
+        InitDrawBuffer(data.height * data.width + chromaHeight * chromaWidth * 2);
 
         auto dst = reinterpret_cast<unsigned char*>(impl->mBufYuv);
         int width = data.width;
@@ -309,8 +695,8 @@ void OpenGLDisplay::updateFrame(IFrameDecoder* decoder, unsigned int generation)
                 dst += width;
                 src += data.pitch[i];
             }
-            width = data.width / 2;
-            height = data.height / 2;
+            width = chromaWidth;
+            height = chromaHeight;
         }
     }
 
@@ -330,72 +716,89 @@ void OpenGLDisplay::showPicture(const QImage& img)
        return;
     }
 
-    const auto step = (img.format() == QImage::Format_RGB888)? 3 : 4;
-
-    const int width = img.width() & ~1;
-    const int height = img.height() & ~1;
-
-    std::unique_lock<std::mutex> lock(impl->m_mutex);
-
-    impl->m_aspectRatio = float(height) / width;
-
-    // RGB to YUV420
-    impl->mVideoW = width;
-    impl->mVideoH = height;
-
-    InitDrawBuffer(height * width * 3 / 2);
+    {
+        std::lock_guard<std::mutex> lock(impl->mPictureMutex);
+        impl->mPendingPicture = img; // shared, not copied
+        impl->mPendingSerial = ++impl->mPictureSerial;
+        if (!impl->mPictureThread.joinable())
+        {
+            impl->mPictureThread = std::thread(&OpenGLDisplay::convertPictures, this);
+        }
+    }
+    impl->mPictureCV.notify_one();
+}
 
-    int size = width*height;
-    // Y
-    for(unsigned y=0;y<height;y++)
+void OpenGLDisplay::convertPictures()
+{
+    for (;;)
     {
-       const auto *s = img.scanLine(y);
-       unsigned char *d = reinterpret_cast<unsigned char*>(impl->mBufYuv) + y*width;
+        QImage img;
+        unsigned int serial;
+        {
+            std::unique_lock<std::mutex> lock(impl->mPictureMutex);
+            impl->mPictureCV.wait(lock, [this] { return impl->mStopping || !impl->mPendingPicture.isNull(); });
+            if (impl->mStopping)
+            {
+                return;
+            }
+            std::swap(img, impl->mPendingPicture);
+            serial = impl->mPendingSerial;
+        }
+
+        if (img.format() == QImage::Format_RGB888)
+        {
+            img = img.convertToFormat(QImage::Format_RGB32);
+        }
 
-       for(unsigned x=0;x<width;x++)
-       {
-          unsigned int r=s[2];
-          unsigned int g=s[1];
-          unsigned int b=s[0];
+        const int width = img.width() & ~1;
+        const int height = img.height() & ~1;
+        if (width == 0 || height == 0)
+        {
+            continue;
+        }
 
-          unsigned Y = std::min((r*2104 + g*4130 + b*802 + 4096 + 131072) >> 13, 235U);
-          *d = Y;
+        // RGB to YUV420
+        const int size = width * height;
+        const unsigned int bufferSize = size * 3 / 2;
+        if (impl->mSpareSize < bufferSize)
+        {
+            delete[] reinterpret_cast<unsigned char*>(impl->mSpareBuf);
+            impl->mSpareSize = bufferSize;
+            impl->mSpareBuf = new unsigned char[bufferSize];
+        }
 
-          d++;
-          s+=step;
-       }
-    }
+        auto dst = static_cast<unsigned char*>(impl->mSpareBuf);
+        BgraToI420(img.constBits(), img.bytesPerLine(),
+            dst, width,
+            dst + size, width / 2,
+            dst + size * 5 / 4, width / 2,
+            width, height);
 
-    // U,V
-    const unsigned int ss = img.bytesPerLine();
-    for(unsigned y=0;y<height;y+=2)
-    {
-       const auto *s = img.scanLine(y);
-       unsigned char *d = reinterpret_cast<unsigned char*>(impl->mBufYuv) + size+y/2*width/2;
+        {
+            std::lock_guard<std::mutex> lock(impl->m_mutex);
+            if (serial != impl->mPictureSerial)
+            {
+                continue; // superseded by another picture or a decoded frame
+            }
 
-       for(unsigned x=0;x<width;x+=2)
-       {
-          // Cr = 128 + 1/256 * ( 112.439 * R'd -  94.154 * G'd -  18.285 * B'd)
-          // Cb = 128 + 1/256 * (- 37.945 * R'd -  74.494 * G'd + 112.439 * B'd)
+            std::swap(impl->mBufYuv, impl->mSpareBuf);
+            std::swap(impl->mFrameSize, impl->mSpareSize);
 
-          // Get the average RGB in a 2x2 block
-          int r=(s[2] + s[step+2] + s[ss+2] + s[ss+step+2] + 2) >> 2;
-          int g=(s[1] + s[step+1] + s[ss+1] + s[ss+step+1] + 2) >> 2;
-          int b=(s[0] + s[step] + s[ss+0] + s[ss+step] + 2) >> 2;
+            impl->mFrame.reset();
+            ++impl->mFrameSerial;
 
-          int Cb = std::clamp((-1214*r - 2384*g + 3598*b + 4096 + 1048576)>>13, 16, 240);
-          int Cr = std::clamp((3598*r - 3013*g - 585*b + 4096 + 1048576)>>13, 16, 240);
+            // BgraToI420() uses BT.601 limited range coefficients
+            impl->mLayout = FrameRenderingData::LAYOUT_FRAME_FORMAT;
+            impl->mColorMatrix = FrameRenderingData::COLOR_MATRIX_BT601;
+            impl->mFullRange = false;
 
-          *d = Cb;
-          *(d+size/4) = Cr;
+            impl->m_aspectRatio = float(height) / width;
+            impl->mVideoW = width;
+            impl->mVideoH = height;
+        }
 
-          d++;
-          s+=step * 2;
-       }
+        QMetaObject::invokeMethod(this, [this] { update(); });
     }
-
-    lock.unlock();
-    emit update();
 }
 
 void OpenGLDisplay::showPicture(const QPixmap& picture)
@@ -422,3 +825,5 @@ void OpenGLDisplay::decoderClosing()
 }
 
 float OpenGLDisplay::aspectRatio() const { return impl->m_aspectRatio; }
+
+unsigned int OpenGLDisplay::nativeFrameLayouts() const { return impl->mNativeFrameLayouts; }
@@ -29,11 +29,18 @@ public:
 
     float aspectRatio() const;
 
+    unsigned int nativeFrameLayouts() const override;
+
 protected:
     void initializeGL() override;
     void paintGL() override;
 
 private:
+    void convertPictures();
+    void allocateTextures(FrameRenderingData::Layout frameLayout, GLsizei width, GLsizei height);
+    void uploadTextures(FrameRenderingData::Layout frameLayout, GLsizei width, GLsizei height,
+        const unsigned char* const planes[3], const GLint strides[3]);
+
     struct OpenGLDisplayImpl;
     QScopedPointer<OpenGLDisplayImpl> impl;
 };
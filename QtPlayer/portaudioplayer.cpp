@@ -1,4 +1,5 @@
 #include "portaudioplayer.h"
+#include "audiovolume.h"
 
 #include <portaudio.h>
 #include <QThread>
@@ -66,10 +67,7 @@ bool PortAudioPlayer::WriteAudio(uint8_t* write_data, int64_t write_size)
         return false;
     }
 
-    auto* realData = (int16_t*)write_data;
-    for (unsigned int i = 0; i < write_size / 2; ++i) {
-        realData[i] *= m_volume;
-    }
+    ScaleVolume((int16_t*)write_data, write_size / 2, m_volume);
 
     const auto framesToWrite = write_size / m_FrameSize;
     auto err = Pa_WriteStream(m_stream, write_data, framesToWrite);
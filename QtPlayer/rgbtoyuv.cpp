@@ -0,0 +1,426 @@
+#include "rgbtoyuv.h"
+
+extern "C"
+{
+#include "libavutil/cpu.h"
+}
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#endif
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+// Fixed point, 13 bit fraction:
+// Y  =  16 + ( 65.738 * R +  129.057 * G +  25.064 * B) / 256
+// Cb = 128 + (-37.945 * R -   74.494 * G + 112.439 * B) / 256
+// Cr = 128 + (112.439 * R -   94.154 * G -  18.285 * B) / 256
+enum
+{
+    Y_R = 2104, Y_G = 4130, Y_B = 802, Y_BIAS = 4096 + 131072,
+    CB_R = -1214, CB_G = -2384, CB_B = 3598,
+    CR_R = 3598, CR_G = -3013, CR_B = -585,
+    C_BIAS = 4096 + 1048576,
+};
+
+typedef void (*BgraToYRowFunc)(const uint8_t* src, uint8_t* dst_y, int width);
+typedef void (*BgraToUVRowFunc)(const uint8_t* src0, const uint8_t* src1,
+    uint8_t* dst_u, uint8_t* dst_v, int width);
+
+void BgraToYRow_C(const uint8_t* src, uint8_t* dst_y, int width)
+{
+    for (int x = 0; x < width; ++x)
+    {
+        const unsigned int b = src[0];
+        const unsigned int g = src[1];
+        const unsigned int r = src[2];
+        dst_y[x] = std::min((r * Y_R + g * Y_G + b * Y_B + Y_BIAS) >> 13, 235U);
+        src += 4;
+    }
+}
+
+// width is the number of source pixels; the average of every 2x2 block is taken
+void BgraToUVRow_C(const uint8_t* src0, const uint8_t* src1, uint8_t* dst_u, uint8_t* dst_v, int width)
+{
+    for (int x = 0; x < width; x += 2)
+    {
+        const int b = (src0[0] + src0[4] + src1[0] + src1[4] + 2) >> 2;
+        const int g = (src0[1] + src0[5] + src1[1] + src1[5] + 2) >> 2;
+        const int r = (src0[2] + src0[6] + src1[2] + src1[6] + 2) >> 2;
+
+        *dst_u++ = std::clamp((CB_R * r + CB_G * g + CB_B * b + C_BIAS) >> 13, 16, 240);
+        *dst_v++ = std::clamp((CR_R * r + CR_G * g + CR_B * b + C_BIAS) >> 13, 16, 240);
+
+        src0 += 8;
+        src1 += 8;
+    }
+}
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+
+#define HAS_X86_KERNELS
+
+#if defined(__GNUC__) || defined(__clang__)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#else
+#define TARGET_AVX2
+#define TARGET_SSE2
+#endif
+
+// Weighted sums of two 16 bit BGRA pixels: the even 32 bit lanes hold the results
+TARGET_SSE2
+inline __m128i DotBgra_SSE2(__m128i pixels, __m128i weights)
+{
+    const __m128i sums = _mm_madd_epi16(pixels, weights);
+    return _mm_add_epi32(sums, _mm_srli_epi64(sums, 32));
+}
+
+// Gathers the even lanes of two DotBgra results
+TARGET_SSE2
+inline __m128i PackDots_SSE2(__m128i a, __m128i b)
+{
+    return _mm_unpacklo_epi64(_mm_shuffle_epi32(a, _MM_SHUFFLE(3, 3, 2, 0)),
+        _mm_shuffle_epi32(b, _MM_SHUFFLE(3, 3, 2, 0)));
+}
+
+// Y of 4 pixels
+TARGET_SSE2
+inline __m128i BgraToY4_SSE2(__m128i bgra, __m128i weights, __m128i bias)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i y = PackDots_SSE2(
+        DotBgra_SSE2(_mm_unpacklo_epi8(bgra, zero), weights),
+        DotBgra_SSE2(_mm_unpackhi_epi8(bgra, zero), weights));
+    return _mm_srai_epi32(_mm_add_epi32(y, bias), 13);
+}
+
+// 16 pixels per iteration
+TARGET_SSE2
+void BgraToYRow_SSE2(const uint8_t* src, uint8_t* dst_y, int width)
+{
+    const __m128i weights = _mm_setr_epi16(Y_B, Y_G, Y_R, 0, Y_B, Y_G, Y_R, 0);
+    const __m128i bias = _mm_set1_epi32(Y_BIAS);
+    const __m128i maxY = _mm_set1_epi16(235);
+
+    for (; width > 0; width -= 16)
+    {
+        const __m128i y0 = BgraToY4_SSE2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src)), weights, bias);
+        const __m128i y1 = BgraToY4_SSE2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 16)), weights, bias);
+        const __m128i y2 = BgraToY4_SSE2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 32)), weights, bias);
+        const __m128i y3 = BgraToY4_SSE2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 48)), weights, bias);
+        src += 64;
+
+        const __m128i y01 = _mm_min_epi16(_mm_packs_epi32(y0, y1), maxY);
+        const __m128i y23 = _mm_min_epi16(_mm_packs_epi32(y2, y3), maxY);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst_y), _mm_packus_epi16(y01, y23));
+        dst_y += 16;
+    }
+}
+
+// Rounded averages of the 2x2 blocks of 4 source pixels from each row: two 16 bit BGRA pixels
+TARGET_SSE2
+inline __m128i AverageBgra2x2_SSE2(__m128i row0, __m128i row1)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(row0, zero), _mm_unpacklo_epi8(row1, zero));
+    const __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(row0, zero), _mm_unpackhi_epi8(row1, zero));
+    const __m128i sums = _mm_unpacklo_epi64(
+        _mm_add_epi16(lo, _mm_srli_si128(lo, 8)),
+        _mm_add_epi16(hi, _mm_srli_si128(hi, 8)));
+    return _mm_srli_epi16(_mm_add_epi16(sums, _mm_set1_epi16(2)), 2);
+}
+
+// 8 source pixels, 4 UV pairs per iteration
+TARGET_SSE2
+void BgraToUVRow_SSE2(const uint8_t* src0, const uint8_t* src1, uint8_t* dst_u, uint8_t* dst_v, int width)
+{
+    const __m128i weightsU = _mm_setr_epi16(CB_B, CB_G, CB_R, 0, CB_B, CB_G, CB_R, 0);
+    const __m128i weightsV = _mm_setr_epi16(CR_B, CR_G, CR_R, 0, CR_B, CR_G, CR_R, 0);
+    const __m128i bias = _mm_set1_epi32(C_BIAS);
+    const __m128i minC = _mm_set1_epi16(16);
+    const __m128i maxC = _mm_set1_epi16(240);
+
+    for (; width > 0; width -= 8)
+    {
+        const __m128i avg0 = AverageBgra2x2_SSE2(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(src0)),
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(src1)));
+        const __m128i avg1 = AverageBgra2x2_SSE2(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(src0 + 16)),
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(src1 + 16)));
+        src0 += 32;
+        src1 += 32;
+
+        const __m128i u = _mm_srai_epi32(_mm_add_epi32(
+            PackDots_SSE2(DotBgra_SSE2(avg0, weightsU), DotBgra_SSE2(avg1, weightsU)), bias), 13);
+        const __m128i v = _mm_srai_epi32(_mm_add_epi32(
+            PackDots_SSE2(DotBgra_SSE2(avg0, weightsV), DotBgra_SSE2(avg1, weightsV)), bias), 13);
+
+        const __m128i uv = _mm_min_epi16(_mm_max_epi16(_mm_packs_epi32(u, v), minC), maxC);
+        const __m128i packed = _mm_packus_epi16(uv, uv);
+        const int u4 = _mm_cvtsi128_si32(packed);
+        const int v4 = _mm_cvtsi128_si32(_mm_srli_si128(packed, 4));
+        memcpy(dst_u, &u4, 4);
+        memcpy(dst_v, &v4, 4);
+        dst_u += 4;
+        dst_v += 4;
+    }
+}
+
+TARGET_AVX2
+inline __m256i DotBgra_AVX2(__m256i pixels, __m256i weights)
+{
+    const __m256i sums = _mm256_madd_epi16(pixels, weights);
+    return _mm256_add_epi32(sums, _mm256_srli_epi64(sums, 32));
+}
+
+// Works within 128 bit lanes, as the SSE2 version
+TARGET_AVX2
+inline __m256i PackDots_AVX2(__m256i a, __m256i b)
+{
+    return _mm256_unpacklo_epi64(_mm256_shuffle_epi32(a, _MM_SHUFFLE(3, 3, 2, 0)),
+        _mm256_shuffle_epi32(b, _MM_SHUFFLE(3, 3, 2, 0)));
+}
+
+// Y of 8 pixels, in order
+TARGET_AVX2
+inline __m256i BgraToY8_AVX2(__m256i bgra, __m256i weights, __m256i bias)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i y = PackDots_AVX2(
+        DotBgra_AVX2(_mm256_unpacklo_epi8(bgra, zero), weights),
+        DotBgra_AVX2(_mm256_unpackhi_epi8(bgra, zero), weights));
+    return _mm256_srai_epi32(_mm256_add_epi32(y, bias), 13);
+}
+
+// 32 pixels per iteration
+TARGET_AVX2
+void BgraToYRow_AVX2(const uint8_t* src, uint8_t* dst_y, int width)
+{
+    const __m256i weights = _mm256_setr_epi16(Y_B, Y_G, Y_R, 0, Y_B, Y_G, Y_R, 0,
+        Y_B, Y_G, Y_R, 0, Y_B, Y_G, Y_R, 0);
+    const __m256i bias = _mm256_set1_epi32(Y_BIAS);
+    const __m256i maxY = _mm256_set1_epi16(235);
+
+    for (; width > 0; width -= 32)
+    {
+        const __m256i y0 = BgraToY8_AVX2(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src)), weights, bias);
+        const __m256i y1 = BgraToY8_AVX2(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 32)), weights, bias);
+        const __m256i y2 = BgraToY8_AVX2(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 64)), weights, bias);
+        const __m256i y3 = BgraToY8_AVX2(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 96)), weights, bias);
+        src += 128;
+
+        // Packing works within 128-bit lanes; restore the quadword order
+        const __m256i y01 = _mm256_min_epi16(_mm256_permute4x64_epi64(_mm256_packs_epi32(y0, y1), 0xD8), maxY);
+        const __m256i y23 = _mm256_min_epi16(_mm256_permute4x64_epi64(_mm256_packs_epi32(y2, y3), 0xD8), maxY);
+        const __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(y01, y23), 0xD8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst_y), packed);
+        dst_y += 32;
+    }
+}
+
+TARGET_AVX2
+inline __m256i AverageBgra2x2_AVX2(__m256i row0, __m256i row1)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i lo = _mm256_add_epi16(_mm256_unpacklo_epi8(row0, zero), _mm256_unpacklo_epi8(row1, zero));
+    const __m256i hi = _mm256_add_epi16(_mm256_unpackhi_epi8(row0, zero), _mm256_unpackhi_epi8(row1, zero));
+    const __m256i sums = _mm256_unpacklo_epi64(
+        _mm256_add_epi16(lo, _mm256_srli_si256(lo, 8)),
+        _mm256_add_epi16(hi, _mm256_srli_si256(hi, 8)));
+    return _mm256_srli_epi16(_mm256_add_epi16(sums, _mm256_set1_epi16(2)), 2);
+}
+
+// 16 source pixels, 8 UV pairs per iteration
+TARGET_AVX2
+void BgraToUVRow_AVX2(const uint8_t* src0, const uint8_t* src1, uint8_t* dst_u, uint8_t* dst_v, int width)
+{
+    const __m256i weightsU = _mm256_setr_epi16(CB_B, CB_G, CB_R, 0, CB_B, CB_G, CB_R, 0,
+        CB_B, CB_G, CB_R, 0, CB_B, CB_G, CB_R, 0);
+    const __m256i weightsV = _mm256_setr_epi16(CR_B, CR_G, CR_R, 0, CR_B, CR_G, CR_R, 0,
+        CR_B, CR_G, CR_R, 0, CR_B, CR_G, CR_R, 0);
+    const __m256i bias = _mm256_set1_epi32(C_BIAS);
+    const __m256i minC = _mm256_set1_epi16(16);
+    const __m256i maxC = _mm256_set1_epi16(240);
+
+    for (; width > 0; width -= 16)
+    {
+        const __m256i avg0 = AverageBgra2x2_AVX2(
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src0)),
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src1)));
+        const __m256i avg1 = AverageBgra2x2_AVX2(
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src0 + 32)),
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src1 + 32)));
+        src0 += 64;
+        src1 += 64;
+
+        // Dots come as blocks 0, 1, 4, 5 | 2, 3, 6, 7
+        const __m256i order = _mm256_setr_epi32(0, 1, 4, 5, 2, 3, 6, 7);
+        const __m256i u = _mm256_permutevar8x32_epi32(_mm256_srai_epi32(_mm256_add_epi32(
+            PackDots_AVX2(DotBgra_AVX2(avg0, weightsU), DotBgra_AVX2(avg1, weightsU)), bias), 13), order);
+        const __m256i v = _mm256_permutevar8x32_epi32(_mm256_srai_epi32(_mm256_add_epi32(
+            PackDots_AVX2(DotBgra_AVX2(avg0, weightsV), DotBgra_AVX2(avg1, weightsV)), bias), 13), order);
+
+        // u in the low lane, v in the high one
+        const __m256i uv = _mm256_min_epi16(_mm256_max_epi16(
+            _mm256_permute4x64_epi64(_mm256_packs_epi32(u, v), 0xD8), minC), maxC);
+        const __m256i packed = _mm256_packus_epi16(uv, uv);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dst_u), _mm256_castsi256_si128(packed));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dst_v), _mm256_extracti128_si256(packed, 1));
+        dst_u += 8;
+        dst_v += 8;
+    }
+}
+
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+
+#define HAS_NEON_KERNELS
+
+// 8 pixels per iteration
+void BgraToYRow_NEON(const uint8_t* src, uint8_t* dst_y, int width)
+{
+    const uint32x4_t bias = vdupq_n_u32(Y_BIAS);
+    const uint8x8_t maxY = vdup_n_u8(235);
+
+    for (; width > 0; width -= 8)
+    {
+        const uint8x8x4_t bgra = vld4_u8(src);
+        src += 32;
+
+        const uint16x8_t b = vmovl_u8(bgra.val[0]);
+        const uint16x8_t g = vmovl_u8(bgra.val[1]);
+        const uint16x8_t r = vmovl_u8(bgra.val[2]);
+
+        uint32x4_t lo = vmlal_n_u16(bias, vget_low_u16(r), Y_R);
+        lo = vmlal_n_u16(lo, vget_low_u16(g), Y_G);
+        lo = vmlal_n_u16(lo, vget_low_u16(b), Y_B);
+        uint32x4_t hi = vmlal_n_u16(bias, vget_high_u16(r), Y_R);
+        hi = vmlal_n_u16(hi, vget_high_u16(g), Y_G);
+        hi = vmlal_n_u16(hi, vget_high_u16(b), Y_B);
+
+        const uint16x8_t y = vcombine_u16(vshrn_n_u32(lo, 13), vshrn_n_u32(hi, 13));
+        vst1_u8(dst_y, vmin_u8(vqmovn_u16(y), maxY));
+        dst_y += 8;
+    }
+}
+
+inline int16x4_t ChromaFromBgra_NEON(int16x4_t b, int16x4_t g, int16x4_t r, int16_t wb, int16_t wg, int16_t wr)
+{
+    int32x4_t acc = vmlal_n_s16(vdupq_n_s32(C_BIAS), b, wb);
+    acc = vmlal_n_s16(acc, g, wg);
+    acc = vmlal_n_s16(acc, r, wr);
+    const int16x4_t c = vshrn_n_s32(acc, 13);
+    return vmin_s16(vmax_s16(c, vdup_n_s16(16)), vdup_n_s16(240));
+}
+
+// 8 source pixels, 4 UV pairs per iteration
+void BgraToUVRow_NEON(const uint8_t* src0, const uint8_t* src1, uint8_t* dst_u, uint8_t* dst_v, int width)
+{
+    for (; width > 0; width -= 8)
+    {
+        const uint8x8x4_t row0 = vld4_u8(src0);
+        const uint8x8x4_t row1 = vld4_u8(src1);
+        src0 += 32;
+        src1 += 32;
+
+        // Pairwise sums of both rows, rounded to averages
+        const int16x4_t b = vreinterpret_s16_u16(vrshr_n_u16(vadd_u16(vpaddl_u8(row0.val[0]), vpaddl_u8(row1.val[0])), 2));
+        const int16x4_t g = vreinterpret_s16_u16(vrshr_n_u16(vadd_u16(vpaddl_u8(row0.val[1]), vpaddl_u8(row1.val[1])), 2));
+        const int16x4_t r = vreinterpret_s16_u16(vrshr_n_u16(vadd_u16(vpaddl_u8(row0.val[2]), vpaddl_u8(row1.val[2])), 2));
+
+        const int16x4_t u = ChromaFromBgra_NEON(b, g, r, CB_B, CB_G, CB_R);
+        const int16x4_t v = ChromaFromBgra_NEON(b, g, r, CR_B, CR_G, CR_R);
+        const uint8x8_t uv = vqmovun_s16(vcombine_s16(u, v));
+        vst1_lane_u32(reinterpret_cast<uint32_t*>(dst_u), vreinterpret_u32_u8(uv), 0);
+        vst1_lane_u32(reinterpret_cast<uint32_t*>(dst_v), vreinterpret_u32_u8(uv), 1);
+        dst_u += 4;
+        dst_v += 4;
+    }
+}
+
+#endif
+
+struct BgraToI420Kernels
+{
+    BgraToYRowFunc yRow = nullptr;
+    int yStep = 0;
+    BgraToUVRowFunc uvRow = nullptr;
+    int uvStep = 0; // source pixels
+};
+
+// Picked once, according to the features of the CPU we are running on
+const BgraToI420Kernels& GetBgraToI420Kernels()
+{
+    static const BgraToI420Kernels kernels = []
+    {
+        BgraToI420Kernels result;
+        const int flags = av_get_cpu_flags();
+        (void)flags;
+#ifdef HAS_X86_KERNELS
+        if (flags & AV_CPU_FLAG_AVX2)
+        {
+            result = { BgraToYRow_AVX2, 32, BgraToUVRow_AVX2, 16 };
+        }
+        else if (flags & AV_CPU_FLAG_SSE2)
+        {
+            result = { BgraToYRow_SSE2, 16, BgraToUVRow_SSE2, 8 };
+        }
+#elif defined(HAS_NEON_KERNELS)
+        if (flags & AV_CPU_FLAG_NEON)
+        {
+            result = { BgraToYRow_NEON, 8, BgraToUVRow_NEON, 8 };
+        }
+#endif
+        return result;
+    }();
+    return kernels;
+}
+
+} // namespace
+
+void BgraToI420(const uint8_t* src, int srcStride,
+    uint8_t* dstY, int strideY,
+    uint8_t* dstU, int strideU,
+    uint8_t* dstV, int strideV,
+    int width, int height)
+{
+    const auto& kernels = GetBgraToI420Kernels();
+    const int yCount = (kernels.yStep != 0) ? width - width % kernels.yStep : 0;
+    const int uvCount = (kernels.uvStep != 0) ? width - width % kernels.uvStep : 0;
+
+    for (int y = 0; y < height; y += 2)
+    {
+        const uint8_t* src0 = src + y * srcStride;
+        const uint8_t* src1 = src0 + srcStride;
+
+        for (const uint8_t* row : { src0, src1 })
+        {
+            uint8_t* dst = dstY + (row == src0 ? y : y + 1) * strideY;
+            if (yCount > 0)
+            {
+                kernels.yRow(row, dst, yCount);
+            }
+            if (yCount < width)
+            {
+                BgraToYRow_C(row + yCount * 4, dst + yCount, width - yCount);
+            }
+        }
+
+        uint8_t* u = dstU + y / 2 * strideU;
+        uint8_t* v = dstV + y / 2 * strideV;
+        if (uvCount > 0)
+        {
+            kernels.uvRow(src0, src1, u, v, uvCount);
+        }
+        if (uvCount < width)
+        {
+            BgraToUVRow_C(src0 + uvCount * 4, src1 + uvCount * 4, u + uvCount / 2, v + uvCount / 2, width - uvCount);
+        }
+    }
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstdint>
+
+// BGRA in memory (QImage::Format_RGB32 / Format_ARGB32) to planar YUV 4:2:0,
+// BT.601 limited range; width and height must be even.
+// Uses SSE2/AVX2 or NEON kernels picked at run time.
+void BgraToI420(const uint8_t* src, int srcStride,
+    uint8_t* dstY, int strideY,
+    uint8_t* dstU, int strideU,
+    uint8_t* dstV, int strideV,
+    int width, int height);
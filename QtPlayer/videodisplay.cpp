@@ -23,6 +23,7 @@ void VideoDisplay::setDecoderObject(FFmpegDecoderWrapper* decoder)
                     IFrameDecoder::PIX_FMT_RGB24
 #endif
                     , false);
+        m_decoder->getFrameDecoder()->setNativeFrameLayouts(nativeFrameLayouts());
     }
 }
 
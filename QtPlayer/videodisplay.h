@@ -15,6 +15,9 @@ public:
     virtual void showPicture(const QImage& picture) = 0;
     virtual void showPicture(const QPixmap& picture) = 0;
 
+    // Frame layouts the display samples as decoded; see IFrameDecoder::setNativeFrameLayouts()
+    virtual unsigned int nativeFrameLayouts() const { return 0; }
+
 protected:
     FFmpegDecoderWrapper* m_decoder{nullptr};
 };
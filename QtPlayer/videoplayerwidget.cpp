@@ -104,6 +104,11 @@ void VideoPlayerWidget::seekByPercent(float percent)
     getDecoder()->seekByPercent(percent);
 }
 
+void VideoPlayerWidget::setScrubbing(bool scrubbing)
+{
+    getDecoder()->setScrubbing(scrubbing);
+}
+
 void VideoPlayerWidget::playPauseButtonAction()
 {
     if (state() == Paused)
@@ -35,6 +35,7 @@ public:
 	void stopVideo(bool showDefaultImage = false);
 	bool isPaused();
     void seekByPercent(float percent);
+    void setScrubbing(bool scrubbing);
 
 	VideoDisplay* getCurrentDisplay();
 	VideoWidget* videoWidget() {return m_videoWidget;}
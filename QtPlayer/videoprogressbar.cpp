@@ -132,6 +132,10 @@ bool VideoProgressBar::eventFilter(QObject* obj, QEvent* event)
 	case QEvent::MouseButtonPress:
 	{
 		m_btn_down = true;
+		if (!m_seekDisabled)
+		{
+			VideoPlayerWidgetInstance()->setScrubbing(true);
+		}
 	}
 	break;
 	case QEvent::MouseButtonRelease:
@@ -145,6 +149,7 @@ bool VideoProgressBar::eventFilter(QObject* obj, QEvent* event)
 		{
             VideoPlayerWidgetInstance()->seekByPercent(percent);
 		}
+		VideoPlayerWidgetInstance()->setScrubbing(false);
 		m_btn_down = false;
 	}
 	break;
@@ -294,17 +294,11 @@ void VideoWidget::resizeEvent(QResizeEvent* event)
 	// FIXME: OpenGL full support
 #ifdef DEVELOPER_OPENGL
 	OpenGLDisplay::resizeEvent(event);
+#else
+	WidgetDisplay::resizeEvent(event);
 #endif
 }
 
-#ifndef DEVELOPER_OPENGL
-void VideoWidget::currentDisplay(unsigned int generation)
-{
-    WidgetDisplay::currentDisplay(generation);
-	m_originalFrame = *pixmap();
-}
-#endif
-
 void VideoWidget::onCursorTimer()
 {
 	if (isFullScreen() && (QDateTime::currentMSecsSinceEpoch() - m_lastMouseTime > 2000))
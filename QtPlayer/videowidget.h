@@ -27,7 +27,11 @@ public:
 
 	void setDefaultPreviewPicture();
 	QSize getPictureSize() const { return m_pictureSize; }
+#ifdef DEVELOPER_OPENGL
 	QPixmap originalFrame() const { return m_originalFrame; }
+#else
+	QPixmap originalFrame() const { return QPixmap::fromImage(currentFrame()); }
+#endif
 	QImage startImageButton() const { return m_startImgButton; }
 
 	QImage noPreviewImage() const { return m_noPreviewImg; }
@@ -77,11 +81,6 @@ private:
 public Q_SLOTS:
 	void fullScreen(bool isEnable = true);
 
-protected Q_SLOTS:
-#ifndef DEVELOPER_OPENGL
-    virtual void currentDisplay(unsigned int generation) override;
-#endif
-
 private Q_SLOTS:
 	void getImageFinished(const QImage& image);
 	void onCursorTimer();
@@ -1,21 +1,70 @@
 #include "widgetdisplay.h"
 
 #include <QDebug>
+#include <QPainter>
+#include <QResizeEvent>
 
 #include <utility>
 
+extern "C"
+{
+#include "libswscale/swscale.h"
+}
+
 WidgetDisplay::WidgetDisplay(QWidget* parent) : QLabel(parent)
 {
+    // Still pictures are shown as the label pixmap, video frames are painted directly
     setScaledContents(true);
     connect(this, &WidgetDisplay::display, this, &WidgetDisplay::currentDisplay);
 }
 
+WidgetDisplay::~WidgetDisplay()
+{
+    sws_freeContext(m_scaleContext);
+}
+
 void WidgetDisplay::currentDisplay(unsigned int generation)
 {
-    m_display = QPixmap::fromImage(m_image);
-    setPixmap(m_display);
+    QImage previousImage; // releases the previous frame outside the lock
+    {
+        std::lock_guard<std::mutex> lock(m_frameMutex);
+        if (m_framePending)
+        {
+            previousImage.swap(m_image);
+            m_image.swap(m_pendingImage);
+            // The previous prescaled image goes back to the display thread to be reused
+            std::swap(m_frame, m_pendingFrame);
+            m_framePending = false;
+        }
+    }
 
     finishedDisplayingFrame(generation);
+
+    update();
+}
+
+void WidgetDisplay::paintEvent(QPaintEvent* event)
+{
+    if (m_image.isNull())
+    {
+        QLabel::paintEvent(event);
+        return;
+    }
+
+    // A plain blit of the prescaled frame. Otherwise, as with prescaling off or after a resize
+    // until the next frame comes, the original one is scaled as it is drawn.
+    QPainter painter(this);
+    painter.drawImage(rect(), (m_frame.size() == size() * devicePixelRatioF()) ? m_frame : m_image);
+}
+
+void WidgetDisplay::resizeEvent(QResizeEvent* event)
+{
+    QLabel::resizeEvent(event);
+
+    const qreal pixelRatio = devicePixelRatioF();
+    std::lock_guard<std::mutex> lock(m_frameMutex);
+    m_targetSize = event->size() * pixelRatio;
+    m_targetPixelRatio = pixelRatio;
 }
 
 
@@ -26,21 +75,78 @@ void WidgetDisplay::showPicture(const QImage& picture)
 
 void WidgetDisplay::showPicture(const QPixmap& picture)
 {
+    m_image = QImage();
+    m_frame = QImage();
 	setPixmap(picture);
 }
 
 
 void WidgetDisplay::updateFrame(IFrameDecoder* decoder, unsigned int generation)
 {
-    FrameRenderingData data;
-    if (!decoder->getFrameRenderingData(&data))
+    // A reference to the decoded frame: the decoder takes another buffer for the next one while it is held
+    FrameRenderingHandle frame = decoder->getFrameRenderingHandle();
+    if (!frame)
     {
         return;
     }
 
-    m_aspectRatio = float(data.height) / data.width;
+    m_aspectRatio = float(frame->height) / frame->width;
+
+    // Read only image over the frame data; the last copy of it releases the frame
+    QImage image(static_cast<const uchar*>(frame->image[0]), frame->width, frame->height, frame->pitch[0],
+        QImage::Format_RGB888, [](void* info) { delete static_cast<FrameRenderingHandle*>(info); },
+        new FrameRenderingHandle(frame));
+
+    const bool prescaled = m_prescaleFrames && prescale(*frame);
+
+    std::lock_guard<std::mutex> lock(m_frameMutex);
+    m_pendingImage.swap(image); // a frame not displayed yet is released along with image
+    if (prescaled)
+    {
+        std::swap(m_pendingFrame, m_backBuffer);
+    }
+    else
+    {
+        m_pendingFrame = QImage();
+    }
+    m_framePending = true;
+}
+
+// Called on the display thread; SWS_FAST_BILINEAR has SIMD paths for packed RGB
+bool WidgetDisplay::prescale(const FrameRenderingData& data)
+{
+    QSize targetSize;
+    qreal pixelRatio;
+    {
+        std::lock_guard<std::mutex> lock(m_frameMutex);
+        targetSize = m_targetSize;
+        pixelRatio = m_targetPixelRatio;
+    }
+    if (targetSize.isEmpty())
+    {
+        return false;
+    }
+
+    m_scaleContext = sws_getCachedContext(m_scaleContext,
+        data.width, data.height, AV_PIX_FMT_RGB24,
+        targetSize.width(), targetSize.height(), AV_PIX_FMT_RGB32,
+        SWS_FAST_BILINEAR, nullptr, nullptr, nullptr);
+    if (m_scaleContext == nullptr)
+    {
+        return false;
+    }
+
+    // Normally the frame handed back by the UI thread; bits() would copy it if it were still shared
+    if (m_backBuffer.size() != targetSize || !m_backBuffer.isDetached())
+    {
+        m_backBuffer = QImage(targetSize, QImage::Format_RGB32);
+    }
 
-    m_image = QImage(data.image[0], data.width, data.height, data.pitch[0], QImage::Format_RGB888);
+    uint8_t* const dst[] = { m_backBuffer.bits() };
+    const int dstStride[] = { int(m_backBuffer.bytesPerLine()) };
+    sws_scale(m_scaleContext, data.image, data.pitch, 0, data.height, dst, dstStride);
+    m_backBuffer.setDevicePixelRatio(pixelRatio);
+    return true;
 }
 
 void WidgetDisplay::drawFrame(IFrameDecoder* decoder, unsigned int generation)
@@ -6,12 +6,17 @@
 #include <QPixmap>
 #include <QImage>
 
+#include <atomic>
+#include <mutex>
+
+struct SwsContext;
+
 class WidgetDisplay : public QLabel, public VideoDisplay
 {
 	Q_OBJECT
 public:
 	WidgetDisplay(QWidget* parent = nullptr);
-    ~WidgetDisplay() override = default;
+    ~WidgetDisplay() override;
 
 	void showPicture(const QImage& picture) override;
 	void showPicture(const QPixmap& picture) override;
@@ -23,13 +28,40 @@ public:
 
     float aspectRatio() const { return m_aspectRatio; }
 
+    // Scale frames to the widget size on the display thread, so that the UI thread only blits them;
+    // otherwise they are scaled as they are painted. On by default.
+    void setPrescaleFrames(bool enable) { m_prescaleFrames = enable; }
+    bool prescaleFrames() const { return m_prescaleFrames; }
+
+    // Last shown frame at its original resolution
+    QImage currentFrame() const { return m_image; }
+
 protected:
-	QImage m_image;
-	QPixmap m_display;
+    void paintEvent(QPaintEvent* event) override;
+    void resizeEvent(QResizeEvent* event) override;
+
+	QImage m_image;         // over the decoded frame, which it holds; null while a still picture is shown
+    QImage m_frame;         // m_image prescaled to the widget, painted as is while the size matches
     float m_aspectRatio { 0.75F };
 
 protected slots:
     virtual void currentDisplay(unsigned int generation);
 signals:
     void display(unsigned int generation);
+
+private:
+    bool prescale(const FrameRenderingData& data);
+
+    std::atomic_bool m_prescaleFrames { true };
+
+    // Display thread
+    SwsContext* m_scaleContext { nullptr };
+    QImage m_backBuffer;
+
+    std::mutex m_frameMutex;
+    QSize m_targetSize;     // device pixels
+    qreal m_targetPixelRatio { 1 };
+    QImage m_pendingImage;
+    QImage m_pendingFrame;  // null if not prescaled
+    bool m_framePending { false };
 };
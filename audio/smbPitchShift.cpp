@@ -44,13 +44,14 @@
 
 #include <memory>
 
+#if defined(__SSE3__) || defined(_M_X64) || defined(_M_IX86)
+#define SMB_USE_SSE3
 #include <emmintrin.h>
 #include <pmmintrin.h>
 #include <xmmintrin.h>
+#endif
 
 
-namespace {
-
 void smbFft(float *fftBuffer, long fftFrameSize, long sign)
 /* 
     FFT routine, (C)1996 S.M.Bernsee. Sign = -1 is FFT, 1 is iFFT (inverse)
@@ -87,7 +88,7 @@ void smbFft(float *fftBuffer, long fftFrameSize, long sign)
     for (long k = 0, le = 2; k < (long)(log(fftFrameSize)/log(2.)+.5); k++) {
         le <<= 1;
         const auto le2 = le>>1;
-        __declspec(align(8)) struct { float r, i; } u{ 1.0, 0.0 };
+        alignas(8) struct { float r, i; } u{ 1.0, 0.0 };
 
         const float arg = M_PI / (le2>>1);
         const float wr = cos(arg);
@@ -96,12 +97,13 @@ void smbFft(float *fftBuffer, long fftFrameSize, long sign)
             auto p1r = fftBuffer+j; 
             auto p2r = p1r+le2;
 
+            long i = j;
+#ifdef SMB_USE_SSE3
             __m128 u_ = _mm_castpd_ps(_mm_movedup_pd(_mm_load_sd((const double*)&u)));
 
             __m128 ldup = _mm_moveldup_ps(u_);
             __m128 hdup = _mm_movehdup_ps(u_);
 
-            long i = j;
             for (; i < 2*fftFrameSize - le; i += le * 2) 
             {
                 __m128 p2 = _mm_loadh_pi(_mm_castpd_ps(_mm_load_sd((const double*)p2r)), (const __m64*)(p2r + le));
@@ -123,9 +125,10 @@ void smbFft(float *fftBuffer, long fftFrameSize, long sign)
                 p1r += le * 2; 
                 p2r += le * 2; 
             }
+#endif
 
-
-            if (i < 2 * fftFrameSize) {
+            // Scalar butterflies: the odd one left by the SSE3 loop, or all of them without SSE3
+            for (; i < 2 * fftFrameSize; i += le, p1r += le, p2r += le) {
                 const auto p1i = p1r + 1;
                 const auto p2i = p2r + 1;
                 const float tr = *p2r * u.r - *p2i * u.i;
@@ -143,6 +146,8 @@ void smbFft(float *fftBuffer, long fftFrameSize, long sign)
 }
 
 
+namespace {
+
 // -----------------------------------------------------------------------------------------------------------------
 
 /*
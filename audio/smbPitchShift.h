@@ -2,6 +2,9 @@
 
 // http://blogs.zynaptiq.com/bernsee/pitch-shifting-using-the-ft/
 
+// In place complex FFT of fftFrameSize interleaved (re, im) pairs; sign is -1 for forward, 1 for inverse
+void smbFft(float *fftBuffer, long fftFrameSize, long sign);
+
 class CSmbPitchShift
 {
     enum { MAX_FRAME_LENGTH = 8192 };
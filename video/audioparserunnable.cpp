@@ -6,6 +6,7 @@
 
 #include <algorithm>
 #include <functional>
+#include <limits>
 #include <memory>
 #include <tuple>
 
@@ -89,6 +90,7 @@ FFmpegDecoder::AudioParams::operator =(const FFmpegDecoder::AudioParams& other)
 void FFmpegDecoder::audioParseRunnable()
 {
     CHANNEL_LOG(ffmpeg_threads) << "Audio thread started";
+    tracing::setThreadName("audio");
     bool initialized = false;
     bool failed = false;
 
@@ -100,6 +102,9 @@ void FFmpegDecoder::audioParseRunnable()
     std::vector<uint8_t> resampleBuffer;
 
     double scheduledEndTime = 0;
+    double seekTarget = std::numeric_limits<double>::lowest(); // audio ending before it is skipped
+
+    m_audioGeneration = m_decodingGeneration;
 
     auto useHandleAudioResultLam = [this, &failed](bool result)
     {
@@ -124,13 +129,35 @@ void FFmpegDecoder::audioParseRunnable()
     while (!boost::this_thread::interruption_requested())
     {
         AVPacket packet;
-        if (!m_audioPacketsQueue.pop(packet))
+        unsigned int generation;
+        if (!m_audioPacketsQueue.pop(packet, generation))
         {
             break;
         }
 
         auto packetGuard = MakeGuard(&packet, av_packet_unref);
 
+        if (generation != m_decodingGeneration)
+        {
+            continue; // queued before the seek
+        }
+
+        if (generation != m_audioGeneration)
+        {
+            m_audioGeneration = generation;
+            if (m_audioCodecContext != nullptr)
+            {
+                avcodec_flush_buffers(m_audioCodecContext);
+            }
+            m_audioPlayer->WaveOutReset();
+            initialized = false;
+            failed = false;
+            scheduledEndTime = 0;
+            const int64_t exactSeekDuration = m_exactSeekDuration;
+            seekTarget = (exactSeekDuration != AV_NOPTS_VALUE)
+                ? getDurationSecs(exactSeekDuration) : std::numeric_limits<double>::lowest();
+        }
+
         if (m_audioStreamNumber != packet.stream_index)
         {
             continue;
@@ -138,13 +165,18 @@ void FFmpegDecoder::audioParseRunnable()
 
         if (!initialized)
         {
+            if (packet.pts != AV_NOPTS_VALUE
+                && av_q2d(m_audioStream->time_base) * (packet.pts + packet.duration) <= seekTarget)
+            {
+                continue; // exact seek: preceding the seek position
+            }
             if (packet.pts == AV_NOPTS_VALUE)
             {
                 if (packet.data == nullptr)
                     continue;
 
                 assert(false && "No audio pts found");
-                return;
+                continue;
             }
             const double pts = av_q2d(m_audioStream->time_base) * packet.pts;
             m_audioPTS = pts;
@@ -162,6 +194,7 @@ void FFmpegDecoder::audioParseRunnable()
                 {
                     InterLockedAdd(m_videoStartClock, -diff);
                     InterLockedAdd(m_audioPTS, diff);
+                    DecoderMetricsCollector::increment(m_metrics.audioSyncCorrections);
                 }
                 else
                 {
@@ -212,14 +245,16 @@ bool FFmpegDecoder::handleAudioPacket(
     if (m_audioCodecContext == nullptr) {
         return false;
     }
-    const int ret = avcodec_send_packet(m_audioCodecContext, &packet);
+    const int ret = tracing::traced("avcodec_send_packet",
+        [this, &packet] { return avcodec_send_packet(m_audioCodecContext, &packet); });
     if (ret < 0) {
         return ret == AVERROR(EAGAIN) || ret == AVERROR_EOF;
     }
 
     AVFramePtr audioFrame(av_frame_alloc());
     bool result = true;
-    while (avcodec_receive_frame(m_audioCodecContext, audioFrame.get()) == 0)
+    while (tracing::traced("avcodec_receive_frame",
+        [this, &audioFrame] { return avcodec_receive_frame(m_audioCodecContext, audioFrame.get()); }) == 0)
     {
         if (audioFrame->nb_samples <= 0)
         {
@@ -367,6 +402,7 @@ bool FFmpegDecoder::handleAudioFrame(
         {
             delta = (m_videoStartClock != VIDEO_START_CLOCK_NOT_INITIALIZED)
                 ? GetHiResTime() - m_videoStartClock - m_audioPTS : 0;
+            m_metrics.setAudioDrift(delta);
         }
     }
 
@@ -384,10 +420,14 @@ bool FFmpegDecoder::handleAudioFrame(
                 ? (m_isPaused ? m_pauseTimer : GetHiResTime()) - m_videoStartClock - m_audioPTS : 0
                 , m_isPaused && !(skipAll = delta >= frame_clock))
         {
+            if (m_audioGeneration != m_decodingGeneration)
+            {
+                return true; // decoded before the seek
+            }
             m_isPausedCV.wait(locker);
         }
     }
-    else if (delta > 1 && m_formatContexts.size() > 1 && delta > frame_clock)
+    else if (delta > 1 && m_formatContexts.size() > 1 && delta > frame_clock && !m_freeRunning)
     {
         CHANNEL_LOG(ffmpeg_sync) << "Skip audio frame";
         skipAll = true;
@@ -403,10 +443,11 @@ bool FFmpegDecoder::handleAudioFrame(
     }
 
     // Audio sync
-    if (!failed && !skipAll && fabs(delta) > 0.1)
+    if (!failed && !skipAll && fabs(delta) > 0.1 && !m_freeRunning)
     {
         CHANNEL_LOG(ffmpeg_sync) << "Audio sync delta = " << delta;
         InterLockedAdd(m_videoStartClock, delta / 2);
+        DecoderMetricsCollector::increment(m_metrics.audioSyncCorrections);
     }
 
     if (m_audioPaused && !skipAll)
@@ -423,6 +464,7 @@ bool FFmpegDecoder::handleAudioFrame(
         return true;
     }
 
+    TRACE_SCOPE("WriteAudio");
     return m_audioPlayer->WriteAudio(write_data, write_size)
         || (m_audioPlayer->Close(), initAudioOutput())
         && (swr_free(&m_audioSwrContext), m_audioPlayer->WriteAudio(write_data, write_size));
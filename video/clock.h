@@ -0,0 +1,167 @@
+#pragma once
+
+#include "makeguard.h"
+
+#include <boost/atomic.hpp>
+#include <boost/chrono.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/lock_guard.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <functional>
+#include <set>
+
+// Time source of the audio/video synchronization.
+// The decoder reads the time and waits for presentation deadlines through it only,
+// so that a VirtualClock can make frame dropping and drift reproducible.
+class IClock
+{
+public:
+    typedef boost::chrono::high_resolution_clock::duration duration;
+    typedef boost::chrono::high_resolution_clock::time_point time_point;
+
+    virtual ~IClock() = default;
+
+    virtual time_point now() const = 0;
+
+    // Waits on cv, which lock is to be locked for, until pred() holds or the clock reaches deadline,
+    // time_point::max() waiting for pred() only; returns pred()
+    virtual bool waitUntil(boost::condition_variable& cv, boost::unique_lock<boost::mutex>& lock,
+        time_point deadline, const std::function<bool()>& pred) = 0;
+
+    virtual void sleepFor(duration time) = 0;
+
+    // Timed waits overshoot by up to this much, so the rest is to be spun
+    virtual duration spinTime() const = 0;
+};
+
+class SystemClock : public IClock
+{
+public:
+    time_point now() const override { return boost::chrono::high_resolution_clock::now(); }
+
+    bool waitUntil(boost::condition_variable& cv, boost::unique_lock<boost::mutex>& lock,
+        time_point deadline, const std::function<bool()>& pred) override
+    {
+        if (deadline == time_point::max())
+        {
+            cv.wait(lock, pred);
+            return true;
+        }
+        return cv.wait_until(lock, deadline, pred);
+    }
+
+    void sleepFor(duration time) override { boost::this_thread::sleep_for(time); }
+
+    duration spinTime() const override
+    {
+#ifdef _WIN32
+        return boost::chrono::microseconds(1500);
+#else
+        return boost::chrono::microseconds(500);
+#endif
+    }
+};
+
+inline IClock& GetSystemClock()
+{
+    static SystemClock instance;
+    return instance;
+}
+
+// Stands still until advanced by its owner. Threads waiting on it register their deadlines,
+// so that a simulation driver can jump straight to the next one once everybody is waiting.
+// Starts at the epoch of high_resolution_clock.
+class VirtualClock : public IClock
+{
+public:
+    time_point now() const override
+    {
+        return time_point(duration(m_now.load(boost::memory_order_acquire)));
+    }
+
+    // Waiters for other events poll the virtual time, as advancing doesn't know of their condition variables
+    bool waitUntil(boost::condition_variable& cv, boost::unique_lock<boost::mutex>& lock,
+        time_point deadline, const std::function<bool()>& pred) override
+    {
+        const auto registration = addDeadline(deadline);
+        // Interruption points throw
+        auto registrationGuard = MakeGuard(this,
+            [registration](VirtualClock* clock) { clock->removeDeadline(registration); });
+        while (!pred())
+        {
+            if (now() >= deadline)
+            {
+                return pred();
+            }
+            cv.wait_for(lock, POLL_INTERVAL);
+        }
+        return true;
+    }
+
+    void sleepFor(duration time) override
+    {
+        boost::unique_lock<boost::mutex> locker(m_mutex);
+        const auto deadline = now() + time;
+        const auto registration = m_deadlines.insert(deadline);
+        // m_mutex is relocked when the wait throws
+        auto registrationGuard = MakeGuard(&m_deadlines,
+            [registration](std::multiset<time_point>* deadlines) { deadlines->erase(registration); });
+        m_cv.wait(locker, [this, deadline] { return now() >= deadline; });
+    }
+
+    duration spinTime() const override { return {}; }
+
+    // Number of threads waiting for the clock
+    size_t waiters() const
+    {
+        boost::lock_guard<boost::mutex> locker(m_mutex);
+        return m_deadlines.size();
+    }
+
+    // The earliest deadline of the waiting threads; time_point::max() if nobody waits
+    time_point nextDeadline() const
+    {
+        boost::lock_guard<boost::mutex> locker(m_mutex);
+        return m_deadlines.empty() ? time_point::max() : *m_deadlines.begin();
+    }
+
+    // The clock never goes back
+    void advanceTo(time_point time)
+    {
+        {
+            boost::lock_guard<boost::mutex> locker(m_mutex);
+            if (time > now())
+            {
+                m_now.store(time.time_since_epoch().count(), boost::memory_order_release);
+            }
+        }
+        m_cv.notify_all();
+    }
+
+    void advance(duration step) { advanceTo(now() + step); }
+
+private:
+    typedef std::multiset<time_point>::iterator Registration;
+
+    Registration addDeadline(time_point deadline)
+    {
+        boost::lock_guard<boost::mutex> locker(m_mutex);
+        return m_deadlines.insert(deadline);
+    }
+
+    void removeDeadline(Registration registration)
+    {
+        boost::lock_guard<boost::mutex> locker(m_mutex);
+        m_deadlines.erase(registration);
+    }
+
+    // Real time
+    static constexpr boost::chrono::milliseconds POLL_INTERVAL{ 1 };
+
+    mutable boost::mutex m_mutex;
+    boost::condition_variable m_cv;
+    boost::atomic<duration::rep> m_now{ 0 };
+    std::multiset<time_point> m_deadlines;
+};
@@ -0,0 +1,243 @@
+#pragma once
+
+#include <boost/smart_ptr/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <memory>
+#include <vector>
+
+// Fixed set of threads running the asynchronous ImageConversionFunc path.
+// Jobs are taken in submission order; every worker keeps its scaler contexts
+// and NV12 buffers between frames, so steady state playback doesn't rebuild or reallocate them.
+// A job lives in a slot of a fixed set, which the frame converted into holds until it is finished.
+class ConversionPool
+{
+public:
+    struct WorkerContext
+    {
+        SwsContext* toNV12 = nullptr;    // cached by sws_getCachedContext() on size and format
+        SwsContext* fromNV12 = nullptr;
+        std::vector<uint8_t> input;      // NV12 image passed to the conversion function
+        std::vector<uint8_t> output;     // NV12 image it returns
+
+        WorkerContext() = default;
+        WorkerContext(const WorkerContext&) = delete;
+        WorkerContext& operator=(const WorkerContext&) = delete;
+
+        ~WorkerContext()
+        {
+            sws_freeContext(toNV12);
+            sws_freeContext(fromNV12);
+        }
+    };
+
+    // A conversion slot. The slots are allocated with the pool and reused, each with its input frame,
+    // so steady state playback doesn't allocate per frame.
+    class Job : public IFrameConversion
+    {
+    public:
+        OrderedScopedTokenGenerator::Token token;
+        AVFramePtr input{ av_frame_alloc() }; // references the decoded frame while the job is pending
+        boost::shared_ptr<IFrameDecoder::ImageConversionFunc> imageConversionFunc;
+        AVPixelFormat pixelFormat = AV_PIX_FMT_NONE;
+        TimingCounter* conversionTime = nullptr;
+
+        // Set by the submitter once it has got the frame to convert into; nullptr drops the result
+        void setOutput(VideoFrame* output)
+        {
+            bool release;
+            {
+                boost::lock_guard<boost::mutex> locker(m_mutex);
+                m_output = output;
+                m_outputSet = true;
+                release = output == nullptr && m_done;
+            }
+            m_cv.notify_all();
+            if (release)
+            {
+                m_pool->release(*this);
+            }
+        }
+
+        // Waits for setOutput() on the worker
+        VideoFrame* output()
+        {
+            boost::unique_lock<boost::mutex> locker(m_mutex);
+            m_cv.wait(locker, [this] { return m_outputSet; });
+            return m_output;
+        }
+
+        // The frame converted into gives the slot back
+        bool finish() override
+        {
+            bool result;
+            {
+                boost::unique_lock<boost::mutex> locker(m_mutex);
+                m_cv.wait(locker, [this] { return m_done; });
+                result = m_result;
+            }
+            m_pool->release(*this);
+            return result;
+        }
+
+    private:
+        friend class ConversionPool;
+
+        void complete(bool result)
+        {
+            bool release;
+            {
+                boost::lock_guard<boost::mutex> locker(m_mutex);
+                m_result = result;
+                m_done = true;
+                release = m_outputSet && m_output == nullptr;
+            }
+            m_cv.notify_all();
+            if (release)
+            {
+                m_pool->release(*this);
+            }
+        }
+
+        ConversionPool* m_pool = nullptr;
+        bool m_inUse = false; // guarded by the pool mutex
+
+        boost::mutex m_mutex;
+        boost::condition_variable m_cv;
+        bool m_outputSet = false;
+        VideoFrame* m_output = nullptr;
+        bool m_done = false;
+        bool m_result = false;
+    };
+
+    typedef bool (*JobFunc)(Job& job, WorkerContext& context);
+
+    // numJobs: conversions in flight at most, that is frames holding their results plus the one being submitted;
+    // acquire() waits for a slot beyond that
+    ConversionPool(JobFunc func, unsigned int numThreads, unsigned int numJobs)
+        : m_func(func)
+        , m_numJobs(numJobs)
+        , m_jobs(new Job[numJobs])
+        , m_queue(new Job*[numJobs])
+    {
+        for (unsigned int i = 0; i < numJobs; ++i)
+        {
+            m_jobs[i].m_pool = this;
+        }
+        for (unsigned int i = 0; i < numThreads; ++i)
+        {
+            m_threads.emplace_back(&ConversionPool::run, this);
+        }
+    }
+
+    ConversionPool(const ConversionPool&) = delete;
+    ConversionPool& operator=(const ConversionPool&) = delete;
+
+    // Pending jobs are completed: their frames wait for the results
+    ~ConversionPool()
+    {
+        {
+            boost::lock_guard<boost::mutex> locker(m_mutex);
+            m_stopping = true;
+        }
+        m_cv.notify_all();
+        for (auto& thread : m_threads)
+        {
+            thread.join();
+        }
+    }
+
+    // A free slot to fill in and submit(). Any free one rather than the next in turn: frames dropped unshown
+    // hold their slots until the frame queue reuses them.
+    Job& acquire()
+    {
+        boost::unique_lock<boost::mutex> locker(m_mutex);
+        Job* job = nullptr;
+        m_slotFreedCV.wait(locker, [this, &job]
+        {
+            for (unsigned int i = 0; i < m_numJobs; ++i)
+            {
+                if (!m_jobs[i].m_inUse)
+                {
+                    job = &m_jobs[i];
+                    return true;
+                }
+            }
+            return false;
+        });
+        job->m_inUse = true;
+
+        // Nobody else refers to a free slot
+        job->m_outputSet = false;
+        job->m_output = nullptr;
+        job->m_done = false;
+        job->m_result = false;
+        return *job;
+    }
+
+    // Jobs run in submission order
+    void submit(Job& job)
+    {
+        {
+            boost::lock_guard<boost::mutex> locker(m_mutex);
+            m_queue[(m_queueHead + m_queueSize) % m_numJobs] = &job;
+            ++m_queueSize;
+        }
+        m_cv.notify_one();
+    }
+
+    // Gives back a slot that is done with, or one acquired but not submitted
+    void release(Job& job)
+    {
+        av_frame_unref(job.input.get());
+        {
+            boost::lock_guard<boost::mutex> locker(m_mutex);
+            job.m_inUse = false;
+        }
+        m_slotFreedCV.notify_one();
+    }
+
+private:
+    void run()
+    {
+        tracing::setThreadName("conversion");
+        WorkerContext context;
+        for (;;)
+        {
+            Job* job;
+            {
+                boost::unique_lock<boost::mutex> locker(m_mutex);
+                m_cv.wait(locker, [this] { return m_stopping || m_queueSize != 0; });
+                if (m_queueSize == 0)
+                {
+                    return;
+                }
+                job = m_queue[m_queueHead];
+                m_queueHead = (m_queueHead + 1) % m_numJobs;
+                --m_queueSize;
+            }
+
+            TRACE_SCOPE("ConversionPool job");
+            const bool result = m_func(*job, context);
+            av_frame_unref(job->input.get());
+            job->complete(result);
+        }
+    }
+
+private:
+    JobFunc m_func;
+
+    const unsigned int m_numJobs;
+    std::unique_ptr<Job[]> m_jobs;
+
+    boost::mutex m_mutex;
+    boost::condition_variable m_cv;
+    boost::condition_variable m_slotFreedCV;
+    std::unique_ptr<Job*[]> m_queue; // ring of the submitted jobs
+    unsigned int m_queueHead = 0;
+    unsigned int m_queueSize = 0;
+    bool m_stopping = false;
+
+    std::vector<boost::thread> m_threads;
+};
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "decoderinterface.h"
+
+// Steps the video decoder through cheaper decoding modes while frames come late
+// and back once they come on time again.
+// Relaxing takes much longer than escalating, so the level doesn't oscillate
+// when the machine is just about fast enough.
+class DecodeQualityGovernor
+{
+public:
+    // lateness: seconds the frame is decoded after its presentation time; negative if early.
+    // Returns true if the level has changed.
+    bool update(double lateness, DecodeQualityLevel maxLevel)
+    {
+        enum
+        {
+            ESCALATE_FRAMES = 25,   // consecutive late frames
+            RELAX_FRAMES = 250,     // consecutive frames early enough
+        };
+        const double RELAX_MARGIN = 0.01;
+
+        if (m_level > maxLevel)
+        {
+            return setLevel(maxLevel);
+        }
+
+        if (lateness >= 0)
+        {
+            m_onTime = 0;
+            if (++m_late >= ESCALATE_FRAMES && m_level < maxLevel)
+            {
+                return setLevel(DecodeQualityLevel(m_level + 1));
+            }
+        }
+        else if (lateness < -RELAX_MARGIN)
+        {
+            m_late = 0;
+            if (++m_onTime >= RELAX_FRAMES && m_level > DECODE_QUALITY_FULL)
+            {
+                return setLevel(DecodeQualityLevel(m_level - 1));
+            }
+        }
+        else
+        {
+            m_late = 0;
+            m_onTime = 0;
+        }
+
+        return false;
+    }
+
+    DecodeQualityLevel level() const { return m_level; }
+
+    void reset() { setLevel(DECODE_QUALITY_FULL); }
+
+private:
+    bool setLevel(DecodeQualityLevel level)
+    {
+        m_late = 0;
+        m_onTime = 0;
+        if (level == m_level)
+        {
+            return false;
+        }
+        m_level = level;
+        return true;
+    }
+
+private:
+    DecodeQualityLevel m_level = DECODE_QUALITY_FULL;
+    int m_late = 0;
+    int m_onTime = 0;
+};
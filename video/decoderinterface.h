@@ -16,10 +16,29 @@ struct IDirect3DDevice9;
 struct IDirect3DSurface9;
 
 struct IFrameDecoder;
+class IClock;
 
 // Structure holding rendering data for a frame
 struct FrameRenderingData
 {
+    // Frame layouts passed to the display as decoded if enabled by IFrameDecoder::setNativeFrameLayouts();
+    // other frames are converted to the format set by IFrameDecoder::SetFrameFormat()
+    enum Layout {
+        LAYOUT_FRAME_FORMAT,  ///< The format set by SetFrameFormat()
+        LAYOUT_NV12,          ///< Y plane and interleaved UV plane, 4:2:0
+        LAYOUT_P010,          ///< 16 bit little endian Y and interleaved UV planes, 4:2:0, MSB aligned (P010, P016)
+        LAYOUT_YUV420P10,     ///< 16 bit little endian Y, U and V planes, 4:2:0, 10 LSB significant
+        LAYOUT_YUV444P,       ///< Y, U and V planes, 4:4:4
+        LAYOUT_YUV444P10,     ///< 16 bit little endian Y, U and V planes, 4:4:4, 10 LSB significant
+    };
+
+    // YCbCr to RGB matrix
+    enum ColorMatrix {
+        COLOR_MATRIX_BT601,
+        COLOR_MATRIX_BT709,
+        COLOR_MATRIX_BT2020,
+    };
+
     uint8_t** image{};      // Pointer to frame image data
     const int* pitch{};     // Pointer to pitch (stride) values for each plane
     int width;              // Frame width
@@ -27,10 +46,18 @@ struct FrameRenderingData
     int aspectNum;          // Numerator of aspect ratio
     int aspectDen;          // Denominator of aspect ratio
 
+    Layout layout{};                // Plane layout of image
+    ColorMatrix colorMatrix{};      // From the frame colour metadata, guessed by size if unspecified
+    bool fullRange{};               // Full (JPEG) or limited (MPEG) YCbCr range
+
     IDirect3DDevice9* d3d9device{};   // Direct3D device interface
     IDirect3DSurface9* surface{};     // Direct3D surface for rendering
 };
 
+// Reference to the picture buffers of a decoded frame: they stay valid and unchanged while
+// any copy is held, and are recycled by the decoder once the last copy is released
+typedef std::shared_ptr<const FrameRenderingData> FrameRenderingHandle;
+
 // Interface for listening to frame updates
 struct IFrameListener
 {
@@ -40,6 +67,16 @@ struct IFrameListener
     virtual void decoderClosing() = 0; // Called when decoder is closing
 };
 
+// Decoding shortcuts taken when the video decoder can't keep up, from the least to the most degrading
+enum DecodeQualityLevel
+{
+    DECODE_QUALITY_FULL,
+    DECODE_QUALITY_SKIP_LOOP_FILTER,  ///< Deblocking skipped
+    DECODE_QUALITY_SKIP_NONREF,       ///< Non-reference frames skipped as well
+    DECODE_QUALITY_SKIP_IDCT,         ///< IDCT skipped on all but keyframes as well
+    DECODE_QUALITY_LOWRES,            ///< Decoding at half resolution; only for codecs supporting it
+};
+
 // Interface for decoder event notifications
 struct FrameDecoderListener
 {
@@ -47,11 +84,14 @@ struct FrameDecoderListener
 
     virtual void changedFramePosition(long long /*start*/, long long /*frame*/, long long /*total*/) {}
     virtual void decoderClosed(bool /*fileReleased*/) {}   // Notification of decoder closure
-    virtual void fileLoaded(long long /*start*/, long long /*total*/) {} // Called when a file has been successfully loaded
+    // Called from the parse thread when a file has been successfully loaded, and again if its estimated duration gets refined
+    virtual void fileLoaded(long long /*start*/, long long /*total*/) {}
     virtual void volumeChanged(double /*volume*/) {}  // Called when volume level changes
 
     virtual void onEndOfStream(int /*idx*/, bool /*error*/) {} // Called when the end of the stream is reached
     virtual void onQueueFull(int /*idx*/) {}  // Called when the frame queue is full
+    virtual void onSeekFrameShown(double /*latency*/, bool /*exact*/) {} // First frame after a seek shown; latency in seconds
+    virtual void onDecodeQualityChanged(DecodeQualityLevel /*level*/) {} // Called from the video thread
 
     virtual void playingFinished() {}  // Called when playback finishes
 };
@@ -69,6 +109,97 @@ inline bool operator==(const RationalNumber& left, const RationalNumber& right)
     return left.numerator == right.numerator && left.denominator == right.denominator;
 }
 
+// Bounds of a demuxed packet queue
+struct PacketQueueLimits
+{
+    double maxSeconds;  // Media duration buffered ahead of the decoder
+    int64_t maxBytes;   // Safety net for streams lacking packet durations
+};
+
+// Read-ahead of the openStream() sources
+struct ReadAheadSettings
+{
+    int blockSize;  // Bytes per read of the source
+    int depth;      // Blocks a background thread reads ahead of the demuxer; 0 - reads on demand
+};
+
+// Stream probing of the opened inputs; 0 keeps the FFmpeg defaults
+struct ProbeSettings
+{
+    int64_t probeSize;        // Bytes read to find the format and the stream parameters
+    int64_t analyzeDuration;  // Microseconds of media analyzed for the stream parameters
+};
+
+// Software video decoding threading policy
+struct DecoderThreading
+{
+    enum Mode {
+        THREADING_AUTO,   ///< Frame or slice threading as the codec prefers
+        THREADING_FRAME,  ///< Frame-parallel decoding; every extra thread adds a frame of latency
+        THREADING_SLICE,  ///< Slice-parallel decoding; no extra latency, scales with slices per frame
+    };
+
+    Mode mode;
+    int threadCount;  // 0 - chosen by core count and resolution
+};
+
+// Presentation timing collected by the display thread
+struct PresentationStats
+{
+    enum { NUM_BUCKETS = 12 };
+
+    // Upper bound of a histogram bucket in microseconds, exclusive; the last bucket is open ended
+    static int64_t bucketLimit(int idx)
+    {
+        static const int64_t limits[NUM_BUCKETS - 1] = {
+            50, 100, 250, 500, 1000, 2000, 4000, 8000, 16667, 33333, 66667 };
+        return idx < NUM_BUCKETS - 1 ? limits[idx] : INT64_MAX;
+    }
+
+    uint64_t framesPresented;   // Passed to IFrameListener::drawFrame()
+    uint64_t framesLate;        // Presented, but reached after their presentation time
+    uint64_t framesDropped;     // Dropped for being late while the frame queue was full
+    double meanJitter;          // Seconds between the presentation time and the wake-up of frames waited for
+    double maxJitter;
+
+    uint64_t jitter[NUM_BUCKETS];   // Frames waited for, by jitter
+    uint64_t lateness[NUM_BUCKETS]; // Late and dropped frames, by how late they were reached
+};
+
+// Snapshot of the decoding pipeline counters; times are in seconds
+struct DecoderMetrics
+{
+    struct PacketQueue
+    {
+        int64_t packets;    // Demuxed packets waiting for the decoder
+        int64_t bytes;
+        double seconds;     // Media duration they cover
+    };
+
+    PacketQueue videoQueue;
+    PacketQueue audioQueue;
+
+    uint64_t framesDecoded;
+    double meanDecodeTime;      // Spent in avcodec_send_packet() and avcodec_receive_frame() per frame
+    double maxDecodeTime;
+
+    uint64_t framesConverted;
+    double meanConversionTime;  // frameToImage() or the ImageConversionFunc job
+    double maxConversionTime;
+
+    uint64_t framesHardSkipped; // Dropped by the video thread once decode quality can't be lowered further
+    uint64_t framesDropped;     // Dropped by the display thread, see PresentationStats
+    uint64_t framesAbandoned;   // Dropped after waiting for room in the frame queue in vain
+
+    uint64_t audioSyncCorrections; // Video clock adjustments made to follow the audio
+    double audioDrift;          // Video clock ahead of the audio at the latest audio frame
+    double maxAudioDrift;       // Absolute value
+
+    uint64_t seeks;             // Seeks that got to show a frame
+    double lastSeekLatency;
+    double meanSeekLatency;
+};
+
 // Interface for video frame decoding
 struct IFrameDecoder
 {
@@ -110,6 +241,10 @@ struct IFrameDecoder
     // Set frame format and whether Direct3D data should be allowed
     virtual void SetFrameFormat(FrameFormat format, bool allowDirect3dData) = 0;
 
+    // Frames decoded in these layouts skip the conversion to the frame format;
+    // bit mask of 1 << FrameRenderingData::Layout, none by default
+    virtual void setNativeFrameLayouts(unsigned int layouts) = 0;
+
     // Open video streams or URLs
     virtual bool openUrls(std::initializer_list<std::string> urls, const std::string& inputFormat = {}, bool useHHO = false) = 0;
     virtual bool openStream(std::unique_ptr<std::streambuf> stream) = 0;
@@ -124,6 +259,10 @@ struct IFrameDecoder
     virtual bool seekByPercent(double percent) = 0;
     virtual void videoReset() = 0;
 
+    // Timeline scrubbing: seeks requested meanwhile are coalesced and land on the nearest preceding
+    // keyframe; the exact frame is decoded once the position settles or scrubbing ends
+    virtual void setScrubbing(bool scrubbing) = 0;
+
     // Set event listeners
     virtual void setFrameListener(IFrameListener* listener) = 0;
     virtual void setDecoderListener(FrameDecoderListener* listener) = 0;
@@ -131,6 +270,10 @@ struct IFrameDecoder
     // Retrieve rendering data
     virtual bool getFrameRenderingData(FrameRenderingData* data) = 0;
 
+    // Same as getFrameRenderingData() but the frame may be kept past finishedDisplayingFrame(),
+    // e.g. until it has been painted, without copying it; empty for Direct3D surfaces
+    virtual FrameRenderingHandle getFrameRenderingHandle() = 0;
+
     virtual void doOnFinishedDisplayingFrame(unsigned int generation, FinishedDisplayingMode mode) = 0;
 
     // Notifies the decoder that a frame has finished displaying.
@@ -172,6 +315,10 @@ struct IFrameDecoder
     virtual bool getHwAccelerated() const = 0;
     virtual void setHwAccelerated(bool hwAccelerated) = 0;
 
+    // Software decoding threading; takes effect on the next open or videoReset()
+    virtual DecoderThreading getDecoderThreading() const = 0;
+    virtual void setDecoderThreading(const DecoderThreading& threading) = 0;
+
     // Retrieve properties of the content
     virtual std::vector<std::string> getProperties() const = 0;
 
@@ -187,6 +334,50 @@ struct IFrameDecoder
 
     // Set custom image conversion function
     virtual void setImageConversionFunc(ImageConversionFunc func) = 0;
+
+    // Packet buffering between demuxing and decoding; trades memory against rebuffer resilience
+    virtual std::pair<PacketQueueLimits, PacketQueueLimits> getPacketQueueLimits() const = 0; // video, audio
+    virtual void setPacketQueueLimits(const PacketQueueLimits& video, const PacketQueueLimits& audio) = 0;
+
+    // Decoded frames waiting for the display (2 to 16); takes effect on the next open
+    virtual int getFrameQueueDepth() const = 0;
+    virtual void setFrameQueueDepth(int depth) = 0;
+
+    // Takes effect on the next openStream()
+    virtual ReadAheadSettings getReadAhead() const = 0;
+    virtual void setReadAhead(const ReadAheadSettings& settings) = 0;
+
+    // Take effect on the next open. Stream layouts of the opened urls are remembered in the UTF-8 cacheFile,
+    // so that reopening them needs a minimal probe; an empty path disables the cache
+    virtual ProbeSettings getProbeSettings() const = 0;
+    virtual void setProbeSettings(const ProbeSettings& settings) = 0;
+    virtual void setProbeCacheFile(const std::string& cacheFile) = 0;
+
+    // Regular files on local fixed volumes are read through a memory mapping; takes effect on the next openUrls().
+    // Off by default
+    virtual bool getMemoryMappedInput() const = 0;
+    virtual void setMemoryMappedInput(bool memoryMapped) = 0;
+
+    // Frames are passed to the frame listener as soon as they are decoded, nothing is dropped for being late
+    // and the video clock doesn't follow the audio; for benchmarking
+    virtual bool getFreeRunning() const = 0;
+    virtual void setFreeRunning(bool freeRunning) = 0;
+
+    // Time source of the audio/video synchronization, the system clock by default (nullptr restores it);
+    // to be set while no file is open. The clock must outlive the decoder or its next setClock() call.
+    virtual void setClock(IClock* clock) = 0;
+
+    // Testing aid: the video thread waits this long on the decoder clock for every decoded frame,
+    // as a slower decoder would take
+    virtual void setSimulatedDecodeCost(double seconds) = 0;
+
+    // Presentation jitter and late frame histograms; reset on open
+    virtual PresentationStats getPresentationStats() const = 0;
+    virtual void resetPresentationStats() = 0;
+
+    // Pipeline counters; cheap enough to be always on, reset on open
+    virtual DecoderMetrics getMetrics() const = 0;
+    virtual void resetMetrics() = 0;
 };
 
 struct IAudioPlayer;
@@ -1,13 +1,370 @@
 #include "decoderiocontext.h"
+#include "mappedfile.h"
+#include "tracing.h"
 
 extern "C" {
 #include <libavformat/avformat.h>
 }
 
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/lock_guard.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/atomic.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+// The stream is read in pieces this large, so that a seek waits for one piece at most
+const std::streamsize READ_CHUNK_SIZE = 64 * 1024;
+
+int64_t toPosition(std::streampos pos)
+{
+    return (pos == std::streampos(std::streamoff(-1))) ? -1 : static_cast<int64_t>(pos);
+}
+
+} // namespace
+
+// Fills a ring of blocks from the stream on a background thread.
+// Blocks hold contiguous data starting at the read position; a seek into them only skips,
+// other seeks drop them and reposition the stream, the reader discarding the block in flight.
+class DecoderIOContext::ReadAhead
+{
+public:
+    ReadAhead(std::streambuf& stream, int blockSize, int depth)
+        : stream(stream), blocks(depth)
+    {
+        for (auto& block : blocks)
+        {
+            block.data.resize(blockSize);
+        }
+        position = readPosition = std::max<int64_t>(0, toPosition(stream.pubseekoff(0, std::ios_base::cur, std::ios_base::in)));
+        thread = boost::thread(&ReadAhead::run, this);
+    }
+
+    ~ReadAhead()
+    {
+        {
+            boost::lock_guard<boost::mutex> locker(mutex);
+            stopping = true;
+        }
+        spaceReady.notify_all();
+        thread.join();
+    }
+
+    ReadAhead(const ReadAhead&) = delete;
+    ReadAhead& operator=(const ReadAhead&) = delete;
+
+    // Called by the demuxing thread
+    int read(uint8_t* buf, int size)
+    {
+        // Waiting must not throw through FFmpeg; the interruption is reported as AVERROR_EXIT instead
+        boost::this_thread::disable_interruption disableInterruption;
+
+        boost::unique_lock<boost::mutex> locker(mutex);
+        while (head == tail)
+        {
+            if (error)
+                return AVERROR(EIO);
+            if (eof)
+                return AVERROR_EOF;
+            if (boost::this_thread::interruption_requested())
+                return AVERROR_EXIT;
+            TRACE_SCOPE("read-ahead wait");
+            dataReady.wait_for(locker, boost::chrono::milliseconds(10));
+        }
+
+        int copied = 0;
+        while (copied < size && head != tail)
+        {
+            const Block& block = blocks[head % blocks.size()];
+            const auto length = std::min<size_t>(size - copied, block.size - offset);
+            memcpy(buf + copied, block.data.data() + offset, length);
+            copied += static_cast<int>(length);
+            offset += length;
+            position += length;
+            if (offset == block.size)
+            {
+                ++head;
+                offset = 0;
+                spaceReady.notify_all();
+            }
+        }
+        return copied;
+    }
+
+    int64_t seek(int64_t pos, int whence)
+    {
+        whence &= ~AVSEEK_FORCE;
+        if (whence == AVSEEK_SIZE)
+        {
+            boost::lock_guard<boost::mutex> streamLocker(streamMutex);
+            return streamSize();
+        }
+
+        boost::unique_lock<boost::mutex> locker(mutex);
+
+        int64_t target;
+        switch (whence)
+        {
+        case SEEK_SET: target = pos; break;
+        case SEEK_CUR: target = position + pos; break;
+        case SEEK_END:
+        {
+            boost::lock_guard<boost::mutex> streamLocker(streamMutex);
+            const auto size = streamSize();
+            if (size < 0)
+                return -1;
+            target = size + pos;
+            break;
+        }
+        default:
+            return -1;
+        }
+        if (target < 0)
+        {
+            return -1;
+        }
+
+        // Within the blocks read so far, or right where the reader goes on
+        if (head != tail && target >= blocks[head % blocks.size()].pos && target < readPosition)
+        {
+            for (; target >= blocks[head % blocks.size()].pos + int64_t(blocks[head % blocks.size()].size); ++head)
+            {
+            }
+            offset = static_cast<size_t>(target - blocks[head % blocks.size()].pos);
+            position = target;
+            spaceReady.notify_all();
+            return target;
+        }
+        if (target == readPosition)
+        {
+            head = tail;
+            offset = 0;
+            position = target;
+            spaceReady.notify_all();
+            return target;
+        }
+
+        // Elsewhere: the block being read is dropped and the reader continues from the new position
+        ++generation;
+        head = tail;
+        offset = 0;
+        eof = false;
+        error = false;
+        int64_t result;
+        {
+            boost::lock_guard<boost::mutex> streamLocker(streamMutex);
+            result = toPosition(stream.pubseekoff(static_cast<std::streamoff>(target), std::ios_base::beg, std::ios_base::in));
+            readPosition = (result != -1) ? result
+                : std::max<int64_t>(0, toPosition(stream.pubseekoff(0, std::ios_base::cur, std::ios_base::in)));
+        }
+        position = readPosition;
+        spaceReady.notify_all();
+        return result;
+    }
+
+private:
+    struct Block
+    {
+        std::vector<char> data;
+        int64_t pos = 0;
+        size_t size = 0;
+    };
+
+    void run()
+    {
+        tracing::setThreadName("read-ahead");
+
+        boost::unique_lock<boost::mutex> locker(mutex);
+        for (;;)
+        {
+            spaceReady.wait(locker, [this] { return stopping || (!eof && !error && tail - head < blocks.size()); });
+            if (stopping)
+            {
+                return;
+            }
+
+            const unsigned int blockGeneration = generation;
+            Block& block = blocks[tail % blocks.size()];
+            const int64_t blockPos = readPosition;
+            locker.unlock();
+
+            TRACE_SCOPE("read-ahead block");
+            size_t filled = 0;
+            std::streamsize len = 0;
+            while (filled < block.data.size())
+            {
+                {
+                    boost::lock_guard<boost::mutex> streamLocker(streamMutex);
+                    if (generation != blockGeneration)
+                    {
+                        break;
+                    }
+                    try
+                    {
+                        len = stream.sgetn(block.data.data() + filled,
+                            std::min<std::streamsize>(READ_CHUNK_SIZE, block.data.size() - filled));
+                    }
+                    catch (const std::exception&)
+                    {
+                        len = -1;
+                    }
+                }
+                if (len <= 0)
+                {
+                    break;
+                }
+                filled += static_cast<size_t>(len);
+            }
+
+            locker.lock();
+            if (generation != blockGeneration)
+            {
+                continue; // a seek dropped it
+            }
+            block.pos = blockPos;
+            block.size = filled;
+            readPosition = blockPos + filled;
+            if (filled > 0)
+            {
+                ++tail;
+            }
+            eof = len == 0;  // assume that source is seekable
+            error = len < 0;
+            dataReady.notify_all();
+        }
+    }
+
+    // Under streamMutex; keeps the stream position
+    int64_t streamSize()
+    {
+        const auto current = stream.pubseekoff(0, std::ios_base::cur, std::ios_base::in);
+        const auto endPos = stream.pubseekoff(0, std::ios_base::end, std::ios_base::in);
+        stream.pubseekoff(current, std::ios_base::beg, std::ios_base::in);
+        return toPosition(endPos);
+    }
+
+    std::streambuf& stream;
+    boost::mutex streamMutex;   // taken after mutex if both are needed
+
+    boost::mutex mutex;
+    boost::condition_variable dataReady;
+    boost::condition_variable spaceReady;
+    std::vector<Block> blocks;
+    size_t head = 0;            // blocks consumed by read()
+    size_t tail = 0;            // blocks filled by the reader
+    size_t offset = 0;          // in the head block
+    int64_t position = 0;       // of the next byte read() returns
+    int64_t readPosition = 0;   // of the next byte the reader fetches
+    boost::atomic<unsigned int> generation{ 0 }; // bumped by the seeks dropping the blocks
+    bool eof = false;
+    bool error = false;
+    bool stopping = false;
+
+    boost::thread thread;
+};
+
+// Serves the reads from a file mapping. Playback reads sequentially, which the mapping is advised of;
+// a seek further than SEQUENTIAL_SLACK switches to random access hints until SEQUENTIAL_RUN bytes
+// have been read in a row again.
+class DecoderIOContext::MappedReader
+{
+public:
+    explicit MappedReader(std::unique_ptr<MappedFile> file) : file(std::move(file))
+    {
+        this->file->adviseSequential();
+    }
+
+    int read(uint8_t* buf, int size)
+    {
+        // The file may still be being written
+        if (position >= static_cast<int64_t>(file->size()) && !file->update())
+        {
+            return AVERROR(EIO);
+        }
+        const auto fileSize = static_cast<int64_t>(file->size());
+        if (position >= fileSize)
+        {
+            return AVERROR_EOF;
+        }
+        const auto length = static_cast<int>(std::min<int64_t>(size, fileSize - position));
+        if (!file->read(buf, position, length))
+        {
+            // A file truncated under the mapping ends where it has been cut
+            return (file->update() && position >= static_cast<int64_t>(file->size()))
+                ? AVERROR_EOF : AVERROR(EIO);
+        }
+        position += length;
+
+        sequentialBytes += length;
+        if (randomAccess && sequentialBytes >= SEQUENTIAL_RUN)
+        {
+            file->adviseSequential();
+            randomAccess = false;
+        }
+        return length;
+    }
+
+    int64_t seek(int64_t pos, int whence)
+    {
+        const auto fileSize = static_cast<int64_t>(file->size());
+        int64_t target;
+        switch (whence & ~AVSEEK_FORCE)
+        {
+        case AVSEEK_SIZE: return fileSize;
+        case SEEK_SET: target = pos; break;
+        case SEEK_CUR: target = position + pos; break;
+        case SEEK_END: target = fileSize + pos; break;
+        default:
+            return -1;
+        }
+        if (target < 0)
+        {
+            return -1;
+        }
+
+        if (target < position || target > position + SEQUENTIAL_SLACK)
+        {
+            sequentialBytes = 0;
+            if (!randomAccess)
+            {
+                file->adviseRandom();
+                randomAccess = true;
+            }
+        }
+        position = target;
+        return target;
+    }
+
+private:
+    enum : int64_t
+    {
+        SEQUENTIAL_SLACK = 1024 * 1024,
+        SEQUENTIAL_RUN = 4 * 1024 * 1024,
+    };
+
+    std::unique_ptr<MappedFile> file;
+    int64_t position = 0;
+    int64_t sequentialBytes = 0;
+    bool randomAccess = false;
+};
+
 // static
 int DecoderIOContext::IOReadFunc(void* data, uint8_t* buf, int buf_size)
 {
     auto* hctx = static_cast<DecoderIOContext*>(data);
+    if (hctx->mappedReader)
+    {
+        return hctx->mappedReader->read(buf, buf_size);
+    }
+    if (hctx->readAhead)
+    {
+        return hctx->readAhead->read(buf, buf_size);
+    }
     try
     {
         std::streamsize len = hctx->stream->sgetn(reinterpret_cast<char*>(buf),
@@ -32,6 +389,14 @@ int DecoderIOContext::IOReadFunc(void* data, uint8_t* buf, int buf_size)
 int64_t DecoderIOContext::IOSeekFunc(void* data, int64_t pos, int whence)
 {
     auto* hctx = static_cast<DecoderIOContext*>(data);
+    if (hctx->mappedReader)
+    {
+        return hctx->mappedReader->seek(pos, whence);
+    }
+    if (hctx->readAhead)
+    {
+        return hctx->readAhead->seek(pos, whence);
+    }
 
     if (whence == AVSEEK_SIZE)
     {
@@ -63,8 +428,7 @@ int64_t DecoderIOContext::IOSeekFunc(void* data, int64_t pos, int whence)
     return static_cast<int64_t>(newPos);
 }
 
-DecoderIOContext::DecoderIOContext(std::unique_ptr<std::streambuf> s)
-    : stream(std::move(s))
+DecoderIOContext::DecoderIOContext()
 {
     bufferSize = 1024 * 64;
     buffer = static_cast<uint8_t*>(av_malloc(bufferSize));
@@ -80,6 +444,28 @@ DecoderIOContext::DecoderIOContext(std::unique_ptr<std::streambuf> s)
     );
 }
 
+DecoderIOContext::DecoderIOContext(std::unique_ptr<std::streambuf> s, int readAheadBlockSize, int readAheadDepth)
+    : DecoderIOContext()
+{
+    stream = std::move(s);
+    if (readAheadDepth > 0 && readAheadBlockSize > 0)
+    {
+        readAhead = std::make_unique<ReadAhead>(*stream, readAheadBlockSize, readAheadDepth);
+    }
+}
+
+DecoderIOContext::DecoderIOContext(std::unique_ptr<MappedFile> file)
+    : DecoderIOContext()
+{
+    mappedReader = std::make_unique<MappedReader>(std::move(file));
+
+    // Large reads bypass the AVIO buffer, and seeks don't need to be avoided
+    if (ioCtx)
+    {
+        ioCtx->direct = 1;
+    }
+}
+
 DecoderIOContext::~DecoderIOContext()
 {
     if (ioCtx)
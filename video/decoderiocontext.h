@@ -6,20 +6,42 @@
 
 struct AVIOContext;
 struct AVFormatContext;
+class MappedFile;
 
 class DecoderIOContext
 {
+public:
+    enum
+    {
+        DEFAULT_READ_AHEAD_BLOCK_SIZE = 1024 * 1024,
+        DEFAULT_READ_AHEAD_DEPTH = 4,
+    };
+
 private:
+    class ReadAhead;
+    class MappedReader;
+
     AVIOContext *ioCtx;
     uint8_t *buffer;  // internal buffer for ffmpeg
     int bufferSize;
     std::unique_ptr<std::streambuf> stream;
+    std::unique_ptr<ReadAhead> readAhead;  // null if the stream is read on demand
+    std::unique_ptr<MappedReader> mappedReader;  // instead of the stream
 
     static int IOReadFunc(void* data, uint8_t* buf, int buf_size);
     static int64_t IOSeekFunc(void* data, int64_t pos, int whence);
 
+    DecoderIOContext();
+
 public:
-    DecoderIOContext(std::unique_ptr<std::streambuf> s);
+    // A background thread keeps up to readAheadDepth blocks of readAheadBlockSize bytes
+    // read ahead of the demuxer; readAheadDepth 0 reads the stream on demand
+    DecoderIOContext(std::unique_ptr<std::streambuf> s,
+        int readAheadBlockSize = DEFAULT_READ_AHEAD_BLOCK_SIZE,
+        int readAheadDepth = DEFAULT_READ_AHEAD_DEPTH);
+
+    // Reads go straight from the mapping into the demuxer buffers
+    explicit DecoderIOContext(std::unique_ptr<MappedFile> file);
     ~DecoderIOContext();
 
     void initAVFormatContext(AVFormatContext * /*pCtx*/);
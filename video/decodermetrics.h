@@ -0,0 +1,150 @@
+#pragma once
+
+#include "decoderinterface.h"
+
+#include <boost/atomic.hpp>
+#include <boost/chrono.hpp>
+
+#include <cmath>
+
+// Number of events with the total and the longest time they took; may be updated from several threads
+class TimingCounter
+{
+public:
+    TimingCounter() { reset(); }
+
+    TimingCounter(const TimingCounter&) = delete;
+    TimingCounter& operator=(const TimingCounter&) = delete;
+
+    void add(boost::chrono::nanoseconds time)
+    {
+        const int64_t ns = time.count();
+        m_count.fetch_add(1, boost::memory_order_relaxed);
+        m_total.fetch_add(ns, boost::memory_order_relaxed);
+        for (int64_t max = m_max.load(boost::memory_order_relaxed);
+            ns > max && !m_max.compare_exchange_weak(max, ns, boost::memory_order_relaxed);)
+        {
+        }
+        m_last.store(ns, boost::memory_order_relaxed);
+    }
+
+    uint64_t count() const { return m_count.load(boost::memory_order_relaxed); }
+
+    // Seconds
+    double mean() const
+    {
+        const auto count = this->count();
+        return count ? m_total.load(boost::memory_order_relaxed) / 1e9 / count : 0;
+    }
+    double max() const { return m_max.load(boost::memory_order_relaxed) / 1e9; }
+    double last() const { return m_last.load(boost::memory_order_relaxed) / 1e9; }
+
+    void reset()
+    {
+        m_count = 0;
+        m_total = 0;
+        m_max = 0;
+        m_last = 0;
+    }
+
+private:
+    boost::atomic<uint64_t> m_count;
+    boost::atomic<int64_t> m_total; // nanoseconds
+    boost::atomic<int64_t> m_max;
+    boost::atomic<int64_t> m_last;
+};
+
+// Measures the time from construction to the destruction or stop()
+class ScopedTiming
+{
+public:
+    explicit ScopedTiming(TimingCounter& counter)
+        : m_counter(&counter), m_start(boost::chrono::high_resolution_clock::now()) {}
+
+    ScopedTiming(const ScopedTiming&) = delete;
+    ScopedTiming& operator=(const ScopedTiming&) = delete;
+
+    ~ScopedTiming() { stop(); }
+
+    void stop()
+    {
+        if (m_counter != nullptr)
+        {
+            m_counter->add(boost::chrono::high_resolution_clock::now() - m_start);
+            m_counter = nullptr;
+        }
+    }
+
+private:
+    TimingCounter* m_counter;
+    boost::chrono::high_resolution_clock::time_point m_start;
+};
+
+// Pipeline counters behind IFrameDecoder::getMetrics(); the packet queues and the display thread
+// keep their own, which are added to the snapshot by the decoder
+struct DecoderMetricsCollector
+{
+    TimingCounter decoding;     // avcodec_send_packet() / avcodec_receive_frame() calls per decoded frame
+    TimingCounter conversion;
+    TimingCounter seekLatency;
+
+    boost::atomic<uint64_t> framesHardSkipped{ 0 };
+    boost::atomic<uint64_t> framesAbandoned{ 0 };
+    boost::atomic<uint64_t> audioSyncCorrections{ 0 };
+
+    boost::atomic<double> audioDrift{ 0 };
+    boost::atomic<double> maxAudioDrift{ 0 };
+
+    DecoderMetricsCollector() = default;
+    DecoderMetricsCollector(const DecoderMetricsCollector&) = delete;
+    DecoderMetricsCollector& operator=(const DecoderMetricsCollector&) = delete;
+
+    static void increment(boost::atomic<uint64_t>& counter)
+    {
+        counter.fetch_add(1, boost::memory_order_relaxed);
+    }
+
+    // Called from the audio thread only
+    void setAudioDrift(double drift)
+    {
+        audioDrift.store(drift, boost::memory_order_relaxed);
+        if (std::fabs(drift) > maxAudioDrift.load(boost::memory_order_relaxed))
+        {
+            maxAudioDrift.store(std::fabs(drift), boost::memory_order_relaxed);
+        }
+    }
+
+    void snapshot(DecoderMetrics& metrics) const
+    {
+        metrics.framesDecoded = decoding.count();
+        metrics.meanDecodeTime = decoding.mean();
+        metrics.maxDecodeTime = decoding.max();
+
+        metrics.framesConverted = conversion.count();
+        metrics.meanConversionTime = conversion.mean();
+        metrics.maxConversionTime = conversion.max();
+
+        metrics.framesHardSkipped = framesHardSkipped.load(boost::memory_order_relaxed);
+        metrics.framesAbandoned = framesAbandoned.load(boost::memory_order_relaxed);
+
+        metrics.audioSyncCorrections = audioSyncCorrections.load(boost::memory_order_relaxed);
+        metrics.audioDrift = audioDrift.load(boost::memory_order_relaxed);
+        metrics.maxAudioDrift = maxAudioDrift.load(boost::memory_order_relaxed);
+
+        metrics.seeks = seekLatency.count();
+        metrics.lastSeekLatency = seekLatency.last();
+        metrics.meanSeekLatency = seekLatency.mean();
+    }
+
+    void reset()
+    {
+        decoding.reset();
+        conversion.reset();
+        seekLatency.reset();
+        framesHardSkipped = 0;
+        framesAbandoned = 0;
+        audioSyncCorrections = 0;
+        audioDrift = 0;
+        maxAudioDrift = 0;
+    }
+};
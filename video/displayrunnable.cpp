@@ -1,34 +1,73 @@
 #include "ffmpegdecoder.h"
 
+#include <algorithm>
 #include <tuple>
+#include <utility>
+
+namespace {
+
+// Audio sync, pausing and speed changes move the presentation time; it is recomputed this often
+const auto MAX_WAIT_TIME = boost::chrono::milliseconds(100);
+
+} // namespace
 
 void FFmpegDecoder::displayRunnable()
 {
     CHANNEL_LOG(ffmpeg_threads) << "Displaying thread started";
+    tracing::setThreadName("display");
 
-#ifdef TRACE_DELAY_STATS
-    double sumIndications = 0;
-    double sqSumIndications = 0;
+    unsigned int generation = m_decodingGeneration;
+    IClock::time_point seekStartTime = IClock::time_point::min();
+    bool exactSeek = false;
 
-    enum { MAX_INDICATIONS = 200 };
-    int numIndications = 0;
-#endif
+    // Wall time since the presentation time of a frame; negative before it
+    const auto presentationDelay = [this](double pts)
+    {
+        return boost::chrono::duration<double>(m_clock->now()
+            - GetHiResTimePoint(m_videoStartClock + pts)).count();
+    };
 
     while (!boost::this_thread::interruption_requested())
     {
         {
+            TRACE_SCOPE("frame queue wait");
             boost::unique_lock<boost::mutex> locker(m_videoFramesMutex);
-            m_videoFramesCV.wait(locker, [this]()
+            m_videoFramesCV.wait(locker, [this, generation]()
             {
-                return !m_frameDisplayingRequested &&
-                    m_videoFramesQueue.canPop();
+                return generation != m_decodingGeneration ||
+                    (!m_frameDisplayingRequested &&
+                    m_videoFramesQueue.canPop());
             });
+
+            if (generation != m_decodingGeneration)
+            {
+                // Seek: drop the frames decoded before it
+                generation = m_decodingGeneration;
+                seekStartTime = m_seekStartTime;
+                exactSeek = m_seekMode == SEEK_EXACT;
+                while (m_videoFramesQueue.canPop() && m_videoFramesQueue.front().m_generation != generation)
+                {
+                    m_videoFramesQueue.front().free();
+                    m_videoFramesQueue.popFront();
+                }
+                m_frameDisplayingRequested = false;
+                ++m_generation;
+                locker.unlock();
+                m_videoFramesCV.notify_all();
+                continue;
+            }
         }
 
         VideoFrame& current_frame = m_videoFramesQueue.front();
         m_frameDisplayingRequested = true;
 
-        if (current_frame.m_convert.valid() && !current_frame.m_convert.get()) {
+        if (current_frame.m_generation != generation) {
+            finishedDisplayingFrame(m_generation);
+            continue;
+        }
+
+        if (current_frame.m_convert != nullptr
+            && !std::exchange(current_frame.m_convert, nullptr)->finish()) {
                 finishedDisplayingFrame(m_generation);
                 continue;
         }
@@ -36,10 +75,11 @@ void FFmpegDecoder::displayRunnable()
         assert(m_videoStartClock != VIDEO_START_CLOCK_NOT_INITIALIZED);
 
         // Frame skip
-        if (!m_videoFramesQueue.canPush()
+        if (!m_freeRunning && !m_videoFramesQueue.canPush()
             && m_videoStartClock + current_frame.m_pts < GetHiResTime())
         {
             CHANNEL_LOG(ffmpeg_threads) << __FUNCTION__ << " Framedrop";
+            m_presentationStats.frameDropped(presentationDelay(current_frame.m_pts));
             finishedDisplayingFrame(m_generation);
             continue;
         }
@@ -50,27 +90,56 @@ void FFmpegDecoder::displayRunnable()
         // Possibly give it time to render frame
         if (m_frameListener != nullptr)
         {
+            TRACE_SCOPE("updateFrame");
             m_frameListener->updateFrame(this, m_generation);
         }
 
-        const auto speed = getSpeedRational();
+        // Waiting is cut short by a seek
+        const auto isStale = [this, generation] { return generation != m_decodingGeneration; };
 
-        for (;;)
+        // Waiting until the presentation time on the clock itself, so that the speed ratio
+        // is applied exactly and sleeping doesn't accumulate error
+        const double lateness = presentationDelay(pts);
+        if (!m_freeRunning)
         {
-            const double delay = m_videoStartClock + pts - GetHiResTime();
-            if (delay < 0.005) {
-                break;
-            }
-            if (delay > 0.1)
+            TRACE_SCOPE("presentation wait");
+            const auto spinTime = m_clock->spinTime();
+            for (;;)
             {
-                boost::this_thread::sleep_for(
-                    boost::chrono::milliseconds(100 * speed.denominator / speed.numerator));
-                continue;
+                const auto now = m_clock->now();
+                const auto deadline = GetHiResTimePoint(m_videoStartClock + pts);
+                if (deadline <= now) {
+                    break;
+                }
+
+                if (deadline - now <= spinTime)
+                {
+                    while (m_clock->now() < deadline && !isStale()) {
+                        boost::this_thread::yield();
+                    }
+                    break;
+                }
+
+                const auto wakeUp = std::min(deadline - spinTime, now + MAX_WAIT_TIME);
+                boost::unique_lock<boost::mutex> locker(m_videoFramesMutex);
+                if (m_clock->waitUntil(m_videoFramesCV, locker, wakeUp, isStale)) {
+                    break;
+                }
             }
+        }
 
-            boost::this_thread::sleep_for(
-                boost::chrono::milliseconds(int(delay * 1000. * speed.denominator / speed.numerator)));
-            break;
+        if (isStale()) {
+            continue;
+        }
+
+        if (!m_freeRunning)
+        {
+            if (lateness > 0) {
+                m_presentationStats.lateFramePresented(lateness);
+            }
+            else {
+                m_presentationStats.framePresented(presentationDelay(pts));
+            }
         }
 
         // It's time to display converted frame
@@ -86,28 +155,28 @@ void FFmpegDecoder::displayRunnable()
             }
         }
 
-#ifdef TRACE_DELAY_STATS
-        const double delay = m_videoStartClock + pts - GetHiResTime();
-        sumIndications += delay;
-        sqSumIndications += delay * delay;
-        if (++numIndications >= MAX_INDICATIONS)
-        {
-            const double avg = sumIndications / numIndications;
-            CHANNEL_LOG(ffmpeg_threads) << "Average frame delay: " << avg
-                << "; frame delay deviation: " << sqrt(sqSumIndications / numIndications - avg * avg);
-            sumIndications = 0;
-            sqSumIndications = 0;
-            numIndications = 0;
-        }
-#endif
-
         if (m_frameListener != nullptr)
         {
+            TRACE_SCOPE("drawFrame");
             m_frameListener->drawFrame(this, m_generation);
         }
         else
         {
             finishedDisplayingFrame(m_generation);
         }
+
+        // Wall time: the media time of GetHiResTime() runs at the playback speed
+        if (seekStartTime != IClock::time_point::min())
+        {
+            const auto latencyTime = m_clock->now() - seekStartTime;
+            seekStartTime = IClock::time_point::min();
+            m_metrics.seekLatency.add(boost::chrono::duration_cast<boost::chrono::nanoseconds>(latencyTime));
+            const double latency = boost::chrono::duration<double>(latencyTime).count();
+            CHANNEL_LOG(ffmpeg_seek) << "Seek to first frame latency: " << latency << (exactSeek ? " (exact)" : "");
+            if (m_decoderListener != nullptr)
+            {
+                m_decoderListener->onSeekFrameShown(latency, exactSeek);
+            }
+        }
     }
 }
@@ -7,6 +7,8 @@
 #include "interlockedadd.h"
 #include "subtitles.h"
 #include "decoderiocontext.h"
+#include "mappedfile.h"
+#include "probecache.h"
 
 #include <boost/chrono.hpp>
 #include <memory>
@@ -21,6 +23,7 @@
 
 extern "C"
 {
+#include "libavutil/cpu.h"
 #include "libavutil/pixdesc.h"
 #include "libavdevice/avdevice.h"
 }
@@ -102,11 +105,15 @@ void FreeVideoCodecContext(AVCodecContext*& videoCodecContext)
 }
 
 
-inline void Shutdown(const std::unique_ptr<boost::thread>& th)
+// Packet queues wait on atomics rather than on boost condition variables,
+// so the thread has to be woken explicitly after the interruption request.
+template<typename... Queues>
+inline void Shutdown(const std::unique_ptr<boost::thread>& th, Queues&... queues)
 {
     if (th)
     {
         th->interrupt();
+        (queues.notify(), ...);
         th->join();
     }
 }
@@ -117,9 +124,59 @@ int ThisThreadInterruptionRequested(void* ptr)
         || boost::this_thread::interruption_requested());
 }
 
-int g_lastHttpCode = 0;
-std::string g_lastLocationHttpHeader;
-boost::atomic_bool* g_interruptionRequestedFlag = nullptr;
+// A path, possibly with a drive letter, or a file: url; anything else is left to the protocols
+bool isLocalFile(const std::string& url)
+{
+    const auto colon = url.find(':');
+    return colon == std::string::npos || colon == 1
+        || (boost::starts_with(url, "file:") && !boost::starts_with(url, "file://"));
+}
+
+const int MAX_DECODER_THREADS = 64;
+
+// Frame threading pays off as long as every thread has enough work per frame;
+// more threads mean more frames of latency and more frame buffers
+int AutoDecoderThreadCount(int width, int height)
+{
+    const int64_t pixels = int64_t(width) * height;
+    const int maxThreads = (pixels <= 1280 * 720) ? 4
+        : (pixels <= 1920 * 1088) ? 8
+        : (pixels <= 4096 * 2304) ? 16
+        : 32;
+
+    return std::max(1, std::min(av_cpu_count(), maxThreads));
+}
+
+const char* ThreadTypeName(int threadType)
+{
+    switch (threadType)
+    {
+    case FF_THREAD_FRAME: return "frame";
+    case FF_THREAD_SLICE: return "slice";
+    default: return "none";
+    }
+}
+
+const double DEFAULT_QUEUE_SECONDS = 15.;
+const int64_t DEFAULT_VIDEO_QUEUE_BYTES = 256 * 1024 * 1024;
+const int64_t DEFAULT_AUDIO_QUEUE_BYTES = 15 * 1024 * 1024;
+
+// Absorbs display hiccups of a few frame periods
+const int DEFAULT_FRAME_QUEUE_DEPTH = 4;
+
+// Redirect tracking of an avformat_open_input() call. The http protocol logs the response
+// on the thread opening the input, so that inputs opened in parallel don't mix up their redirects.
+struct RedirectCapture
+{
+    explicit RedirectCapture(boost::atomic_bool* flag) : interruptionRequestedFlag(flag) {}
+
+    boost::atomic_bool* interruptionRequestedFlag;
+    int lastHttpCode = 0;
+    std::string lastLocationHttpHeader;
+};
+
+thread_local RedirectCapture* t_redirectCapture = nullptr;
+
 void log_callback(void *ptr, int level, const char *fmt, va_list vargs)
 {
     if (level <= AV_LOG_ERROR)
@@ -135,20 +192,20 @@ void log_callback(void *ptr, int level, const char *fmt, va_list vargs)
             CHANNEL_LOG(ffmpeg_internal) << buffer;
         }
     }
-    else if (const auto interruptionRequestedFlag = g_interruptionRequestedFlag)
+    else if (const auto capture = t_redirectCapture)
     {
         if (strcmp(fmt, "http_code=%d\n") == 0)
         {
-            g_lastHttpCode = va_arg(vargs, int);
+            capture->lastHttpCode = va_arg(vargs, int);
         }
-        else if (g_lastHttpCode == 302 && g_lastLocationHttpHeader.empty()
+        else if (capture->lastHttpCode == 302 && capture->lastLocationHttpHeader.empty()
             && strcmp(fmt, "header='%s'\n") == 0)
         {
             auto header = va_arg(vargs, const char*);
             if (header != nullptr && strncmp("Location: ", header, 10) == 0)
             {
-                g_lastLocationHttpHeader = header + 10;
-                *interruptionRequestedFlag = true;
+                capture->lastLocationHttpHeader = header + 10;
+                *capture->interruptionRequestedFlag = true;
             }
         }
     }
@@ -186,6 +243,8 @@ FFmpegDecoder::FFmpegDecoder(std::unique_ptr<IAudioPlayer> audioPlayer)
       m_audioSettings(48000, 2, AV_SAMPLE_FMT_S16),
       m_pixelFormat(AV_PIX_FMT_YUV420P),
       m_allowDirect3dData(false),
+      m_videoPacketsQueue(MAX_VIDEO_PACKETS),
+      m_audioPacketsQueue(MAX_AUDIO_PACKETS),
       m_audioPlayer(std::move(audioPlayer)),
       m_hwAccelerated(true)
 {
@@ -194,6 +253,17 @@ FFmpegDecoder::FFmpegDecoder(std::unique_ptr<IAudioPlayer> audioPlayer)
 
     m_audioPlayer->SetCallback(this);
 
+    m_videoPacketsQueue.setLimits(DEFAULT_QUEUE_SECONDS, DEFAULT_VIDEO_QUEUE_BYTES);
+    m_audioPacketsQueue.setLimits(DEFAULT_QUEUE_SECONDS, DEFAULT_AUDIO_QUEUE_BYTES);
+
+    m_decoderThreading = DecoderThreading{ DecoderThreading::THREADING_AUTO, 0 };
+    m_readAhead = ReadAheadSettings{
+        DecoderIOContext::DEFAULT_READ_AHEAD_BLOCK_SIZE, DecoderIOContext::DEFAULT_READ_AHEAD_DEPTH };
+    m_probeSettings = ProbeSettings{ 0, 0 };
+
+    m_frameQueueDepth = DEFAULT_FRAME_QUEUE_DEPTH;
+    m_videoFramesQueue.resize(m_frameQueueDepth);
+
     resetVariables();
 
     // init codecs
@@ -223,6 +293,7 @@ void FFmpegDecoder::resetVariables()
     m_startTime = 0;
     m_currentTime = 0;
     m_duration = 0;
+    m_refinedDuration = AV_NOPTS_VALUE;
 
     m_prevTime = AV_NOPTS_VALUE;
 
@@ -243,6 +314,15 @@ void FFmpegDecoder::resetVariables()
     m_videoResetRendezVous.count = 0;
 
     m_videoResetting = false;
+    m_videoResetRequested = false;
+
+    m_decodeQualityGovernor.reset();
+
+    m_isScrubbing = false;
+    m_scrubSeekDuration = AV_NOPTS_VALUE;
+    m_exactSeekRequested = false;
+    m_exactSeekDuration = AV_NOPTS_VALUE;
+    m_seekRequestTime = IClock::time_point::min();
 
     m_videoStartClock = VIDEO_START_CLOCK_NOT_INITIALIZED;
 
@@ -265,6 +345,9 @@ void FFmpegDecoder::resetVariables()
 
     m_speedRational = { 1, 1 };
 
+    m_presentationStats.reset();
+    m_metrics.reset();
+
     CHANNEL_LOG(ffmpeg_closing) << "Variables reset";
 }
 
@@ -276,11 +359,12 @@ void FFmpegDecoder::close()
     // controls other threads, hence stop first
     for (auto& mainParseThread : m_mainParseThreads)
     {
-        Shutdown(mainParseThread);
+        Shutdown(mainParseThread, m_videoPacketsQueue, m_audioPacketsQueue);
     }
-    Shutdown(m_mainVideoThread);
-    Shutdown(m_mainAudioThread);
+    Shutdown(m_mainVideoThread, m_videoPacketsQueue);
+    Shutdown(m_mainAudioThread, m_audioPacketsQueue);
     Shutdown(m_mainDisplayThread);
+    Shutdown(m_durationThread);
 
     m_audioPlayer->Close();
 
@@ -306,11 +390,12 @@ void FFmpegDecoder::closeProcessing()
     m_mainAudioThread.reset();
     m_mainParseThreads.clear();
     m_mainDisplayThread.reset();
+    m_durationThread.reset();
 
     // Free videoFrames
     {
         boost::lock_guard<boost::mutex> locker(m_videoFramesMutex);
-        m_videoFramesQueue.clear();
+        m_videoFramesQueue.resize(m_frameQueueDepth);
     }
 
     sws_freeContext(m_imageCovertContext);
@@ -337,7 +422,7 @@ void FFmpegDecoder::closeProcessing()
             isFileReallyClosed = true;
         }
 
-    m_ioCtx.reset();
+    m_ioContexts.clear();
 
     CHANNEL_LOG(ffmpeg_closing) << "Old file closed";
 
@@ -350,126 +435,319 @@ void FFmpegDecoder::closeProcessing()
 
 const char szUserAgent[] = "User-Agent: Mozilla/5.0 (Windows NT 10.0) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/126.0.0.0 Safari/537.36";
 
-bool FFmpegDecoder::openUrls(std::initializer_list<std::string> urls, const std::string& inputFormat, bool useHHO)
+namespace {
+
+// Stream information of the cached layouts is looked for in this much media
+const int64_t MIN_ANALYZE_DURATION = AV_TIME_BASE / 2;
+
+struct ProbeOptions
 {
-    close();
+    ProbeSettings settings;
+    ProbeCache* cache;      // null if disabled
+    bool useCachedLayout;   // false once the cached layout has turned out not to match
+};
 
-    m_formatContextInterrupts = std::vector<boost::atomic_bool>(urls.size());
-    for (auto& elem : m_formatContextInterrupts) {
-        elem.store(false);
+enum ProbeResult { PROBE_FAILED, PROBE_DONE, PROBE_STALE };
+
+void applyProbeSettings(AVFormatContext* formatContext, const ProbeSettings& settings)
+{
+    if (settings.probeSize > 0)
+    {
+        formatContext->probesize = settings.probeSize;
     }
+    if (settings.analyzeDuration > 0)
+    {
+        formatContext->max_analyze_duration = settings.analyzeDuration;
+    }
+}
 
-    for (auto url : urls)
+// avformat_find_stream_info(), cut short for the inputs the cache knows; on PROBE_STALE
+// the input is to be reopened and probed with useCachedLayout off
+ProbeResult probeStreams(AVFormatContext* formatContext, const std::string& url, const ProbeOptions& probe)
+{
+    ProbeCache::Identity identity{ -1, 0 };
+    if (probe.cache != nullptr)
     {
-        const auto interruptionRequestedFlag = &m_formatContextInterrupts.at(m_formatContexts.size());
+        identity = ProbeCache::identify(url, formatContext);
+        const int64_t probeSize = probe.useCachedLayout ? probe.cache->probeSize(url, identity) : 0;
+        if (probeSize > 0 && probeSize < formatContext->probesize)
+        {
+            formatContext->probesize = probeSize;
+            formatContext->max_analyze_duration = MIN_ANALYZE_DURATION;
+            if (avformat_find_stream_info(formatContext, nullptr) >= 0 && probe.cache->apply(url, formatContext))
+            {
+                CHANNEL_LOG(ffmpeg_opening) << "Stream layout found in the probe cache, probe size " << probeSize;
+                return PROBE_DONE;
+            }
+            CHANNEL_LOG(ffmpeg_opening) << "Probe cache entry doesn't match, probing fully";
+            return PROBE_STALE;
+        }
+    }
 
-        auto iformat = inputFormat.empty() ? nullptr : av_find_input_format(inputFormat.c_str());
+    if (avformat_find_stream_info(formatContext, nullptr) < 0)
+    {
+        return PROBE_FAILED;
+    }
+    if (probe.cache != nullptr)
+    {
+        probe.cache->store(url, identity, formatContext);
+    }
+    return PROBE_DONE;
+}
 
-        int redirectsLeft = 10;
+// Maps a local file for the demuxer; returns nullptr if it can't be mapped or opened that way
+AVFormatContext* openMappedFile(const std::string& url, boost::atomic_bool* interruptionRequestedFlag,
+    const ProbeOptions& probe, std::unique_ptr<DecoderIOContext>& ioCtx)
+{
+    auto mappedFile = std::make_unique<MappedFile>();
+    if (!mappedFile->open(boost::starts_with(url, "file:") ? url.substr(5) : url))
+    {
+        return nullptr;
+    }
+    CHANNEL_LOG(ffmpeg_opening) << "Mapped " << mappedFile->size() << " bytes of " << url;
 
-        for (;;)
+    auto mappedIoCtx = std::make_unique<DecoderIOContext>(std::move(mappedFile));
+
+    auto formatContext = avformat_alloc_context();
+    auto formatContextGuard = MakeGuard(&formatContext, avformat_close_input);
+
+    mappedIoCtx->initAVFormatContext(formatContext);
+    applyProbeSettings(formatContext, probe.settings);
+
+    formatContext->interrupt_callback.opaque = interruptionRequestedFlag;
+    formatContext->interrupt_callback.callback = ThisThreadInterruptionRequested;
+
+    AVDictionary* streamOpts = nullptr;
+    auto avOptionsGuard = MakeGuard(&streamOpts, av_dict_free);
+    av_dict_set(&streamOpts, "scan_all_pmts", "1", AV_DICT_DONT_OVERWRITE);
+
+    // The url still lets the format be guessed by its extension
+    const auto probeResult = (avformat_open_input(&formatContext, url.c_str(), nullptr, &streamOpts) == 0)
+        ? probeStreams(formatContext, url, probe) : PROBE_FAILED;
+    if (probeResult == PROBE_STALE)
+    {
+        avformat_close_input(&formatContext);
+        return openMappedFile(url, interruptionRequestedFlag, { probe.settings, probe.cache, false }, ioCtx);
+    }
+    if (probeResult == PROBE_FAILED)
+    {
+        CHANNEL_LOG(ffmpeg_opening) << "Couldn't open the mapped file, reading it instead";
+        return nullptr;
+    }
+    CHANNEL_LOG(ffmpeg_opening) << "Opening video/audio file...";
+
+    ioCtx = std::move(mappedIoCtx);
+    formatContextGuard.release();
+    return formatContext;
+}
+
+// Opens and probes a single input, following redirects; returns nullptr on failure.
+// Gives up as soon as cancelled is set, which has to be followed by setting interruptionRequestedFlag.
+AVFormatContext* openInput(const std::string& requestedUrl, const std::string& inputFormat, bool useHHO,
+    bool memoryMapped, boost::atomic_bool* interruptionRequestedFlag, const boost::atomic_bool& cancelled,
+    ProbeOptions probe, std::unique_ptr<DecoderIOContext>& ioCtx)
+{
+    std::string url = requestedUrl;
+
+    auto iformat = inputFormat.empty() ? nullptr : av_find_input_format(inputFormat.c_str());
+
+    // Local files are read through a mapping if asked for
+    if (memoryMapped && iformat == nullptr && isLocalFile(url))
+    {
+        if (auto formatContext = openMappedFile(url, interruptionRequestedFlag, probe, ioCtx))
         {
-            std::vector<std::string> finalUrls{ url };
-            std::string hostname;
+            return formatContext;
+        }
+    }
+
+    int redirectsLeft = 10;
+
+    for (;;)
+    {
+        std::vector<std::string> finalUrls{ url };
+        std::string hostname;
 
-            const bool isHttps = boost::starts_with(url, "https://");
-            if (isHttps)
+        const bool isHttps = boost::starts_with(url, "https://");
+        if (isHttps)
+        {
+            if (useHHO)
             {
-                if (useHHO)
-                {
-                    const auto pos = 8; // Move past "://"
-                    size_t endPos = url.find_first_of(":/", pos);
-                    if (endPos != std::string::npos) {
-                        hostname = url.substr(pos, endPos - pos);
-                        auto ips = resolveHostnameToIPs(hostname);
-                        if (!ips.empty()) {
-                            finalUrls.clear();
-                            for (const auto& ip : ips)
-                            {
-                                std::string urlWithIp = url.substr(0, pos) + ip + url.substr(endPos);
-                                finalUrls.push_back(urlWithIp);
-                            }
+                const auto pos = 8; // Move past "://"
+                size_t endPos = url.find_first_of(":/", pos);
+                if (endPos != std::string::npos) {
+                    hostname = url.substr(pos, endPos - pos);
+                    auto ips = resolveHostnameToIPs(hostname);
+                    if (!ips.empty()) {
+                        finalUrls.clear();
+                        for (const auto& ip : ips)
+                        {
+                            std::string urlWithIp = url.substr(0, pos) + ip + url.substr(endPos);
+                            finalUrls.push_back(urlWithIp);
                         }
                     }
                 }
             }
+        }
 
-            // Open video file
+        // Open video file
 
-            g_lastLocationHttpHeader.clear();
-            g_lastHttpCode = 0;
-            g_interruptionRequestedFlag = interruptionRequestedFlag;
-            AVFormatContext* formatContext = nullptr;
-            int error = -1;
-            for (const auto& finalUrl : finalUrls)
+        RedirectCapture redirectCapture(interruptionRequestedFlag);
+        t_redirectCapture = &redirectCapture;
+        AVFormatContext* formatContext = nullptr;
+        int error = -1;
+        for (const auto& finalUrl : finalUrls)
+        {
+            AVDictionary* streamOpts = nullptr;
+            auto avOptionsGuard = MakeGuard(&streamOpts, av_dict_free);
+            av_dict_set(&streamOpts, "rw_timeout", "5000000", 0); // 5 seconds I/O timeout.
+            if (isHttps || boost::starts_with(url, "http://")) // seems to be a bug
             {
-                AVDictionary* streamOpts = nullptr;
-                auto avOptionsGuard = MakeGuard(&streamOpts, av_dict_free);
-                av_dict_set(&streamOpts, "rw_timeout", "5000000", 0); // 5 seconds I/O timeout.
-                if (isHttps || boost::starts_with(url, "http://")) // seems to be a bug
-                {
-                    av_dict_set(&streamOpts, "timeout", "5000000", 0); // 5 seconds tcp timeout.
-                }
-                if (useHHO && !hostname.empty())
-                {
-                    CHANNEL_LOG(ffmpeg_opening) << "Opening using a HHO Host: " << hostname << " URL: " << url;
-                    av_dict_set(&streamOpts, "headers", ("Host: " + hostname + "\r\n" + szUserAgent).c_str(), 0);
-                }
-                else
-                {
-                    av_dict_set(&streamOpts, "headers", szUserAgent, 0);
-                }
-
-                if (iformat)
-                {
-                    av_dict_set(&streamOpts, "rtbufsize", "15000000", 0); // https://superuser.com/questions/1158820/ffmpeg-real-time-buffer-issue-rtbufsize-parameter
-                }
-                if (iformat ? (iformat->name != nullptr && strcmp(iformat->name, "sdp") == 0) : boost::iends_with(url, ".sdp"))
-                {
-                    av_dict_set(&streamOpts, "protocol_whitelist", "file,http,https,tls,rtp,tcp,udp,crypto,httpproxy,data", 0);
-                }
-                av_dict_set(&streamOpts, "scan_all_pmts", "1", AV_DICT_DONT_OVERWRITE);
-
-                formatContext = avformat_alloc_context();
-                formatContext->interrupt_callback.opaque = interruptionRequestedFlag;
-                formatContext->interrupt_callback.callback = ThisThreadInterruptionRequested;
-
-                error = avformat_open_input(&formatContext, finalUrl.c_str(), iformat, &streamOpts);
-                if (error == 0)
-                {
-                    break;
-                }
+                av_dict_set(&streamOpts, "timeout", "5000000", 0); // 5 seconds tcp timeout.
+            }
+            if (useHHO && !hostname.empty())
+            {
+                CHANNEL_LOG(ffmpeg_opening) << "Opening using a HHO Host: " << hostname << " URL: " << url;
+                av_dict_set(&streamOpts, "headers", ("Host: " + hostname + "\r\n" + szUserAgent).c_str(), 0);
             }
-            auto formatContextGuard = MakeGuard(&formatContext, avformat_close_input);
-            g_interruptionRequestedFlag = nullptr;
-            *interruptionRequestedFlag = false;
-            if (error == 0)
+            else
             {
-                CHANNEL_LOG(ffmpeg_opening) << "Opening video/audio file...";
+                av_dict_set(&streamOpts, "headers", szUserAgent, 0);
+            }
 
-                // Retrieve stream information
-                if (avformat_find_stream_info(formatContext, nullptr) < 0)
-                {
-                    CHANNEL_LOG(ffmpeg_opening) << "Couldn't find stream information";
-                    return false;
-                }
+            if (iformat)
+            {
+                av_dict_set(&streamOpts, "rtbufsize", "15000000", 0); // https://superuser.com/questions/1158820/ffmpeg-real-time-buffer-issue-rtbufsize-parameter
+            }
+            if (iformat ? (iformat->name != nullptr && strcmp(iformat->name, "sdp") == 0) : boost::iends_with(url, ".sdp"))
+            {
+                av_dict_set(&streamOpts, "protocol_whitelist", "file,http,https,tls,rtp,tcp,udp,crypto,httpproxy,data", 0);
+            }
+            av_dict_set(&streamOpts, "scan_all_pmts", "1", AV_DICT_DONT_OVERWRITE);
 
-                m_formatContexts.push_back(formatContext);
-                formatContextGuard.release();
+            formatContext = avformat_alloc_context();
+            applyProbeSettings(formatContext, probe.settings);
+            formatContext->interrupt_callback.opaque = interruptionRequestedFlag;
+            formatContext->interrupt_callback.callback = ThisThreadInterruptionRequested;
 
+            error = avformat_open_input(&formatContext, finalUrl.c_str(), iformat, &streamOpts);
+            if (error == 0 || cancelled)
+            {
                 break;
             }
-            if (!isHttps || !useHHO || g_lastLocationHttpHeader.empty() || --redirectsLeft < 0)
+        }
+        auto formatContextGuard = MakeGuard(&formatContext, avformat_close_input);
+        t_redirectCapture = nullptr;
+        *interruptionRequestedFlag = false;
+        if (cancelled)
+        {
+            CHANNEL_LOG(ffmpeg_opening) << "Opening cancelled, url = " << url;
+            return nullptr;
+        }
+        if (error == 0)
+        {
+            CHANNEL_LOG(ffmpeg_opening) << "Opening video/audio file...";
+
+            // Retrieve stream information; redirected urls are cached under the requested one
+            const auto probeResult = probeStreams(formatContext, requestedUrl, probe);
+            if (probeResult == PROBE_STALE)
+            {
+                probe.useCachedLayout = false;
+                continue;
+            }
+            if (probeResult == PROBE_FAILED)
             {
-                char err_buf[AV_ERROR_MAX_STRING_SIZE + 2] = ": ";
-                BOOST_LOG_TRIVIAL(error) << "Couldn't open video/audio file error " << error 
-                    << (av_strerror(error, err_buf + 2, sizeof(err_buf) - 2) == 0 ? err_buf : "")
-                    << " url = " << url;
-                return false;
+                CHANNEL_LOG(ffmpeg_opening) << "Couldn't find stream information";
+                return nullptr;
             }
 
-            url = g_lastLocationHttpHeader;
-            CHANNEL_LOG(ffmpeg_opening) << "Redirecting to URL: " << url;
+            formatContextGuard.release();
+            return formatContext;
+        }
+        if (!isHttps || !useHHO || redirectCapture.lastLocationHttpHeader.empty() || --redirectsLeft < 0)
+        {
+            char err_buf[AV_ERROR_MAX_STRING_SIZE + 2] = ": ";
+            BOOST_LOG_TRIVIAL(error) << "Couldn't open video/audio file error " << error 
+                << (av_strerror(error, err_buf + 2, sizeof(err_buf) - 2) == 0 ? err_buf : "")
+                << " url = " << url;
+            return nullptr;
+        }
+
+        url = redirectCapture.lastLocationHttpHeader;
+        CHANNEL_LOG(ffmpeg_opening) << "Redirecting to URL: " << url;
+    }
+}
+
+} // namespace
+
+bool FFmpegDecoder::openUrls(std::initializer_list<std::string> urls, const std::string& inputFormat, bool useHHO)
+{
+    close();
+
+    m_formatContextInterrupts = std::vector<boost::atomic_bool>(urls.size());
+    for (auto& elem : m_formatContextInterrupts) {
+        elem.store(false);
+    }
+
+    // Separate video and audio inputs are opened and probed in parallel; the first failure cancels the others
+    std::vector<AVFormatContext*> formatContexts(urls.size(), nullptr);
+    std::vector<std::unique_ptr<DecoderIOContext>> ioContexts(urls.size());
+    boost::atomic_bool cancelled(false);
+
+    const boost::shared_ptr<ProbeCache> probeCache = m_probeCache;
+    const ProbeOptions probe{ m_probeSettings, probeCache.get(), true };
+
+    const bool memoryMapped = m_memoryMappedInput;
+
+    auto openAt = [&](size_t idx, const std::string& url)
+    {
+        formatContexts[idx] = openInput(url, inputFormat, useHHO, memoryMapped,
+            &m_formatContextInterrupts[idx], cancelled, probe, ioContexts[idx]);
+        if (formatContexts[idx] == nullptr && !cancelled.exchange(true))
+        {
+            for (auto& elem : m_formatContextInterrupts) {
+                elem = true;
+            }
+        }
+    };
+
+    // The first input is opened on this thread, so that its interruption still cancels the opening
+    std::vector<boost::thread> threads;
+    threads.reserve(urls.size());
+    for (size_t idx = 1; idx < urls.size(); ++idx)
+    {
+        threads.emplace_back(openAt, idx, std::cref(*(urls.begin() + idx)));
+    }
+    openAt(0, *urls.begin());
+
+    if (boost::this_thread::interruption_requested() && !cancelled.exchange(true))
+    {
+        for (auto& elem : m_formatContextInterrupts) {
+            elem = true;
+        }
+    }
+    {
+        boost::this_thread::disable_interruption di;
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+    }
+
+    if (cancelled)
+    {
+        for (auto& formatContext : formatContexts)
+        {
+            avformat_close_input(&formatContext);
+        }
+        return false;
+    }
+
+    m_formatContexts = std::move(formatContexts);
+    for (auto& ioCtx : ioContexts)
+    {
+        if (ioCtx)
+        {
+            m_ioContexts.push_back(std::move(ioCtx));
         }
     }
 
@@ -480,13 +758,15 @@ bool FFmpegDecoder::openStream(std::unique_ptr<std::streambuf> stream)
 {
     close();
 
-    auto ioCtx = std::make_unique<DecoderIOContext>(std::move(stream));
+    const ReadAheadSettings readAhead = m_readAhead;
+    auto ioCtx = std::make_unique<DecoderIOContext>(std::move(stream), readAhead.blockSize, readAhead.depth);
 
     auto formatContext = avformat_alloc_context();
 
     auto formatContextGuard = MakeGuard(&formatContext, avformat_close_input);
 
     ioCtx->initAVFormatContext(formatContext);
+    applyProbeSettings(formatContext, m_probeSettings);
 
     formatContext->interrupt_callback.callback = ThisThreadInterruptionRequested;
 
@@ -512,14 +792,16 @@ bool FFmpegDecoder::openStream(std::unique_ptr<std::streambuf> stream)
 
     m_formatContexts.push_back(formatContext);
     formatContextGuard.release();
-    m_ioCtx = std::move(ioCtx);
+    m_ioContexts.push_back(std::move(ioCtx));
 
     return doOpen();
 }
 
 bool FFmpegDecoder::doOpen(const std::initializer_list<std::string>& urls)
 {
-    m_referenceTime = boost::chrono::high_resolution_clock::now().time_since_epoch();
+    m_referenceTime = m_clock->now().time_since_epoch();
+
+    m_durationScanUrl = (urls.size() != 0 && isLocalFile(*urls.begin())) ? *urls.begin() : std::string();
 
     // Find the first video stream
     m_videoContextIndex = -1;
@@ -707,17 +989,16 @@ bool FFmpegDecoder::resetVideoProcessing()
             }
             else
             {
-                m_videoCodecContext->thread_count = 2;
-                m_videoCodecContext->flags2 |= AV_CODEC_FLAG2_FAST;
+                setupVideoDecoderThreading();
             }
         }
         else
 #endif
         {
-            m_videoCodecContext->thread_count = 2;
-            m_videoCodecContext->flags2 |= AV_CODEC_FLAG2_FAST;
+            setupVideoDecoderThreading();
         }
 
+        setupVideoDecodeQuality();
 
     // Open codec
         if (avcodec_open2(m_videoCodecContext, m_videoCodec, nullptr) < 0)
@@ -733,12 +1014,41 @@ bool FFmpegDecoder::resetVideoProcessing()
         //    return false;  // Could not open codec
         //}
 
+        CHANNEL_LOG(ffmpeg_opening) << "Video decoding threads: " << m_videoCodecContext->thread_count
+            << " (" << ThreadTypeName(m_videoCodecContext->active_thread_type) << ")";
+
         videoCodecContextGuard.release();
     }
 
     return true;
 }
 
+void FFmpegDecoder::setupVideoDecoderThreading()
+{
+    const DecoderThreading threading = m_decoderThreading;
+
+    m_videoCodecContext->thread_count = (threading.threadCount > 0)
+        ? std::min(threading.threadCount, MAX_DECODER_THREADS)
+        : AutoDecoderThreadCount(m_videoCodecContext->width, m_videoCodecContext->height);
+
+    switch (threading.mode)
+    {
+    case DecoderThreading::THREADING_FRAME:
+        m_videoCodecContext->thread_type = FF_THREAD_FRAME;
+        break;
+    case DecoderThreading::THREADING_SLICE:
+        m_videoCodecContext->thread_type = FF_THREAD_SLICE;
+        break;
+    default:
+        m_videoCodecContext->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+        break;
+    }
+
+    // Not a part of the policy: it trades spec compliance for speed, not threads,
+    // and has always been on for software decoding
+    m_videoCodecContext->flags2 |= AV_CODEC_FLAG2_FAST;
+}
+
 bool FFmpegDecoder::setupAudioProcessing()
 {
     m_audioCurrentPref = m_audioSettings;
@@ -865,6 +1175,11 @@ void FFmpegDecoder::SetFrameFormat(FrameFormat format, bool allowDirect3dData)
     m_allowDirect3dData = allowDirect3dData;
 }
 
+void FFmpegDecoder::setNativeFrameLayouts(unsigned int layouts)
+{
+    m_nativeFrameLayouts = layouts & ~(1u << FrameRenderingData::LAYOUT_FRAME_FORMAT);
+}
+
 void FFmpegDecoder::doOnFinishedDisplayingFrame(unsigned int generation, FinishedDisplayingMode mode)
 {
     {
@@ -900,7 +1215,59 @@ bool FFmpegDecoder::seekDuration(int64_t duration)
         return true; // previous frame special case
     }
 
-    if (!m_mainParseThreads.empty() && m_seekDuration.exchange(duration) == AV_NOPTS_VALUE)
+    if (m_mainParseThreads.empty())
+    {
+        return true;
+    }
+
+    // Refined by an exact seek when scrubbing settles
+    m_scrubSeekDuration = m_isScrubbing ? duration : int64_t(AV_NOPTS_VALUE);
+    m_exactSeekRequested = false;
+    m_seekRequestTime = m_clock->now();
+
+    // Requests coming while the previous one is in flight just replace its position
+    if (m_seekDuration.exchange(duration) == AV_NOPTS_VALUE)
+    {
+        m_videoPacketsQueue.notify();
+        m_audioPacketsQueue.notify();
+    }
+
+    return true;
+}
+
+void FFmpegDecoder::setScrubbing(bool scrubbing)
+{
+    CHANNEL_LOG(ffmpeg_seek) << __FUNCTION__ << " scrubbing=" << scrubbing;
+    m_isScrubbing = scrubbing;
+    if (!scrubbing)
+    {
+        settleScrubbing(true);
+    }
+}
+
+// Turns the pending keyframe seek position into an exact seek
+// once no seek has been requested for a while or scrubbing has ended
+bool FFmpegDecoder::settleScrubbing(bool force)
+{
+    const auto SCRUB_SETTLE_TIME = boost::chrono::milliseconds(250);
+
+    if (m_scrubSeekDuration == AV_NOPTS_VALUE || m_mainParseThreads.empty()
+        || (!force && m_clock->now() - m_seekRequestTime.load() < SCRUB_SETTLE_TIME))
+    {
+        return false;
+    }
+
+    const int64_t duration = m_scrubSeekDuration.exchange(AV_NOPTS_VALUE);
+    if (duration == AV_NOPTS_VALUE)
+    {
+        return false;
+    }
+
+    CHANNEL_LOG(ffmpeg_seek) << "Refining scrubbing position " << duration;
+
+    m_exactSeekRequested = true;
+    m_seekRequestTime = m_clock->now();
+    if (m_seekDuration.exchange(duration) == AV_NOPTS_VALUE)
     {
         m_videoPacketsQueue.notify();
         m_audioPacketsQueue.notify();
@@ -969,6 +1336,27 @@ bool FFmpegDecoder::getFrameRenderingData(FrameRenderingData *data)
     data->pitch = current_frame.m_image->linesize;
     data->width = current_frame.m_image->width;
     data->height = current_frame.m_image->height;
+
+    data->layout = (current_frame.m_image->format == m_pixelFormat)
+        ? FrameRenderingData::LAYOUT_FRAME_FORMAT : GetNativeFrameLayout(current_frame.m_image->format);
+    switch (current_frame.m_image->colorspace)
+    {
+    case AVCOL_SPC_BT470BG:
+    case AVCOL_SPC_SMPTE170M:
+        data->colorMatrix = FrameRenderingData::COLOR_MATRIX_BT601;
+        break;
+    case AVCOL_SPC_BT709:
+        data->colorMatrix = FrameRenderingData::COLOR_MATRIX_BT709;
+        break;
+    case AVCOL_SPC_BT2020_NCL:
+    case AVCOL_SPC_BT2020_CL:
+        data->colorMatrix = FrameRenderingData::COLOR_MATRIX_BT2020;
+        break;
+    default:
+        data->colorMatrix = (data->height >= 720)
+            ? FrameRenderingData::COLOR_MATRIX_BT709 : FrameRenderingData::COLOR_MATRIX_BT601;
+    }
+    data->fullRange = current_frame.m_image->color_range == AVCOL_RANGE_JPEG;
     if (current_frame.m_image->sample_aspect_ratio.num != 0
         && current_frame.m_image->sample_aspect_ratio.den != 0)
     {
@@ -990,6 +1378,34 @@ bool FFmpegDecoder::getFrameRenderingData(FrameRenderingData *data)
     return true;
 }
 
+FrameRenderingHandle FFmpegDecoder::getFrameRenderingHandle()
+{
+    // Keeps its own reference to the frame buffers
+    struct FrameReference : FrameRenderingData
+    {
+        AVFramePtr frame;
+    };
+
+    FrameRenderingData data;
+    if (!getFrameRenderingData(&data) || data.surface != nullptr)
+    {
+        return {};
+    }
+
+    auto result = std::make_shared<FrameReference>();
+    result->frame.reset(av_frame_clone(m_videoFramesQueue.front().m_image.get()));
+    if (!result->frame)
+    {
+        return {};
+    }
+
+    static_cast<FrameRenderingData&>(*result) = data;
+    result->image = result->frame->data;
+    result->pitch = result->frame->linesize;
+
+    return result;
+}
+
 double FFmpegDecoder::getDurationSecs(int64_t duration) const
 {
     return av_q2d(basedOnVideoStream()
@@ -1144,7 +1560,7 @@ void FFmpegDecoder::setSpeedRational(const RationalNumber& speed)
     const auto time = GetHiResTime();
     m_speedRational = speed;
 
-    m_referenceTime = (boost::chrono::high_resolution_clock::now()
+    m_referenceTime = (m_clock->now()
             - boost::chrono::microseconds(int64_t(time * speed.denominator / speed.numerator * 1000000.)))
         .time_since_epoch();
 }
@@ -1193,6 +1609,11 @@ std::vector<std::string> FFmpegDecoder::getProperties() const
             "%d / %d @ %.2f FPS %d BPP %d bits", 
             m_videoCodecContext->width, m_videoCodecContext->height, fps, bpp, depth);
         result.emplace_back(buffer);
+
+        snprintf(buffer, sizeof(buffer) / sizeof(buffer[0]),
+            "%d decoding thread(s), %s threading",
+            m_videoCodecContext->thread_count, ThreadTypeName(m_videoCodecContext->active_thread_type));
+        result.emplace_back(buffer);
     }
 
     if (m_audioCodec && m_audioCodec->long_name)
@@ -1268,10 +1689,19 @@ double FFmpegDecoder::GetHiResTime() const
 {
     const auto speed = getSpeedRational();
     return boost::chrono::duration_cast<boost::chrono::microseconds>(
-        boost::chrono::high_resolution_clock::now() - boost::chrono::high_resolution_clock::time_point(m_referenceTime)).count()
+        m_clock->now() - boost::chrono::high_resolution_clock::time_point(m_referenceTime)).count()
             / 1000000. * speed.numerator / speed.denominator;
 }
 
+// Clock time at which GetHiResTime() reaches time at the current speed
+boost::chrono::high_resolution_clock::time_point FFmpegDecoder::GetHiResTimePoint(double time) const
+{
+    const auto speed = getSpeedRational();
+    return boost::chrono::high_resolution_clock::time_point(m_referenceTime)
+        + boost::chrono::duration_cast<boost::chrono::high_resolution_clock::duration>(
+            boost::chrono::duration<double>(time * speed.denominator / speed.numerator));
+}
+
 bool FFmpegDecoder::basedOnVideoStream() const 
 { 
     return m_videoStream != nullptr &&
@@ -1289,6 +1719,16 @@ void FFmpegDecoder::setHwAccelerated(bool hwAccelerated)
     m_hwAccelerated = hwAccelerated;
 }
 
+DecoderThreading FFmpegDecoder::getDecoderThreading() const
+{
+    return m_decoderThreading;
+}
+
+void FFmpegDecoder::setDecoderThreading(const DecoderThreading& threading)
+{
+    m_decoderThreading = threading;
+}
+
 std::vector<std::string> FFmpegDecoder::listSubtitles() const
 {
     std::vector<std::string> result;
@@ -1375,3 +1815,84 @@ void FFmpegDecoder::setImageConversionFunc(ImageConversionFunc func)
 {
     m_imageConversionFunc = boost::make_shared<ImageConversionFunc>(std::move(func));
 }
+
+std::pair<PacketQueueLimits, PacketQueueLimits> FFmpegDecoder::getPacketQueueLimits() const
+{
+    return {
+        { m_videoPacketsQueue.maxSeconds(), m_videoPacketsQueue.maxBytes() },
+        { m_audioPacketsQueue.maxSeconds(), m_audioPacketsQueue.maxBytes() } };
+}
+
+void FFmpegDecoder::setPacketQueueLimits(const PacketQueueLimits& video, const PacketQueueLimits& audio)
+{
+    CHANNEL_LOG(ffmpeg_opening) << "Packet queue limits: video " << video.maxSeconds << " s / "
+        << video.maxBytes << " bytes; audio " << audio.maxSeconds << " s / " << audio.maxBytes << " bytes";
+    m_videoPacketsQueue.setLimits(video.maxSeconds, video.maxBytes);
+    m_audioPacketsQueue.setLimits(audio.maxSeconds, audio.maxBytes);
+}
+
+int FFmpegDecoder::getFrameQueueDepth() const
+{
+    return m_frameQueueDepth;
+}
+
+void FFmpegDecoder::setFrameQueueDepth(int depth)
+{
+    m_frameQueueDepth = std::max<int>(VQueue::MIN_QUEUE_SIZE, std::min<int>(depth, VQueue::MAX_QUEUE_SIZE));
+}
+
+ReadAheadSettings FFmpegDecoder::getReadAhead() const
+{
+    return m_readAhead;
+}
+
+void FFmpegDecoder::setReadAhead(const ReadAheadSettings& settings)
+{
+    CHANNEL_LOG(ffmpeg_opening) << "Read-ahead: " << settings.depth << " blocks of " << settings.blockSize << " bytes";
+    m_readAhead = settings;
+}
+
+ProbeSettings FFmpegDecoder::getProbeSettings() const
+{
+    return m_probeSettings;
+}
+
+void FFmpegDecoder::setProbeSettings(const ProbeSettings& settings)
+{
+    CHANNEL_LOG(ffmpeg_opening) << "Probe size: " << settings.probeSize
+        << " analyze duration: " << settings.analyzeDuration;
+    m_probeSettings = settings;
+}
+
+void FFmpegDecoder::setProbeCacheFile(const std::string& cacheFile)
+{
+    CHANNEL_LOG(ffmpeg_opening) << "Probe cache file: " << cacheFile;
+    m_probeCache = cacheFile.empty() ? boost::shared_ptr<ProbeCache>() : boost::make_shared<ProbeCache>(cacheFile);
+}
+
+PresentationStats FFmpegDecoder::getPresentationStats() const
+{
+    return m_presentationStats.snapshot();
+}
+
+void FFmpegDecoder::resetPresentationStats()
+{
+    m_presentationStats.reset();
+}
+
+DecoderMetrics FFmpegDecoder::getMetrics() const
+{
+    DecoderMetrics result{};
+    m_metrics.snapshot(result);
+
+    result.videoQueue = { int64_t(m_videoPacketsQueue.packets()), m_videoPacketsQueue.bytes(), m_videoPacketsQueue.seconds() };
+    result.audioQueue = { int64_t(m_audioPacketsQueue.packets()), m_audioPacketsQueue.bytes(), m_audioPacketsQueue.seconds() };
+    result.framesDropped = m_presentationStats.snapshot().framesDropped;
+
+    return result;
+}
+
+void FFmpegDecoder::resetMetrics()
+{
+    m_metrics.reset();
+}
@@ -73,6 +73,12 @@ extern ChannelLogger
 #include "fqueue.h"
 #include "videoframe.h"
 #include "vqueue.h"
+#include "decodermetrics.h"
+#include "tracing.h"
+#include "conversionpool.h"
+#include "decodequalitygovernor.h"
+#include "presentationstats.h"
+#include "clock.h"
 
 struct RendezVousData
 {
@@ -83,6 +89,7 @@ struct RendezVousData
 };
 
 class DecoderIOContext;
+class ProbeCache;
 
 
 // Inspired by http://dranger.com/ffmpeg/ffmpeg.html
@@ -97,6 +104,7 @@ class FFmpegDecoder final : public IFrameDecoder, public IAudioPlayerCallback
     FFmpegDecoder& operator=(const FFmpegDecoder&) = delete;
 
     void SetFrameFormat(FrameFormat format, bool allowDirect3dData) override;
+    void setNativeFrameLayouts(unsigned int layouts) override;
 
     bool openUrls(std::initializer_list<std::string> urls, const std::string& inputFormat = {}, bool useHHO = false) override;
     bool openStream(std::unique_ptr<std::streambuf> stream) override;
@@ -105,6 +113,8 @@ class FFmpegDecoder final : public IFrameDecoder, public IAudioPlayerCallback
 
     void videoReset() override;
 
+    void setScrubbing(bool scrubbing) override;
+
     double volume() const override;
 
     bool isPlaying() const override { return m_isPlaying; }
@@ -118,6 +128,7 @@ class FFmpegDecoder final : public IFrameDecoder, public IAudioPlayerCallback
     }
 
     bool getFrameRenderingData(FrameRenderingData* data) override;
+    FrameRenderingHandle getFrameRenderingHandle() override;
 
     double getDurationSecs(int64_t duration) const override;
 
@@ -140,6 +151,9 @@ class FFmpegDecoder final : public IFrameDecoder, public IAudioPlayerCallback
     bool getHwAccelerated() const override;
     void setHwAccelerated(bool hwAccelerated) override;
 
+    DecoderThreading getDecoderThreading() const override;
+    void setDecoderThreading(const DecoderThreading& threading) override;
+
     std::vector<std::string> getProperties() const override;
 
     std::pair<int, int> getVideoSize() const override;
@@ -151,14 +165,50 @@ class FFmpegDecoder final : public IFrameDecoder, public IAudioPlayerCallback
 
     void setImageConversionFunc(ImageConversionFunc func) override;
 
+    std::pair<PacketQueueLimits, PacketQueueLimits> getPacketQueueLimits() const override;
+    void setPacketQueueLimits(const PacketQueueLimits& video, const PacketQueueLimits& audio) override;
+
+    int getFrameQueueDepth() const override;
+    void setFrameQueueDepth(int depth) override;
+
+    ReadAheadSettings getReadAhead() const override;
+    void setReadAhead(const ReadAheadSettings& settings) override;
+
+    ProbeSettings getProbeSettings() const override;
+    void setProbeSettings(const ProbeSettings& settings) override;
+    void setProbeCacheFile(const std::string& cacheFile) override;
+
+    bool getMemoryMappedInput() const override { return m_memoryMappedInput; }
+    void setMemoryMappedInput(bool memoryMapped) override { m_memoryMappedInput = memoryMapped; }
+
+    bool getFreeRunning() const override { return m_freeRunning; }
+    void setFreeRunning(bool freeRunning) override { m_freeRunning = freeRunning; }
+
+    void setClock(IClock* clock) override { m_clock = (clock != nullptr) ? clock : &GetSystemClock(); }
+    void setSimulatedDecodeCost(double seconds) override { m_simulatedDecodeCost = seconds; }
+
+    PresentationStats getPresentationStats() const override;
+    void resetPresentationStats() override;
+
+    DecoderMetrics getMetrics() const override;
+    void resetMetrics() override;
+
    private:
     struct VideoParseContext;
 
+    enum SeekMode
+    {
+        SEEK_DEFAULT,
+        SEEK_KEYFRAME,  // scrubbing: nearest preceding keyframe is shown as is
+        SEEK_EXACT,     // frames preceding the seek position are decoded but not shown
+    };
+
     // Threads
     void parseRunnable(int idx);
     void audioParseRunnable();
     void videoParseRunnable();
     void displayRunnable();
+    void durationRunnable(std::string url, int streamIndex, int streamId, AVRational timeBase);
 
     bool doOpen(const std::initializer_list<std::string>& urls = {});
     void LoadSubtitleItems(const std::initializer_list<std::string>& urls);
@@ -168,8 +218,10 @@ class FFmpegDecoder final : public IFrameDecoder, public IAudioPlayerCallback
     void startAudioThread();
     void startVideoThread();
     bool resetDecoding(int64_t seekDuration, bool resetVideo);
-    bool doSeekFrame(int idx, int64_t seekDuration, AVPacket* packet);
-    bool respawn(int64_t seekDuration, bool resetVideo);
+    bool doSeekFrame(int idx, int64_t seekDuration, AVPacket* packet, bool toPrecedingKeyFrame = false);
+    bool flushDecoding(int64_t seekDuration, bool resetVideo, SeekMode seekMode);
+    bool settleScrubbing(bool force);
+    void restartVideoDecoding();
 
     void fixDuration();
 
@@ -195,6 +247,10 @@ class FFmpegDecoder final : public IFrameDecoder, public IAudioPlayerCallback
     void closeProcessing();
 
     bool resetVideoProcessing();
+    void setupVideoDecoderThreading();
+    void setupVideoDecodeQuality();
+    bool isVideoLowresPending() const;
+    void updateDecodeQuality(double lateness);
     bool setupAudioProcessing();
     bool setupAudioCodec();
     bool initAudioOutput();
@@ -204,6 +260,7 @@ class FFmpegDecoder final : public IFrameDecoder, public IAudioPlayerCallback
     void handleDirect3dData(AVFrame* videoFrame, bool forceConversion);
 
     double GetHiResTime() const;
+    boost::chrono::high_resolution_clock::time_point GetHiResTimePoint(double time) const;
 
     bool basedOnVideoStream() const;
 
@@ -219,6 +276,7 @@ class FFmpegDecoder final : public IFrameDecoder, public IAudioPlayerCallback
     std::unique_ptr<boost::thread> m_mainAudioThread;
     std::vector<std::unique_ptr<boost::thread>> m_mainParseThreads;
     std::unique_ptr<boost::thread> m_mainDisplayThread;
+    std::unique_ptr<boost::thread> m_durationThread;
 
     // Synchronization
     boost::atomic<double> m_audioPTS;
@@ -226,7 +284,9 @@ class FFmpegDecoder final : public IFrameDecoder, public IAudioPlayerCallback
     // Real duration from video stream
     int64_t m_startTime;
     boost::atomic_int64_t m_currentTime;
-    int64_t m_duration;
+    boost::atomic_int64_t m_duration;  // refined in the background if estimated by fixDuration()
+    boost::atomic_int64_t m_refinedDuration;  // found by durationRunnable, applied by the parse thread
+    std::string m_durationScanUrl;     // local file of the first context; empty if it can't be reopened
 
     boost::atomic_int64_t m_prevTime;
 
@@ -241,7 +301,22 @@ class FFmpegDecoder final : public IFrameDecoder, public IAudioPlayerCallback
     RendezVousData m_seekRendezVous;
     RendezVousData m_videoResetRendezVous;
 
+    // Scrubbing
+    boost::atomic_bool m_isScrubbing;
+    boost::atomic_int64_t m_scrubSeekDuration; // pending exact seek refining the keyframe one
+    boost::atomic_bool m_exactSeekRequested;
+    boost::atomic_int64_t m_exactSeekDuration; // of the current generation; AV_NOPTS_VALUE if not exact
+    boost::atomic<IClock::time_point> m_seekRequestTime; // of the latest seek request, on m_clock
+    // Of the current generation, min() if it isn't timed; guarded by m_videoFramesMutex
+    IClock::time_point m_seekStartTime = IClock::time_point::min();
+    SeekMode m_seekMode = SEEK_DEFAULT;        // of the current generation; guarded by m_videoFramesMutex
+
     boost::atomic_bool m_videoResetting;
+    boost::atomic_bool m_videoResetRequested;
+
+    // Bumped on every seek and video reset; the decoding threads stay alive
+    // and drop everything belonging to previous generations
+    boost::atomic_uint m_decodingGeneration{ 0 };
 
     // Video Stuff
     enum { VIDEO_START_CLOCK_NOT_INITIALIZED = -1000000000 };
@@ -252,6 +327,7 @@ class FFmpegDecoder final : public IFrameDecoder, public IAudioPlayerCallback
     AVStream* m_videoStream;
     int m_videoContextIndex;
     int m_videoStreamNumber;
+    DecodeQualityGovernor m_decodeQualityGovernor; // accessed from the video thread once opened
 
     // Audio Stuff
     const AVCodec* m_audioCodec;
@@ -260,6 +336,7 @@ class FFmpegDecoder final : public IFrameDecoder, public IAudioPlayerCallback
     int m_audioContextIndex;
     boost::atomic<int> m_audioStreamNumber;
     SwrContext* m_audioSwrContext;
+    unsigned int m_audioGeneration{}; // accessed from the audio thread only
 
     struct AudioParams
     {
@@ -286,22 +363,28 @@ class FFmpegDecoder final : public IFrameDecoder, public IAudioPlayerCallback
     SwsContext* m_imageCovertContext;
     AVPixelFormat m_pixelFormat;
     bool m_allowDirect3dData;
+    boost::atomic_uint m_nativeFrameLayouts{ 0 };
 
     // Video and audio queues
     enum
     {
-        MAX_VIDEO_QUEUE_SIZE = 100 * 1024 * 1024,
-        MAX_AUDIO_QUEUE_SIZE = 15 * 1024 * 1024,
-        MAX_VIDEO_FRAMES = 500,
-        MAX_AUDIO_FRAMES = 500,
+        MAX_VIDEO_PACKETS = 2048,
+        MAX_AUDIO_PACKETS = 2048,
     };
-    FQueue<MAX_VIDEO_QUEUE_SIZE, MAX_VIDEO_FRAMES> m_videoPacketsQueue;
-    FQueue<MAX_AUDIO_QUEUE_SIZE, MAX_AUDIO_FRAMES> m_audioPacketsQueue;
+    FQueue m_videoPacketsQueue;
+    FQueue m_audioPacketsQueue;
 
     VQueue m_videoFramesQueue;
+    boost::atomic_int m_frameQueueDepth; // applied to m_videoFramesQueue on close
+
+    // Runs ImageConversionFunc; declared after the frames it writes to so that it is destroyed first
+    std::unique_ptr<ConversionPool> m_conversionPool;
 
     bool m_frameDisplayingRequested;
 
+    PresentationStatsCollector m_presentationStats;
+    DecoderMetricsCollector m_metrics;
+
     unsigned int m_generation = 0;
 
     boost::mutex m_videoFramesMutex;
@@ -320,7 +403,7 @@ class FFmpegDecoder final : public IFrameDecoder, public IAudioPlayerCallback
 
     std::vector<int> m_audioIndices;
 
-    std::unique_ptr<DecoderIOContext> m_ioCtx;
+    std::vector<std::unique_ptr<DecoderIOContext>> m_ioContexts; // custom IO of the format contexts having one
 
     boost::atomic<boost::chrono::high_resolution_clock::duration> m_referenceTime;
 
@@ -328,6 +411,17 @@ class FFmpegDecoder final : public IFrameDecoder, public IAudioPlayerCallback
 
     bool m_hwAccelerated;
 
+    boost::atomic<DecoderThreading> m_decoderThreading;
+    boost::atomic<ReadAheadSettings> m_readAhead;
+    boost::atomic<ProbeSettings> m_probeSettings;
+    boost::atomic_shared_ptr<ProbeCache> m_probeCache;
+
+    boost::atomic_bool m_freeRunning{ false };
+    boost::atomic_bool m_memoryMappedInput{ false };
+
+    IClock* m_clock = &GetSystemClock();
+    boost::atomic<double> m_simulatedDecodeCost{ 0 };
+
     struct SubtitleItem {
         int contextIdx;
         int streamIdx;
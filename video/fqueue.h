@@ -1,127 +1,199 @@
 #pragma once
 
+#include "makeguard.h"
+#include "tracing.h"
+
+#include <boost/atomic.hpp>
 #include <boost/thread/thread.hpp>
-#include <deque>
+#include <cassert>
 #include <map>
 #include <type_traits>
+#include <vector>
 
-template<size_t MAX_QUEUE_SIZE, size_t MAX_FRAMES>
+constexpr size_t RingCapacity(size_t size)
+{
+    size_t result = 1;
+    while (result < size)
+        result <<= 1;
+    return result;
+}
+
+// Bounded single-producer/single-consumer packet ring.
+// push() is called by the parse thread, pop() by the decoding thread; they block only
+// when the ring is full or empty, waiting on an atomic event counter (futex / WaitOnAddress)
+// instead of a mutex and a condition variable.
+// notify() wakes a blocked side so that it can re-check its abort condition.
+// Every packet carries the decoding generation it was demuxed in, so that the consumer
+// can drop packets queued before a seek and flush its codec on a generation change.
+// The queue is bounded by the buffered media duration; the byte limit and the ring
+// capacity act as a safety net for streams lacking packet durations.
 class FQueue
 {
 public:
-    FQueue()  {}
+    explicit FQueue(size_t maxPackets) : m_ring(RingCapacity(maxPackets)) {}
     FQueue(const FQueue&) = delete;
     FQueue& operator=(const FQueue&) = delete;
 
+    ~FQueue() { clear(); }
+
     template<typename T>
-    bool push(const AVPacket& packet, T abortFunc)
+    bool push(const AVPacket& packet, AVRational timeBase, unsigned int generation, T abortFunc)
     {
         const auto pos = packet.pos;
         const auto dts = packet.dts;
         auto& prev = m_positions[packet.stream_index];
+        if (prev.m_generation != generation)
+        {
+            // Positions of the packets demuxed before a seek don't matter any more
+            prev = PositionData{};
+            prev.m_generation = generation;
+        }
         if ((dts != AV_NOPTS_VALUE) ? dts < prev.m_dts
             : (pos != -1 && pos < prev.m_pos))
         {
             return false;
         }
 
-        bool wasEmpty;
-        {
-            boost::unique_lock<boost::mutex> locker(m_mutex);
-            while (isPacketsQueueFull())
-            {
-                if (abortFunc())
-                {
-                    return false;
-                }
-                m_condVar.wait(locker);
-            }
-            wasEmpty = m_queue.empty();
-            enqueue(packet);
-            if (pos != -1)
-                prev.m_pos = pos;
-            if (dts != AV_NOPTS_VALUE)
-                prev.m_dts = dts;
-        }
-        if (wasEmpty)
+        // Fall back to the dts step if the demuxer didn't provide the packet duration
+        int64_t duration = (packet.duration > 0) ? packet.duration
+            : (dts != AV_NOPTS_VALUE && prev.m_dts != AV_NOPTS_VALUE) ? dts - prev.m_dts : 0;
+        duration = (timeBase.num > 0 && timeBase.den > 0)
+            ? av_rescale_q(duration, timeBase, AVRational{ 1, AV_TIME_BASE }) : 0;
+
+        const auto tail = m_tail.load(boost::memory_order_relaxed);
+        if (!waitFor([this, tail] { return !isPacketsQueueFull(tail); }, abortFunc))
         {
-            m_condVar.notify_all();
+            return false;
         }
 
+        auto& entry = m_ring[tail & (m_ring.size() - 1)];
+        entry.packet = packet;
+        entry.duration = duration;
+        entry.generation = generation;
+        m_packetsSize += packet.size;
+        m_packetsDuration += duration;
+        m_tail = tail + 1;
+
+        if (pos != -1)
+            prev.m_pos = pos;
+        if (dts != AV_NOPTS_VALUE)
+            prev.m_dts = dts;
+
+        wakeWaiters();
+
         return true;
     }
 
     template<typename T = std::false_type>
-    bool pop(AVPacket& packet, T abortFunc = T())
+    bool pop(AVPacket& packet, unsigned int& generation, T abortFunc = T())
     {
-        bool wasFull;
+        const auto head = m_head.load(boost::memory_order_relaxed);
+        if (!waitFor([this, head] { return m_tail != head; }, abortFunc))
         {
-            boost::unique_lock<boost::mutex> locker(m_mutex);
+            return false;
+        }
 
-            while (m_queue.empty())
-            {
-                if (abortFunc())
-                {
-                    return false;
-                }
-                m_condVar.wait(locker);
-            }
+        const auto& entry = m_ring[head & (m_ring.size() - 1)];
+        packet = entry.packet;
+        generation = entry.generation;
+        m_packetsSize -= packet.size;
+        m_packetsDuration -= entry.duration;
+        assert(m_packetsSize >= 0);
+        m_head = head + 1;
 
-            wasFull = isPacketsQueueFull();
-            packet = dequeue();
-        }
-        if (wasFull)
-        {
-            m_condVar.notify_all();
-        }
+        wakeWaiters();
 
         return true;
     }
 
+    // Not thread safe: both the producer and the consumer must be stopped.
     void clear()
     {
-        for (AVPacket& packet : m_queue)
+        for (auto head = m_head.load(); head != m_tail; ++head)
         {
-            av_packet_unref(&packet);
+            av_packet_unref(&m_ring[head & (m_ring.size() - 1)].packet);
         }
+        m_head = 0;
+        m_tail = 0;
         m_packetsSize = 0;
+        m_packetsDuration = 0;
         m_positions.clear();
-        std::deque<AVPacket>().swap(m_queue);
     }
 
-    bool empty()
+    bool empty() const
     {
-        boost::lock_guard<boost::mutex> locker(m_mutex);
-        return m_queue.empty();
+        return m_head == m_tail;
     }
 
     void notify()
     {
-        m_condVar.notify_all();
+        ++m_event;
+        m_event.notify_all();
+    }
+
+    void setLimits(double maxSeconds, int64_t maxBytes)
+    {
+        m_maxDuration = int64_t(maxSeconds * AV_TIME_BASE);
+        m_maxBytes = maxBytes;
+        notify();
     }
 
+    double maxSeconds() const { return double(m_maxDuration) / AV_TIME_BASE; }
+    int64_t maxBytes() const { return m_maxBytes; }
+
+    // May be called from any thread; the values are approximate while the queue is in use
+    size_t packets() const
+    {
+        const size_t head = m_head;
+        return m_tail - head;
+    }
+    int64_t bytes() const { return m_packetsSize; }
+    double seconds() const { return double(m_packetsDuration) / AV_TIME_BASE; }
+
 private:
-    AVPacket dequeue()
+    bool isPacketsQueueFull(size_t tail) const
     {
-        assert(!m_queue.empty());
-        AVPacket packet = m_queue.front();
-        m_queue.pop_front();
-        m_packetsSize -= packet.size;
-        assert(m_packetsSize >= 0);
-        return packet;
+        return m_packetsDuration > m_maxDuration ||
+            m_packetsSize > m_maxBytes ||
+            tail - m_head >= m_ring.size();
     }
 
-    void enqueue(const AVPacket& packet)
+    // Both the waiter and the notifier use sequentially consistent operations:
+    // either the waiter sees the new head/tail or the notifier sees the waiter.
+    template<typename P, typename T>
+    bool waitFor(P ready, T& abortFunc)
     {
-        m_packetsSize += packet.size;
-        assert(m_packetsSize >= 0);
-        m_queue.push_back(packet);
+        if (ready())
+        {
+            return true;
+        }
+
+        TRACE_SCOPE("packet queue wait");
+        ++m_waiters;
+        auto waitersGuard = MakeGuard(&m_waiters, [](boost::atomic_uint* waiters) { --*waiters; });
+
+        for (;;)
+        {
+            const unsigned int event = m_event;
+            if (ready())
+            {
+                return true;
+            }
+            if (abortFunc())
+            {
+                return false;
+            }
+            boost::this_thread::interruption_point();
+            m_event.wait(event);
+        }
     }
 
-    bool isPacketsQueueFull() const
+    void wakeWaiters()
     {
-        return m_packetsSize > MAX_QUEUE_SIZE ||
-            m_queue.size() > MAX_FRAMES;
+        if (m_waiters != 0)
+        {
+            notify();
+        }
     }
 
 private:
@@ -129,13 +201,28 @@ private:
     {
         int64_t	m_pos = -1;
         int64_t m_dts = AV_NOPTS_VALUE;
+        unsigned int m_generation = 0;
+    };
+
+    struct Entry
+    {
+        AVPacket packet;
+        int64_t duration; // AV_TIME_BASE units
+        unsigned int generation;
     };
 
-    int64_t	m_packetsSize = 0;
-    std::deque<AVPacket> m_queue;
+    std::vector<Entry> m_ring;
+
+    alignas(64) boost::atomic<size_t> m_head{ 0 };   // written by the consumer
+    alignas(64) boost::atomic<size_t> m_tail{ 0 };   // written by the producer
+    alignas(64) boost::atomic_int64_t m_packetsSize{ 0 };
+    boost::atomic_int64_t m_packetsDuration{ 0 };
+
+    boost::atomic_int64_t m_maxDuration{ 0 };
+    boost::atomic_int64_t m_maxBytes{ 0 };
 
-    boost::mutex m_mutex;
-    boost::condition_variable m_condVar;
+    boost::atomic_uint m_event{ 0 };
+    boost::atomic_uint m_waiters{ 0 };
 
-    std::map<int, PositionData> m_positions;
+    std::map<int, PositionData> m_positions; // producer side only
 };
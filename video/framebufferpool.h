@@ -0,0 +1,114 @@
+#pragma once
+
+extern "C" {
+#include <libavutil/buffer.h>
+#include <libavutil/imgutils.h>
+}
+
+#include <algorithm>
+#include <boost/thread/lock_guard.hpp>
+#include <boost/thread/mutex.hpp>
+#include <tuple>
+#include <vector>
+
+// Recycles picture buffers of the display frames, one AVBufferPool per format and size.
+// A buffer returns to its pool once the last frame referencing it is unreferenced,
+// so frames swapped out to the decoder or dropped on a seek come back as well.
+// Used by the video thread and the conversion workers concurrently.
+class FrameBufferPool
+{
+public:
+    enum { ALIGN = 16 };
+
+    FrameBufferPool() = default;
+    FrameBufferPool(const FrameBufferPool&) = delete;
+    FrameBufferPool& operator=(const FrameBufferPool&) = delete;
+
+    // Pools having buffers in use are freed when the last buffer is returned
+    ~FrameBufferPool()
+    {
+        for (auto& entry : m_pools)
+        {
+            av_buffer_pool_uninit(&entry.pool);
+        }
+    }
+
+    // frame must be unreferenced, with format, width and height set
+    bool getBuffer(AVFrame* frame)
+    {
+        const Key key{ frame->format, frame->width, frame->height };
+        AVBufferPool* pool = findPool(key);
+        if (pool == nullptr)
+        {
+            return false;
+        }
+
+        AVBufferRef* buffer = av_buffer_pool_get(pool);
+        if (buffer == nullptr)
+        {
+            return false;
+        }
+
+        if (av_image_fill_arrays(frame->data, frame->linesize, buffer->data,
+                AVPixelFormat(frame->format), frame->width, frame->height, ALIGN) < 0)
+        {
+            av_buffer_unref(&buffer);
+            return false;
+        }
+
+        frame->buf[0] = buffer;
+        frame->extended_data = frame->data;
+        return true;
+    }
+
+private:
+    typedef std::tuple<int, int, int> Key; // format, width, height
+
+    struct Entry
+    {
+        Key key;
+        AVBufferPool* pool;
+    };
+
+    enum { MAX_POOLS = 4 }; // a resolution change leaves the previous pools unused
+
+    AVBufferPool* findPool(const Key& key)
+    {
+        boost::lock_guard<boost::mutex> locker(m_mutex);
+        for (auto it = m_pools.begin(); it != m_pools.end(); ++it)
+        {
+            if (it->key == key)
+            {
+                // Most recently used first
+                std::rotate(m_pools.begin(), it, it + 1);
+                return m_pools.front().pool;
+            }
+        }
+
+        const int size = av_image_get_buffer_size(AVPixelFormat(std::get<0>(key)),
+            std::get<1>(key), std::get<2>(key), ALIGN);
+        if (size <= 0)
+        {
+            return nullptr;
+        }
+
+        // Padding for SIMD readers overrunning the last row
+        AVBufferPool* pool = av_buffer_pool_init(size + AV_INPUT_BUFFER_PADDING_SIZE, av_buffer_alloc);
+        if (pool == nullptr)
+        {
+            return nullptr;
+        }
+
+        if (m_pools.size() >= MAX_POOLS)
+        {
+            av_buffer_pool_uninit(&m_pools.back().pool);
+            m_pools.pop_back();
+        }
+        m_pools.insert(m_pools.begin(), Entry{ key, pool });
+        return pool;
+    }
+
+private:
+    boost::mutex m_mutex;
+    std::vector<Entry> m_pools;
+};
@@ -0,0 +1,641 @@
+#include "frameconversion.h"
+
+extern "C"
+{
+#include "libavutil/cpu.h"
+#include "libavutil/imgutils.h"
+#include "libswscale/swscale.h"
+}
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#endif
+
+#include <boost/log/trivial.hpp>
+#include <algorithm>
+#include <cassert>
+#include <utility>
+
+namespace {
+
+#define SUBSAMPLE(v, a, s) (v < 0) ? (-((-v + a) >> s)) : ((v + a) >> s)
+
+inline uint8_t clamp255(uint32_t v) {
+    const uint8_t noOverflowCandidate = v;
+    return (noOverflowCandidate == v) ? noOverflowCandidate : 255;
+}
+
+#define C16TO8(v, scale) clamp255(((v) * (scale)) >> 16)
+
+const auto DITHER_SCALE = 16352;
+
+// Use scale to convert lsb formats to msb, depending how many bits there are:
+// 32768 = 9 bits
+// 16384 = 10 bits (dither - 16352)
+// 4096 = 12 bits
+// 256 = 16 bits
+
+// Row kernels process width pixels, width being a multiple of the kernel step.
+// odd_even_add is either 0, 0x00000002 or 0x00030001; its low half is added to even pixels,
+// its high half to odd ones.
+typedef void (*Convert16To8RowFunc)(const uint16_t* src_y, uint8_t* dst_y, int scale, int width, uint32_t odd_even_add);
+// Splits interleaved 16 bit UV samples (P010/P016) into 8 bit planes
+typedef void (*SplitUVRow16To8Func)(const uint16_t* src_uv, uint8_t* dst_u, uint8_t* dst_v, int scale, int width);
+
+void Convert16To8Row_C(const uint16_t* src_y, uint8_t* dst_y, int scale, int width, uint32_t odd_even_add)
+{
+    const uint32_t add[] = { odd_even_add & 0xFFFF, odd_even_add >> 16 };
+    for (int x = 0; x < width; ++x) {
+        dst_y[x] = C16TO8(uint16_t(src_y[x] + add[x & 1]), scale);
+    }
+}
+
+void SplitUVRow16To8_C(const uint16_t* src_uv, uint8_t* dst_u, uint8_t* dst_v, int scale, int width)
+{
+    for (int x = 0; x < width; ++x) {
+        dst_u[x] = C16TO8(src_uv[0], scale);
+        dst_v[x] = C16TO8(src_uv[1], scale);
+        src_uv += 2;
+    }
+}
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+
+#define HAS_X86_KERNELS
+
+#if defined(__GNUC__) || defined(__clang__)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#else
+#define TARGET_AVX2
+#define TARGET_SSE2
+#endif
+
+// 16 pixels per iteration
+TARGET_SSE2
+void Convert16To8Row_SSE2(const uint16_t* src_y, uint8_t* dst_y, int scale, int width, uint32_t odd_even_add)
+{
+    // Load scale factor into SIMD register
+    const __m128i s = _mm_set1_epi16(short(scale));
+
+    // Broadcast 32-bit odd/even offset across the 128-bit register (four times)
+    const __m128i odd_even_offset = _mm_set1_epi32(int(odd_even_add));
+
+    for (; width > 0; width -= 16)
+    {
+        // Load 16-bit values from the source buffer
+        __m128i a0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src_y));
+        __m128i a1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src_y + 8));
+        src_y += 16;
+
+        // Apply alternating dither values
+        a0 = _mm_add_epi16(a0, odd_even_offset);
+        a1 = _mm_add_epi16(a1, odd_even_offset);
+
+        // Scale down from 16-bit to 8-bit using multiply-high
+        a0 = _mm_mulhi_epu16(a0, s);
+        a1 = _mm_mulhi_epu16(a1, s);
+
+        // Pack two 16-bit sets into one 8-bit register
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst_y), _mm_packus_epi16(a0, a1));
+        dst_y += 16;
+    }
+}
+
+// 16 UV pairs per iteration
+TARGET_SSE2
+void SplitUVRow16To8_SSE2(const uint16_t* src_uv, uint8_t* dst_u, uint8_t* dst_v, int scale, int width)
+{
+    const __m128i s = _mm_set1_epi16(short(scale));
+    const __m128i lowMask = _mm_set1_epi32(0xFFFF);
+
+    for (; width > 0; width -= 16)
+    {
+        const __m128i a0 = _mm_mulhi_epu16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src_uv)), s);
+        const __m128i a1 = _mm_mulhi_epu16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src_uv + 8)), s);
+        const __m128i a2 = _mm_mulhi_epu16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src_uv + 16)), s);
+        const __m128i a3 = _mm_mulhi_epu16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src_uv + 24)), s);
+        src_uv += 32;
+
+        // Scaled samples fit in 8 bits, so signed packing is safe
+        const __m128i u = _mm_packus_epi16(
+            _mm_packs_epi32(_mm_and_si128(a0, lowMask), _mm_and_si128(a1, lowMask)),
+            _mm_packs_epi32(_mm_and_si128(a2, lowMask), _mm_and_si128(a3, lowMask)));
+        const __m128i v = _mm_packus_epi16(
+            _mm_packs_epi32(_mm_srli_epi32(a0, 16), _mm_srli_epi32(a1, 16)),
+            _mm_packs_epi32(_mm_srli_epi32(a2, 16), _mm_srli_epi32(a3, 16)));
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst_u), u);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst_v), v);
+        dst_u += 16;
+        dst_v += 16;
+    }
+}
+
+// 32 pixels per iteration
+TARGET_AVX2
+void Convert16To8Row_AVX2(const uint16_t* src_y, uint8_t* dst_y, int scale, int width, uint32_t odd_even_add)
+{
+    const __m256i s = _mm256_set1_epi16(short(scale));
+    const __m256i odd_even_offset = _mm256_set1_epi32(int(odd_even_add));
+
+    for (; width > 0; width -= 32)
+    {
+        __m256i a0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src_y));
+        __m256i a1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src_y + 16));
+        src_y += 32;
+
+        a0 = _mm256_mulhi_epu16(_mm256_add_epi16(a0, odd_even_offset), s);
+        a1 = _mm256_mulhi_epu16(_mm256_add_epi16(a1, odd_even_offset), s);
+
+        // Packing works within 128-bit lanes; restore the quadword order
+        const __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(a0, a1), 0xD8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst_y), packed);
+        dst_y += 32;
+    }
+}
+
+// 32 UV pairs per iteration
+TARGET_AVX2
+void SplitUVRow16To8_AVX2(const uint16_t* src_uv, uint8_t* dst_u, uint8_t* dst_v, int scale, int width)
+{
+    const __m256i s = _mm256_set1_epi16(short(scale));
+    const __m256i lowMask = _mm256_set1_epi32(0xFFFF);
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+    for (; width > 0; width -= 32)
+    {
+        const __m256i a0 = _mm256_mulhi_epu16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src_uv)), s);
+        const __m256i a1 = _mm256_mulhi_epu16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src_uv + 16)), s);
+        const __m256i a2 = _mm256_mulhi_epu16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src_uv + 32)), s);
+        const __m256i a3 = _mm256_mulhi_epu16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src_uv + 48)), s);
+        src_uv += 64;
+
+        const __m256i u = _mm256_packus_epi16(
+            _mm256_packs_epi32(_mm256_and_si256(a0, lowMask), _mm256_and_si256(a1, lowMask)),
+            _mm256_packs_epi32(_mm256_and_si256(a2, lowMask), _mm256_and_si256(a3, lowMask)));
+        const __m256i v = _mm256_packus_epi16(
+            _mm256_packs_epi32(_mm256_srli_epi32(a0, 16), _mm256_srli_epi32(a1, 16)),
+            _mm256_packs_epi32(_mm256_srli_epi32(a2, 16), _mm256_srli_epi32(a3, 16)));
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst_u), _mm256_permutevar8x32_epi32(u, order));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst_v), _mm256_permutevar8x32_epi32(v, order));
+        dst_u += 32;
+        dst_v += 32;
+    }
+}
+
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+
+#define HAS_NEON_KERNELS
+
+inline uint8x8_t MulHi16To8_NEON(uint16x8_t a, uint16x4_t s)
+{
+    const uint16x4_t lo = vshrn_n_u32(vmull_u16(vget_low_u16(a), s), 16);
+    const uint16x4_t hi = vshrn_n_u32(vmull_u16(vget_high_u16(a), s), 16);
+    return vqmovn_u16(vcombine_u16(lo, hi));
+}
+
+// 16 pixels per iteration
+void Convert16To8Row_NEON(const uint16_t* src_y, uint8_t* dst_y, int scale, int width, uint32_t odd_even_add)
+{
+    const uint16x4_t s = vdup_n_u16(uint16_t(scale));
+    const uint16x8_t odd_even_offset = vreinterpretq_u16_u32(vdupq_n_u32(odd_even_add));
+
+    for (; width > 0; width -= 16)
+    {
+        const uint16x8_t a0 = vaddq_u16(vld1q_u16(src_y), odd_even_offset);
+        const uint16x8_t a1 = vaddq_u16(vld1q_u16(src_y + 8), odd_even_offset);
+        src_y += 16;
+
+        vst1q_u8(dst_y, vcombine_u8(MulHi16To8_NEON(a0, s), MulHi16To8_NEON(a1, s)));
+        dst_y += 16;
+    }
+}
+
+// 8 UV pairs per iteration
+void SplitUVRow16To8_NEON(const uint16_t* src_uv, uint8_t* dst_u, uint8_t* dst_v, int scale, int width)
+{
+    const uint16x4_t s = vdup_n_u16(uint16_t(scale));
+
+    for (; width > 0; width -= 8)
+    {
+        const uint16x8x2_t uv = vld2q_u16(src_uv);
+        src_uv += 16;
+
+        vst1_u8(dst_u, MulHi16To8_NEON(uv.val[0], s));
+        vst1_u8(dst_v, MulHi16To8_NEON(uv.val[1], s));
+        dst_u += 8;
+        dst_v += 8;
+    }
+}
+
+#endif
+
+struct Convert16To8Kernels
+{
+    Convert16To8RowFunc convertRow = nullptr;
+    int convertStep = 0;
+    SplitUVRow16To8Func splitUVRow = nullptr;
+    int splitUVStep = 0;
+};
+
+// Picked once, according to the features of the CPU we are running on
+const Convert16To8Kernels& GetConvert16To8Kernels()
+{
+    static const Convert16To8Kernels kernels = []
+    {
+        Convert16To8Kernels result;
+        const int flags = av_get_cpu_flags();
+        (void)flags;
+#ifdef HAS_X86_KERNELS
+        if (flags & AV_CPU_FLAG_AVX2)
+        {
+            result = { Convert16To8Row_AVX2, 32, SplitUVRow16To8_AVX2, 32 };
+        }
+        else if (flags & AV_CPU_FLAG_SSE2)
+        {
+            result = { Convert16To8Row_SSE2, 16, SplitUVRow16To8_SSE2, 16 };
+        }
+#elif defined(HAS_NEON_KERNELS)
+        if (flags & AV_CPU_FLAG_NEON)
+        {
+            result = { Convert16To8Row_NEON, 16, SplitUVRow16To8_NEON, 8 };
+        }
+#endif
+        return result;
+    }();
+    return kernels;
+}
+
+void Convert16To8Row_Any(const uint16_t* src_ptr, uint8_t* dst_ptr, int scale, int width, int y)
+{
+    const auto& kernels = GetConvert16To8Kernels();
+    const uint32_t add = (scale != DITHER_SCALE) ? 0 : ((y & 1) ? 0x00000002 : 0x00030001);
+    const int n = (kernels.convertStep != 0) ? width - width % kernels.convertStep : 0;
+    if (n > 0) {
+        kernels.convertRow(src_ptr, dst_ptr, scale, n, add);
+    }
+    if (n < width) {
+        // n is even, so the odd/even pattern is preserved
+        Convert16To8Row_C(src_ptr + n, dst_ptr + n, scale, width - n, add);
+    }
+}
+
+void SplitUVRow16To8_Any(const uint16_t* src_uv, uint8_t* dst_u, uint8_t* dst_v, int scale, int width)
+{
+    const auto& kernels = GetConvert16To8Kernels();
+    const int n = (kernels.splitUVStep != 0) ? width - width % kernels.splitUVStep : 0;
+    if (n > 0) {
+        kernels.splitUVRow(src_uv, dst_u, dst_v, scale, n);
+    }
+    if (n < width) {
+        SplitUVRow16To8_C(src_uv + n * 2, dst_u + n, dst_v + n, scale, width - n);
+    }
+}
+
+void ScaleRowDown2_16To8_C(const uint16_t* src_ptr,
+    ptrdiff_t src_stride,
+    uint8_t* dst,
+    int dst_width,
+    int scale) {
+    int x;
+    (void)src_stride;
+    assert(scale >= 256);
+    assert(scale <= 32768);
+    for (x = 0; x < dst_width - 1; x += 2) {
+        dst[0] = C16TO8(src_ptr[1], scale);
+        dst[1] = C16TO8(src_ptr[3], scale);
+        dst += 2;
+        src_ptr += 4;
+    }
+    if (dst_width & 1) {
+        dst[0] = C16TO8(src_ptr[1], scale);
+    }
+}
+
+} // namespace
+
+void Convert16To8Plane(const uint16_t* src_y,
+                       int src_stride_y,
+                       uint8_t* dst_y,
+                       int dst_stride_y,
+                       int scale,  // 16384 for 10 bits
+                       int width,
+                       int height) 
+{
+  // Negative height means invert the image.
+  if (height < 0) {
+    height = -height;
+    dst_y = dst_y + (height - 1) * dst_stride_y;
+    dst_stride_y = -dst_stride_y;
+  }
+  // Coalesce rows.
+  if (src_stride_y == width && dst_stride_y == width && scale != DITHER_SCALE) {
+    width *= height;
+    height = 1;
+    src_stride_y = dst_stride_y = 0;
+  }
+
+  // Convert plane
+  for (int y = 0; y < height; ++y) {
+    Convert16To8Row_Any(src_y, dst_y, scale, width, y);
+    src_y += src_stride_y;
+    dst_y += dst_stride_y;
+  }
+}
+
+namespace {
+
+void SplitUVPlane16To8(const uint16_t* src_uv,
+                       int src_stride_uv,
+                       uint8_t* dst_u,
+                       int dst_stride_u,
+                       uint8_t* dst_v,
+                       int dst_stride_v,
+                       int scale,
+                       int width,
+                       int height)
+{
+  for (int y = 0; y < height; ++y) {
+    SplitUVRow16To8_Any(src_uv, dst_u, dst_v, scale, width);
+    src_uv += src_stride_uv;
+    dst_u += dst_stride_u;
+    dst_v += dst_stride_v;
+  }
+}
+
+void ScalePlaneDown2_16To8(int dst_width,
+                        int dst_height,
+                        int src_stride,
+                        int dst_stride,
+                        const uint16_t* src_ptr,
+                        uint8_t* dst_ptr,
+                        int scale) {
+    int row_stride = src_stride * 2;
+    //if (!filtering) {
+        src_ptr += src_stride;  // Point to odd rows.
+        src_stride = 0;
+    //}
+
+    for (int y = 0; y < dst_height; ++y) {
+        ScaleRowDown2_16To8_C(src_ptr, src_stride, dst_ptr, dst_width, scale);
+        src_ptr += row_stride;
+        dst_ptr += dst_stride;
+    }
+}
+
+} // namespace
+
+int I010ToI420(const uint16_t* src_y,
+               int src_stride_y,
+               const uint16_t* src_u,
+               int src_stride_u,
+               const uint16_t* src_v,
+               int src_stride_v,
+               uint8_t* dst_y,
+               int dst_stride_y,
+               uint8_t* dst_u,
+               int dst_stride_u,
+               uint8_t* dst_v,
+               int dst_stride_v,
+               int width,
+               int height)
+{
+  int halfwidth = (width + 1) >> 1;
+  int halfheight = (height + 1) >> 1;
+  if (!src_u || !src_v || !dst_u || !dst_v || width <= 0 || height == 0) {
+    return -1;
+  }
+  // Negative height means invert the image.
+  if (height < 0) {
+    height = -height;
+    halfheight = (height + 1) >> 1;
+    src_y = src_y + (height - 1) * src_stride_y;
+    src_u = src_u + (halfheight - 1) * src_stride_u;
+    src_v = src_v + (halfheight - 1) * src_stride_v;
+    src_stride_y = -src_stride_y;
+    src_stride_u = -src_stride_u;
+    src_stride_v = -src_stride_v;
+  }
+
+  // Convert Y plane.
+  Convert16To8Plane(src_y, src_stride_y, dst_y, dst_stride_y, DITHER_SCALE, width,
+                    height);
+  // Convert UV planes.
+  Convert16To8Plane(src_u, src_stride_u, dst_u, dst_stride_u, 16384, halfwidth,
+                    halfheight);
+  Convert16To8Plane(src_v, src_stride_v, dst_v, dst_stride_v, 16384, halfwidth,
+                    halfheight);
+  return 0;
+}
+
+namespace {
+
+int I410ToI420(const uint16_t* src_y,
+            int src_stride_y,
+            const uint16_t* src_u,
+            int src_stride_u,
+            const uint16_t* src_v,
+            int src_stride_v,
+            uint8_t* dst_y,
+            int dst_stride_y,
+            uint8_t* dst_u,
+            int dst_stride_u,
+            uint8_t* dst_v,
+            int dst_stride_v,
+            int width,
+            int height) {
+    const int depth = 10;
+    const int scale = 1 << (24 - depth);
+
+    if (width <= 0 || height == 0) {
+        return -1;
+    }
+    // Negative height means invert the image.
+    if (height < 0) {
+        height = -height;
+        src_y = src_y + (height - 1) * src_stride_y;
+        src_u = src_u + (height - 1) * src_stride_u;
+        src_v = src_v + (height - 1) * src_stride_v;
+        src_stride_y = -src_stride_y;
+        src_stride_u = -src_stride_u;
+        src_stride_v = -src_stride_v;
+    }
+
+    {
+        const int uv_width = SUBSAMPLE(width, 1, 1);
+        const int uv_height = SUBSAMPLE(height, 1, 1);
+
+        Convert16To8Plane(src_y, src_stride_y, dst_y, dst_stride_y, DITHER_SCALE, width,
+            height);
+        ScalePlaneDown2_16To8(uv_width, uv_height, src_stride_u,
+            dst_stride_u, src_u, dst_u, scale);
+        ScalePlaneDown2_16To8(uv_width, uv_height, src_stride_v,
+            dst_stride_v, src_v, dst_v, scale);
+    }
+    return 0;
+}
+
+bool IsJpegFormat(int format)
+{
+    switch (format)
+    {
+    case AV_PIX_FMT_YUVJ420P:
+    case AV_PIX_FMT_YUVJ422P:
+    case AV_PIX_FMT_YUVJ444P:
+    case AV_PIX_FMT_YUVJ440P:
+    case AV_PIX_FMT_YUVJ411P:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// swscale takes the source range from the pixel format only, so a full range frame in a common format
+// would pass through unconverted; gives it the range of the frame. Returns the range of the output.
+AVColorRange SetupSourceRange(SwsContext* context, const AVFrame* frame)
+{
+    int* invTable;
+    int* table;
+    int srcRange, dstRange, brightness, contrast, saturation;
+    if (sws_getColorspaceDetails(context, &invTable, &srcRange, &table, &dstRange,
+            &brightness, &contrast, &saturation) < 0)
+    {
+        return AVCOL_RANGE_MPEG;
+    }
+
+    const int fullRange = frame->color_range == AVCOL_RANGE_JPEG
+        || (frame->color_range == AVCOL_RANGE_UNSPECIFIED && IsJpegFormat(frame->format));
+    if (srcRange != fullRange)
+    {
+        sws_setColorspaceDetails(context, invTable, fullRange, table, dstRange,
+            brightness, contrast, saturation);
+    }
+    return dstRange ? AVCOL_RANGE_JPEG : AVCOL_RANGE_MPEG;
+}
+
+} // namespace
+
+// P010/P016: 16 bit samples, msb aligned, with interleaved chroma
+int P016ToI420(const uint16_t* src_y,
+               int src_stride_y,
+               const uint16_t* src_uv,
+               int src_stride_uv,
+               uint8_t* dst_y,
+               int dst_stride_y,
+               uint8_t* dst_u,
+               int dst_stride_u,
+               uint8_t* dst_v,
+               int dst_stride_v,
+               int width,
+               int height)
+{
+  const int scale = 256;
+  if (!src_uv || !dst_u || !dst_v || width <= 0 || height <= 0) {
+    return -1;
+  }
+
+  Convert16To8Plane(src_y, src_stride_y, dst_y, dst_stride_y, scale, width, height);
+  SplitUVPlane16To8(src_uv, src_stride_uv, dst_u, dst_stride_u, dst_v, dst_stride_v, scale,
+                    (width + 1) >> 1, (height + 1) >> 1);
+  return 0;
+}
+
+bool HighBitDepthToI420(const AVFrame* src, AVFrame* dst)
+{
+    const auto convert = [src, dst](auto func) {
+        return func(
+            reinterpret_cast<const uint16_t*>(src->data[0]), src->linesize[0] / 2,
+            reinterpret_cast<const uint16_t*>(src->data[1]), src->linesize[1] / 2,
+            reinterpret_cast<const uint16_t*>(src->data[2]), src->linesize[2] / 2,
+            dst->data[0], dst->linesize[0],
+            dst->data[1], dst->linesize[1],
+            dst->data[2], dst->linesize[2],
+            src->width, src->height) == 0;
+    };
+
+    switch (src->format)
+    {
+    case AV_PIX_FMT_YUV420P10LE:
+        return convert(I010ToI420);
+    case AV_PIX_FMT_YUV444P10LE:
+        return convert(I410ToI420);
+    case AV_PIX_FMT_P010LE:
+    case AV_PIX_FMT_P016LE:
+        return P016ToI420(
+            reinterpret_cast<const uint16_t*>(src->data[0]), src->linesize[0] / 2,
+            reinterpret_cast<const uint16_t*>(src->data[1]), src->linesize[1] / 2,
+            dst->data[0], dst->linesize[0],
+            dst->data[1], dst->linesize[1],
+            dst->data[2], dst->linesize[2],
+            src->width, src->height) == 0;
+    default:
+        return false;
+    }
+}
+
+bool frameToImage(
+    VideoFrame& videoFrameData,
+    AVFramePtr& videoFrame,
+    SwsContext*& imageCovertContext,
+    AVPixelFormat pixelFormat,
+    unsigned int nativeFrameLayouts)
+{
+    if (videoFrame->format == AV_PIX_FMT_NONE)
+    {
+        return false;
+    }
+
+    if (videoFrame->format == pixelFormat
+        || videoFrame->format == AV_PIX_FMT_DXVA2_VLD
+        || (nativeFrameLayouts & (1u << GetNativeFrameLayout(videoFrame->format))) != 0)
+    {
+        std::swap(videoFrame, videoFrameData.m_image);
+    }
+    else
+    {
+        const int width = videoFrame->width;
+        const int height = videoFrame->height;
+
+        videoFrameData.realloc(pixelFormat, width, height);
+
+        // Fast path for high bit depth content; keeps the range
+        AVColorRange colorRange = videoFrame->color_range;
+        if (!(pixelFormat == AV_PIX_FMT_YUV420P
+            && HighBitDepthToI420(videoFrame.get(), videoFrameData.m_image.get())))
+        {
+            // Prepare image conversion
+            imageCovertContext =
+                sws_getCachedContext(imageCovertContext, videoFrame->width, videoFrame->height,
+                    static_cast<AVPixelFormat>(videoFrame->format), width, height, pixelFormat,
+                    0, nullptr, nullptr, nullptr);
+
+            assert(imageCovertContext != nullptr);
+
+            if (imageCovertContext == nullptr)
+            {
+                return false;
+            }
+
+            colorRange = SetupSourceRange(imageCovertContext, videoFrame.get());
+
+            // Doing conversion
+            if (sws_scale(imageCovertContext, videoFrame->data, videoFrame->linesize, 0,
+                videoFrame->height, videoFrameData.m_image->data, videoFrameData.m_image->linesize) <= 0)
+            {
+                assert(false && "sws_scale failed");
+                BOOST_LOG_TRIVIAL(error) << "sws_scale failed";
+                return false;
+            }
+        }
+
+        videoFrameData.m_image->sample_aspect_ratio = videoFrame->sample_aspect_ratio;
+        videoFrameData.m_image->colorspace = videoFrame->colorspace;
+        videoFrameData.m_image->color_range = colorRange;
+    }
+
+    return true;
+}
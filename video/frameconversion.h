@@ -0,0 +1,64 @@
+#pragma once
+
+#include "decoderinterface.h"
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+#include "videoframe.h"
+
+#include <cstdint>
+
+struct SwsContext;
+
+// Conversion of decoded frames to the display format, run by the conversion pool workers
+
+// 16 bit samples to 8 bit ones; scale is 16384 for 10 bits, 256 for 16 bits
+void Convert16To8Plane(const uint16_t* src_y,
+                       int src_stride_y,
+                       uint8_t* dst_y,
+                       int dst_stride_y,
+                       int scale,
+                       int width,
+                       int height);
+
+// Strides are in samples; return 0 on success
+int I010ToI420(const uint16_t* src_y,
+               int src_stride_y,
+               const uint16_t* src_u,
+               int src_stride_u,
+               const uint16_t* src_v,
+               int src_stride_v,
+               uint8_t* dst_y,
+               int dst_stride_y,
+               uint8_t* dst_u,
+               int dst_stride_u,
+               uint8_t* dst_v,
+               int dst_stride_v,
+               int width,
+               int height);
+
+int P016ToI420(const uint16_t* src_y,
+               int src_stride_y,
+               const uint16_t* src_uv,
+               int src_stride_uv,
+               uint8_t* dst_y,
+               int dst_stride_y,
+               uint8_t* dst_u,
+               int dst_stride_u,
+               uint8_t* dst_v,
+               int dst_stride_v,
+               int width,
+               int height);
+
+// Fast path for 10 and 16 bit YUV; false if the format of src isn't handled
+bool HighBitDepthToI420(const AVFrame* src, AVFrame* dst);
+
+// Either takes videoFrame over, if the display can show it as is, or converts it to pixelFormat
+bool frameToImage(
+    VideoFrame& videoFrameData,
+    AVFramePtr& videoFrame,
+    SwsContext*& imageCovertContext,
+    AVPixelFormat pixelFormat,
+    unsigned int nativeFrameLayouts);
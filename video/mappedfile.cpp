@@ -0,0 +1,331 @@
+#include "mappedfile.h"
+
+#include <cstring>
+#include <limits>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <atomic>
+#include <mutex>
+
+#include <fcntl.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/vfs.h>
+#else
+#include <sys/mount.h>
+#include <sys/param.h>
+#endif
+#endif
+
+#ifdef _WIN32
+
+bool MappedFile::open(const std::string& path)
+{
+    close();
+
+    const int length = MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, path.c_str(), -1, nullptr, 0);
+    if (length <= 0)
+    {
+        return false;
+    }
+    std::wstring widePath(length, L'\0');
+    MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, path.c_str(), -1, &widePath[0], length);
+
+    wchar_t volume[MAX_PATH];
+    if (!GetVolumePathNameW(widePath.c_str(), volume, MAX_PATH) || GetDriveTypeW(volume) != DRIVE_FIXED)
+    {
+        return false;
+    }
+
+    HANDLE file = CreateFileW(widePath.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+    m_file = file;
+
+    LARGE_INTEGER fileSize;
+    if (GetFileType(file) != FILE_TYPE_DISK || !GetFileSizeEx(file, &fileSize) || fileSize.QuadPart <= 0
+        || !map(fileSize.QuadPart))
+    {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void MappedFile::close()
+{
+    unmap();
+    if (m_file != nullptr)
+    {
+        CloseHandle(m_file);
+        m_file = nullptr;
+    }
+}
+
+bool MappedFile::update()
+{
+    LARGE_INTEGER fileSize;
+    if (m_file == nullptr || !GetFileSizeEx(m_file, &fileSize))
+    {
+        return false;
+    }
+    if (uint64_t(fileSize.QuadPart) <= m_mappedSize)
+    {
+        m_size = fileSize.QuadPart;
+        return true;
+    }
+    unmap();
+    return map(fileSize.QuadPart);
+}
+
+// Pages of a mapped view that can't be read in raise EXCEPTION_IN_PAGE_ERROR
+bool MappedFile::read(uint8_t* buffer, uint64_t offset, size_t length) const
+{
+    __try
+    {
+        memcpy(buffer, m_data + offset, length);
+    }
+    __except (GetExceptionCode() == EXCEPTION_IN_PAGE_ERROR ? EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH)
+    {
+        return false;
+    }
+    return true;
+}
+
+bool MappedFile::map(uint64_t size)
+{
+    if (size > (std::numeric_limits<SIZE_T>::max)())
+    {
+        return false;
+    }
+
+    // Zero sizes map the whole file, whatever its size
+    m_mapping = CreateFileMappingW(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (m_mapping == nullptr)
+    {
+        return false;
+    }
+
+    m_data = static_cast<const uint8_t*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+    if (m_data == nullptr)
+    {
+        unmap();
+        return false;
+    }
+    m_size = m_mappedSize = size;
+    return true;
+}
+
+void MappedFile::unmap()
+{
+    if (m_data != nullptr)
+    {
+        UnmapViewOfFile(m_data);
+        m_data = nullptr;
+    }
+    if (m_mapping != nullptr)
+    {
+        CloseHandle(m_mapping);
+        m_mapping = nullptr;
+    }
+    m_size = m_mappedSize = 0;
+}
+
+// Mapped views have no access pattern hints; the cache manager detects sequential reads itself
+void MappedFile::adviseSequential() {}
+void MappedFile::adviseRandom() {}
+
+#else
+
+namespace {
+
+// Set while the thread copies from a mapping: SIGBUS, as raised by a page past the end of a truncated file,
+// jumps back to MappedFile::read()
+thread_local sigjmp_buf* t_faultJump = nullptr;
+struct sigaction g_previousBusAction;
+
+void busHandler(int sig, siginfo_t* info, void* context)
+{
+    if (sigjmp_buf* jump = t_faultJump)
+    {
+        siglongjmp(*jump, 1);
+    }
+
+    // Not raised by a mapping read
+    if (g_previousBusAction.sa_flags & SA_SIGINFO)
+    {
+        g_previousBusAction.sa_sigaction(sig, info, context);
+    }
+    else if (g_previousBusAction.sa_handler != SIG_DFL && g_previousBusAction.sa_handler != SIG_IGN)
+    {
+        g_previousBusAction.sa_handler(sig);
+    }
+    else
+    {
+        signal(sig, SIG_DFL); // the faulting access is repeated and terminates the process
+    }
+}
+
+void installBusHandler()
+{
+    static std::once_flag once;
+    std::call_once(once, []
+    {
+        struct sigaction action{};
+        action.sa_sigaction = busHandler;
+        // Not blocked on the jump out of the handler, so sigsetjmp() needn't save the signal mask
+        action.sa_flags = SA_SIGINFO | SA_NODEFER;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGBUS, &action, &g_previousBusAction);
+    });
+}
+
+bool isLocalFileSystem(int fd)
+{
+    struct statfs info;
+    if (fstatfs(fd, &info) != 0)
+    {
+        return false;
+    }
+#if defined(__linux__)
+    switch (static_cast<uint32_t>(info.f_type))
+    {
+    case 0x6969:        // NFS
+    case 0x517B:        // SMB
+    case 0xFF534D42:    // CIFS
+    case 0xFE534D42:    // SMB2
+    case 0x65735546:    // FUSE
+    case 0x5346414F:    // AFS
+    case 0x01021997:    // 9P
+    case 0x73757245:    // Coda
+        return false;
+    default:
+        return true;
+    }
+#else
+    return (info.f_flags & MNT_LOCAL) != 0;
+#endif
+}
+
+} // namespace
+
+bool MappedFile::open(const std::string& path)
+{
+    close();
+    installBusHandler();
+
+    m_fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (m_fd == -1)
+    {
+        return false;
+    }
+
+    struct stat status;
+    if (fstat(m_fd, &status) != 0 || !S_ISREG(status.st_mode) || status.st_size <= 0
+        || !isLocalFileSystem(m_fd) || !map(uint64_t(status.st_size)))
+    {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void MappedFile::close()
+{
+    unmap();
+    if (m_fd != -1)
+    {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+}
+
+bool MappedFile::update()
+{
+    struct stat status;
+    if (m_fd == -1 || fstat(m_fd, &status) != 0)
+    {
+        return false;
+    }
+    if (uint64_t(status.st_size) <= m_mappedSize)
+    {
+        m_size = uint64_t(status.st_size);
+        return true;
+    }
+    unmap();
+    return map(uint64_t(status.st_size));
+}
+
+bool MappedFile::read(uint8_t* buffer, uint64_t offset, size_t length) const
+{
+    sigjmp_buf jump;
+    if (sigsetjmp(jump, 0) != 0)
+    {
+        t_faultJump = nullptr;
+        return false;
+    }
+    t_faultJump = &jump;
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    memcpy(buffer, m_data + offset, length);
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    t_faultJump = nullptr;
+    return true;
+}
+
+bool MappedFile::map(uint64_t size)
+{
+    if (size > (std::numeric_limits<size_t>::max)())
+    {
+        return false;
+    }
+
+    void* data = mmap(nullptr, size_t(size), PROT_READ, MAP_SHARED, m_fd, 0);
+    if (data == MAP_FAILED)
+    {
+        return false;
+    }
+
+    m_data = static_cast<const uint8_t*>(data);
+    m_size = m_mappedSize = size;
+    posix_madvise(data, size_t(size), m_randomAccess ? POSIX_MADV_RANDOM : POSIX_MADV_SEQUENTIAL);
+    return true;
+}
+
+void MappedFile::unmap()
+{
+    if (m_data != nullptr)
+    {
+        munmap(const_cast<uint8_t*>(m_data), size_t(m_mappedSize));
+        m_data = nullptr;
+    }
+    m_size = m_mappedSize = 0;
+}
+
+void MappedFile::adviseSequential()
+{
+    m_randomAccess = false;
+    if (m_data != nullptr)
+    {
+        posix_madvise(const_cast<uint8_t*>(m_data), size_t(m_mappedSize), POSIX_MADV_SEQUENTIAL);
+    }
+}
+
+void MappedFile::adviseRandom()
+{
+    m_randomAccess = true;
+    if (m_data != nullptr)
+    {
+        posix_madvise(const_cast<uint8_t*>(m_data), size_t(m_mappedSize), POSIX_MADV_RANDOM);
+    }
+}
+
+#endif
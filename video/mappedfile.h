@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Read-only mapping of a whole regular file on a local fixed volume; sizes above 4 GB need a 64-bit build.
+// The pages are served from the system file cache, without a copy in a read buffer.
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    ~MappedFile() { close(); }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // path is UTF-8; fails for network and removable volumes, where I/O errors would fault the reads
+    bool open(const std::string& path);
+    void close();
+
+    uint64_t size() const { return m_size; }
+
+    // Follows the file size: a grown file, e.g. one still being downloaded, is mapped anew;
+    // returns false on an error
+    bool update();
+
+    // Copies length bytes at offset, which are to be within size(); returns false on an I/O error,
+    // or if the file has been truncated meanwhile, where the pages of a mapping fault instead of failing a read
+    bool read(uint8_t* buffer, uint64_t offset, size_t length) const;
+
+    // Read-ahead hints for the whole mapping; no-ops where unsupported
+    void adviseSequential();
+    void adviseRandom();
+
+private:
+    bool map(uint64_t size);
+    void unmap();
+
+    const uint8_t* m_data = nullptr;
+    uint64_t m_size = 0;        // of the file, up to m_mappedSize
+    uint64_t m_mappedSize = 0;
+#ifdef _WIN32
+    void* m_file = nullptr;
+    void* m_mapping = nullptr;
+#else
+    int m_fd = -1;
+    bool m_randomAccess = false; // the hint is given anew to a new mapping
+#endif
+};
@@ -33,6 +33,50 @@ bool isSeekable(AVFormatContext* formatContext)
 #endif
 }
 
+// Bytes read near the end of the input for its last timestamp, 16 times more on the second attempt
+const int64_t TAIL_SCAN_BYTES = 1024 * 1024;
+
+// Largest input that is read through in the background to refine an extrapolated duration
+const int64_t DURATION_SCAN_BYTES = int64_t(512) * 1024 * 1024;
+
+// The presentation end of the packet; AV_NOPTS_VALUE if it has no timestamps
+int64_t packetEndTimestamp(const AVPacket& packet)
+{
+    const int64_t timestamp = (packet.pts != AV_NOPTS_VALUE) ? packet.pts : packet.dts;
+    return (timestamp != AV_NOPTS_VALUE) ? timestamp + std::max<int64_t>(0, packet.duration) : AV_NOPTS_VALUE;
+}
+
+// The last timestamp of the stream from position on; AV_NOPTS_VALUE if there is none.
+// Leaves the demuxer wherever reading has stopped.
+int64_t findLastTimestamp(AVFormatContext* formatContext, int streamIndex, int64_t position)
+{
+    if (avformat_seek_file(formatContext, -1, INT64_MIN, position, INT64_MAX, AVSEEK_FLAG_BYTE) < 0)
+    {
+        return AV_NOPTS_VALUE;
+    }
+
+    int64_t result = AV_NOPTS_VALUE;
+    AVPacket packet;
+    while (av_read_frame(formatContext, &packet) >= 0)
+    {
+        if (packet.stream_index == streamIndex)
+        {
+            const int64_t timestamp = packetEndTimestamp(packet);
+            if (timestamp != AV_NOPTS_VALUE && (result == AV_NOPTS_VALUE || timestamp > result))
+            {
+                result = timestamp;
+            }
+        }
+        av_packet_unref(&packet);
+
+        if (boost::this_thread::interruption_requested())
+        {
+            break;
+        }
+    }
+    return result;
+}
+
 template<typename T>
 bool RendezVous(
     boost::atomic_int64_t& duration,
@@ -85,6 +129,7 @@ bool RendezVous(
 void FFmpegDecoder::parseRunnable(int idx)
 {
     CHANNEL_LOG(ffmpeg_threads) << "Parse thread started";
+    tracing::setThreadName("parse");
     AVPacket packet;
     enum { UNSET, SET_EOF, SET_INVALID, REPORTED } eof = UNSET;
 
@@ -116,6 +161,21 @@ void FFmpegDecoder::parseRunnable(int idx)
             return;
         }
 
+        if (idx == 0)
+        {
+            settleScrubbing(false);
+
+            const int64_t refinedDuration = m_refinedDuration.exchange(AV_NOPTS_VALUE);
+            if (refinedDuration != AV_NOPTS_VALUE)
+            {
+                m_duration = refinedDuration;
+                if (m_decoderListener != nullptr)
+                {
+                    m_decoderListener->fileLoaded(m_startTime, m_duration + m_startTime);
+                }
+            }
+        }
+
         bool restarted = false;
         RendezVous(m_seekDuration, m_seekRendezVous, m_formatContexts.size(), restarted,
             std::bind(&FFmpegDecoder::resetDecoding, this, std::placeholders::_1, false));
@@ -131,7 +191,8 @@ void FFmpegDecoder::parseRunnable(int idx)
             recovering = RECOVERED;
         }
 
-        const int readStatus = av_read_frame(m_formatContexts[idx], &packet);
+        const int readStatus = tracing::traced("av_read_frame",
+            [this, idx, &packet] { return av_read_frame(m_formatContexts[idx], &packet); });
         if (readStatus >= 0)
         {
             const bool dispatched = dispatchPacket(idx, packet);
@@ -246,7 +307,8 @@ bool FFmpegDecoder::dispatchPacket(int idx, AVPacket& packet)
 
     auto seekLambda = [this, idx]
     {
-        if (m_seekDuration != AV_NOPTS_VALUE || m_videoResetDuration != AV_NOPTS_VALUE)
+        if (m_seekDuration != AV_NOPTS_VALUE || m_videoResetDuration != AV_NOPTS_VALUE
+                || settleScrubbing(false))
             return true;
 
         if (m_decoderListener != nullptr)
@@ -255,9 +317,12 @@ bool FFmpegDecoder::dispatchPacket(int idx, AVPacket& packet)
         return false;
     };
 
+    const auto& timeBase = m_formatContexts[idx]->streams[packet.stream_index]->time_base;
+    const unsigned int generation = m_decodingGeneration;
+
     if (idx == m_videoContextIndex && packet.stream_index == m_videoStreamNumber)
     { 
-        if (m_videoPacketsQueue.push(packet, seekLambda))
+        if (m_videoPacketsQueue.push(packet, timeBase, generation, seekLambda))
         {
             guard.release();
             return true;
@@ -266,7 +331,7 @@ bool FFmpegDecoder::dispatchPacket(int idx, AVPacket& packet)
     else if (idx == m_audioContextIndex
         && std::find(m_audioIndices.begin(), m_audioIndices.end(), packet.stream_index) != m_audioIndices.end())
     { 
-        if (m_audioPacketsQueue.push(packet, seekLambda))
+        if (m_audioPacketsQueue.push(packet, timeBase, generation, seekLambda))
         {
             guard.release();
             return true;
@@ -371,18 +436,26 @@ void FFmpegDecoder::startVideoThread()
 
 bool FFmpegDecoder::resetDecoding(int64_t seekDuration, bool resetVideo)
 {
-    CHANNEL_LOG(ffmpeg_seek) << __FUNCTION__ << " resetVideo=" << resetVideo;
+    const SeekMode seekMode = resetVideo ? SEEK_DEFAULT
+        : m_exactSeekRequested.exchange(false) ? SEEK_EXACT
+        : m_isScrubbing ? SEEK_KEYFRAME : SEEK_DEFAULT;
+
+    CHANNEL_LOG(ffmpeg_seek) << __FUNCTION__ << " resetVideo=" << resetVideo << " seekMode=" << seekMode;
 
     AVPacket packet{};
     auto guard = MakeGuard(&packet, av_packet_unref);
 
+    // Keyframe and exact seeks land on the preceding keyframe with a single av_seek_frame() call
+    const bool toPrecedingKeyFrame = seekMode != SEEK_DEFAULT;
+
     for (int i = 0; i < m_formatContexts.size(); ++i)
     {
-        if (!doSeekFrame(i, seekDuration, resetVideo ? nullptr : &packet))
+        if (!doSeekFrame(i, seekDuration,
+                (resetVideo || toPrecedingKeyFrame) ? nullptr : &packet, toPrecedingKeyFrame))
             return false;
     }
 
-    if (!respawn(seekDuration, resetVideo))
+    if (!flushDecoding(seekDuration, resetVideo, seekMode))
         return false;
 
     if (packet.data != nullptr)
@@ -394,7 +467,7 @@ bool FFmpegDecoder::resetDecoding(int64_t seekDuration, bool resetVideo)
     return true;
 }
 
-bool FFmpegDecoder::doSeekFrame(int idx, int64_t seekDuration, AVPacket* packet)
+bool FFmpegDecoder::doSeekFrame(int idx, int64_t seekDuration, AVPacket* packet, bool toPrecedingKeyFrame)
 {
     if (idx != m_audioContextIndex && !basedOnVideoStream())
         return true;  // continue;
@@ -439,6 +512,15 @@ bool FFmpegDecoder::doSeekFrame(int idx, int64_t seekDuration, AVPacket* packet)
             return false;
         }
     }
+    else if (toPrecedingKeyFrame)
+    {
+        if (av_seek_frame(formatContext, streamNumber, convertedSeekDuration, AVSEEK_FLAG_BACKWARD) < 0
+            && av_seek_frame(formatContext, streamNumber, convertedSeekDuration, 0) < 0)
+        {
+            CHANNEL_LOG(ffmpeg_seek) << "Seek failed";
+            return false;
+        }
+    }
     else
     {
         if (av_seek_frame(formatContext, streamNumber, convertedSeekDuration, 0) < 0
@@ -492,124 +574,176 @@ bool FFmpegDecoder::doSeekFrame(int idx, int64_t seekDuration, AVPacket* packet)
     return true;
 }
 
-bool FFmpegDecoder::respawn(int64_t seekDuration, bool resetVideo)
+bool FFmpegDecoder::flushDecoding(int64_t seekDuration, bool resetVideo, SeekMode seekMode)
 {
-    const bool hasVideo = m_mainVideoThread != nullptr;
-    const bool hasAudio = m_mainAudioThread != nullptr;
+    m_exactSeekDuration = (seekMode == SEEK_EXACT) ? seekDuration : int64_t(AV_NOPTS_VALUE);
 
-    if (hasVideo)
+    // The decoding threads are kept alive: they drop the packets queued before the seek
+    // and flush their codecs on the first packet of the new generation,
+    // while the displaying thread drops the frames decoded before the seek
     {
-        m_mainVideoThread->interrupt();
+        boost::lock_guard<boost::mutex> locker(m_videoFramesMutex);
+        ++m_decodingGeneration;
+        m_seekStartTime = resetVideo ? IClock::time_point::min() : m_seekRequestTime.load();
+        m_seekMode = seekMode;
     }
-    if (hasAudio)
+    m_videoFramesCV.notify_all();
+
+    m_videoStartClock = VIDEO_START_CLOCK_NOT_INITIALIZED;
+
+    if (resetVideo && m_mainVideoThread != nullptr)
     {
-        m_mainAudioThread->interrupt();
+        m_videoResetRequested = true; // handled by the video thread
     }
-
-    if (hasVideo)
+    else
     {
-        m_mainVideoThread->join();
+        m_videoResetting = false;
+
+        if (resetVideo && !resetVideoProcessing())
+        {
+            return false;
+        }
     }
-    if (hasAudio)
+
+    if (m_decoderListener != nullptr)
     {
-        m_mainAudioThread->join();
+        m_decoderListener->changedFramePosition(m_startTime, seekDuration, m_duration + m_startTime);
     }
 
-    // Reset stuff
-    m_videoPacketsQueue.clear();
-    m_audioPacketsQueue.clear();
+    seekWhilePaused();
+    m_isPausedCV.notify_all();
 
-    m_mainDisplayThread->interrupt();
-    m_mainDisplayThread->join();
+    return true;
+}
 
-    // Free videoFrames
+// Estimates the missing duration without reading the whole input: the last timestamp is looked for
+// near the end, otherwise the duration is extrapolated from the bitrate and, for inputs up to
+// DURATION_SCAN_BYTES, refined in the background
+void FFmpegDecoder::fixDuration()
+{
+    if (m_duration > 0)
     {
-        boost::lock_guard<boost::mutex> locker(m_videoFramesMutex);
-        m_videoFramesQueue.clear();
-        m_frameDisplayingRequested = false;
-        ++m_generation;
+        return;
     }
 
-    m_videoResetting = false;
-
-    m_videoStartClock = VIDEO_START_CLOCK_NOT_INITIALIZED;
+    const int streamNumber =
+        (m_videoContextIndex == 0) ? m_videoStreamNumber : m_audioStreamNumber.load();
 
-    if (resetVideo && !resetVideoProcessing())
+    m_duration = 0;
+    auto formatContext = m_formatContexts[0];
+    if (!isSeekable(formatContext) || streamNumber < 0)
     {
-        return false;
+        return;
     }
 
-    m_mainDisplayThread = std::make_unique<boost::thread>(&FFmpegDecoder::displayRunnable, this);
+    const AVStream* stream = formatContext->streams[streamNumber];
+    const int64_t fileSize = (formatContext->pb != nullptr) ? avio_size(formatContext->pb) : -1;
 
-    if (hasVideo)
+    int64_t lastTimestamp = AV_NOPTS_VALUE;
+    if (fileSize > 0 && (formatContext->iformat->flags & AVFMT_NO_BYTE_SEEK) == 0)
     {
-        if (m_videoCodecContext != nullptr) {
-            avcodec_flush_buffers(m_videoCodecContext);
+        for (int64_t tailBytes : { TAIL_SCAN_BYTES, TAIL_SCAN_BYTES * 16 })
+        {
+            lastTimestamp = findLastTimestamp(formatContext, streamNumber, std::max<int64_t>(0, fileSize - tailBytes));
+            if (lastTimestamp != AV_NOPTS_VALUE || tailBytes >= fileSize
+                || boost::this_thread::interruption_requested())
+            {
+                break;
+            }
         }
     }
-    if (hasAudio)
+
+    if (lastTimestamp != AV_NOPTS_VALUE)
     {
-        if (m_audioCodecContext != nullptr) {
-            avcodec_flush_buffers(m_audioCodecContext);
+        if (lastTimestamp < m_startTime && stream->pts_wrap_bits < 63)
+        {
+            lastTimestamp += int64_t(1) << stream->pts_wrap_bits;
         }
-        m_audioPlayer->WaveOutReset();
+        m_duration = std::max<int64_t>(0, lastTimestamp - m_startTime);
+        CHANNEL_LOG(ffmpeg_opening) << "Duration found near the end: " << m_duration;
     }
-
-    if (m_decoderListener != nullptr)
+    else if (fileSize > 0)
     {
-        m_decoderListener->changedFramePosition(m_startTime, seekDuration, m_duration + m_startTime);
-    }
-
-    seekWhilePaused();
+        int64_t bitRate = formatContext->bit_rate;
+        if (bitRate <= 0)
+        {
+            bitRate = 0;
+            for (unsigned int i = 0; i < formatContext->nb_streams; ++i)
+            {
+                bitRate += std::max<int64_t>(0, formatContext->streams[i]->codecpar->bit_rate);
+            }
+        }
+        if (bitRate > 0)
+        {
+            m_duration = int64_t(fileSize * 8. / bitRate / av_q2d(stream->time_base));
+            CHANNEL_LOG(ffmpeg_opening) << "Duration extrapolated from the bitrate: " << m_duration;
 
-    // Restart
-    startAudioThread();
-    startVideoThread();
+            if (!m_durationScanUrl.empty() && fileSize <= DURATION_SCAN_BYTES)
+            {
+                m_durationThread = std::make_unique<boost::thread>(&FFmpegDecoder::durationRunnable, this,
+                    m_durationScanUrl, streamNumber, stream->id, stream->time_base);
+            }
+        }
+    }
 
-    return true;
+    if (avformat_seek_file(formatContext, streamNumber, 0, 0, 0, AVSEEK_FLAG_FRAME) < 0
+        && avformat_seek_file(formatContext, -1, 0, 0, 0, AVSEEK_FLAG_BYTE) < 0)
+    {
+        CHANNEL_LOG(ffmpeg_seek) << "Seek failed";
+    }
 }
 
-void FFmpegDecoder::fixDuration()
+// Reads the file from the start on a context of its own, as the demuxer couldn't find timestamps near the end;
+// the result is handed over to the parse thread, which reports it through fileLoaded()
+void FFmpegDecoder::durationRunnable(std::string url, int streamIndex, int streamId, AVRational timeBase)
 {
-    if (m_duration <= 0)
+    CHANNEL_LOG(ffmpeg_threads) << "Duration thread started";
+    tracing::setThreadName("duration");
+
+    AVFormatContext* formatContext = avformat_alloc_context();
+    auto formatContextGuard = MakeGuard(&formatContext, avformat_close_input);
+    formatContext->interrupt_callback.callback = [](void*)
     {
-        const int streamNumber =
-            (m_videoContextIndex == 0) ? m_videoStreamNumber : m_audioStreamNumber.load();
+        return static_cast<int>(boost::this_thread::interruption_requested());
+    };
 
-        m_duration = 0;
-        if (!isSeekable(m_formatContexts[0]))
-        {
-            return;
-        }
+    if (avformat_open_input(&formatContext, url.c_str(), nullptr, nullptr) != 0)
+    {
+        return;
+    }
 
-        AVPacket packet;
-        while (av_read_frame(m_formatContexts[0], &packet) >= 0)
+    int64_t lastTimestamp = AV_NOPTS_VALUE;
+    AVPacket packet;
+    while (av_read_frame(formatContext, &packet) >= 0)
+    {
+        // Streams of the demuxers without a header show up in any order, so they are matched by id
+        const AVStream* stream = formatContext->streams[packet.stream_index];
+        if ((streamId != 0) ? stream->id == streamId : stream->index == streamIndex)
         {
-            if (packet.stream_index == streamNumber)
+            int64_t timestamp = packetEndTimestamp(packet);
+            if (timestamp != AV_NOPTS_VALUE)
             {
-                if (packet.pts != AV_NOPTS_VALUE)
-                {
-                    m_duration = packet.pts;
-                }
-                else if (packet.dts != AV_NOPTS_VALUE)
+                timestamp = av_rescale_q(timestamp, stream->time_base, timeBase);
+                if (lastTimestamp == AV_NOPTS_VALUE || timestamp > lastTimestamp)
                 {
-                    m_duration = packet.dts;
+                    lastTimestamp = timestamp;
                 }
             }
-            av_packet_unref(&packet);
-
-            if (boost::this_thread::interruption_requested())
-            {
-                CHANNEL_LOG(ffmpeg_threads) << "Parse thread broken";
-                return;
-            }
         }
+        av_packet_unref(&packet);
 
-        if (avformat_seek_file(m_formatContexts[0], streamNumber, 0, 0, 0,
-                               AVSEEK_FLAG_FRAME) < 0)
+        if (boost::this_thread::interruption_requested())
         {
-            CHANNEL_LOG(ffmpeg_seek) << "Seek failed";
+            CHANNEL_LOG(ffmpeg_threads) << "Duration thread broken";
             return;
         }
     }
+
+    if (lastTimestamp == AV_NOPTS_VALUE || lastTimestamp <= m_startTime)
+    {
+        return;
+    }
+
+    m_refinedDuration = lastTimestamp - m_startTime;
+    CHANNEL_LOG(ffmpeg_opening) << "Duration refined: " << (lastTimestamp - m_startTime);
 }
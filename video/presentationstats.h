@@ -0,0 +1,107 @@
+#pragma once
+
+#include "decoderinterface.h"
+
+#include <boost/atomic.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+// Collects PresentationStats on the display thread; snapshots can be taken from any thread.
+// Counters are updated separately, so a snapshot may be off by the frame being recorded.
+class PresentationStatsCollector
+{
+public:
+    PresentationStatsCollector() { reset(); }
+
+    PresentationStatsCollector(const PresentationStatsCollector&) = delete;
+    PresentationStatsCollector& operator=(const PresentationStatsCollector&) = delete;
+
+    // jitter: seconds the display thread woke up after the presentation time; negative if before it
+    void framePresented(double jitter)
+    {
+        const int64_t us = toMicroseconds(std::fabs(jitter));
+        m_jitter[bucket(us)].fetch_add(1, boost::memory_order_relaxed);
+        m_jitterSum.fetch_add(us, boost::memory_order_relaxed);
+        if (us > m_maxJitter.load(boost::memory_order_relaxed))
+        {
+            m_maxJitter.store(us, boost::memory_order_relaxed);
+        }
+        m_presented.fetch_add(1, boost::memory_order_relaxed);
+    }
+
+    // lateness: seconds past the presentation time the frame was reached at
+    void lateFramePresented(double lateness)
+    {
+        m_lateness[bucket(toMicroseconds(lateness))].fetch_add(1, boost::memory_order_relaxed);
+        m_late.fetch_add(1, boost::memory_order_relaxed);
+        m_presented.fetch_add(1, boost::memory_order_relaxed);
+    }
+
+    void frameDropped(double lateness)
+    {
+        m_lateness[bucket(toMicroseconds(lateness))].fetch_add(1, boost::memory_order_relaxed);
+        m_dropped.fetch_add(1, boost::memory_order_relaxed);
+    }
+
+    PresentationStats snapshot() const
+    {
+        PresentationStats result{};
+        result.framesPresented = m_presented.load(boost::memory_order_relaxed);
+        result.framesLate = m_late.load(boost::memory_order_relaxed);
+        result.framesDropped = m_dropped.load(boost::memory_order_relaxed);
+
+        uint64_t waitedFor = 0;
+        for (int i = 0; i < PresentationStats::NUM_BUCKETS; ++i)
+        {
+            result.jitter[i] = m_jitter[i].load(boost::memory_order_relaxed);
+            result.lateness[i] = m_lateness[i].load(boost::memory_order_relaxed);
+            waitedFor += result.jitter[i];
+        }
+        if (waitedFor != 0)
+        {
+            result.meanJitter = m_jitterSum.load(boost::memory_order_relaxed) / 1000000. / waitedFor;
+        }
+        result.maxJitter = m_maxJitter.load(boost::memory_order_relaxed) / 1000000.;
+        return result;
+    }
+
+    void reset()
+    {
+        m_presented = 0;
+        m_late = 0;
+        m_dropped = 0;
+        m_jitterSum = 0;
+        m_maxJitter = 0;
+        for (int i = 0; i < PresentationStats::NUM_BUCKETS; ++i)
+        {
+            m_jitter[i] = 0;
+            m_lateness[i] = 0;
+        }
+    }
+
+private:
+    static int64_t toMicroseconds(double seconds)
+    {
+        return std::max<int64_t>(0, static_cast<int64_t>(seconds * 1000000.));
+    }
+
+    static int bucket(int64_t us)
+    {
+        int idx = 0;
+        while (us >= PresentationStats::bucketLimit(idx))
+        {
+            ++idx;
+        }
+        return idx;
+    }
+
+private:
+    boost::atomic<uint64_t> m_presented;
+    boost::atomic<uint64_t> m_late;
+    boost::atomic<uint64_t> m_dropped;
+    boost::atomic<uint64_t> m_jitterSum;    // microseconds
+    boost::atomic<int64_t> m_maxJitter;     // microseconds
+    boost::atomic<uint64_t> m_jitter[PresentationStats::NUM_BUCKETS];
+    boost::atomic<uint64_t> m_lateness[PresentationStats::NUM_BUCKETS];
+};
@@ -0,0 +1,220 @@
+#include "probecache.h"
+
+extern "C"
+{
+#include <libavformat/avformat.h>
+}
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/thread/lock_guard.hpp>
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <system_error>
+
+namespace {
+
+const char FILE_HEADER[] = "# probe cache 1";
+
+std::filesystem::path toPath(const std::string& utf8)
+{
+    return std::filesystem::u8path(utf8);
+}
+
+} // namespace
+
+ProbeCache::ProbeCache(std::string path) : m_path(std::move(path))
+{
+    load();
+}
+
+// static
+ProbeCache::Identity ProbeCache::identify(const std::string& url, AVFormatContext* formatContext)
+{
+    Identity identity{ -1, 0 };
+    if (formatContext->pb != nullptr)
+    {
+        identity.size = avio_size(formatContext->pb);
+    }
+
+    // Fails for anything but local files
+    std::error_code ec;
+    const auto modified = std::filesystem::last_write_time(
+        toPath(boost::starts_with(url, "file:") ? url.substr(5) : url), ec);
+    if (!ec)
+    {
+        identity.modified = modified.time_since_epoch().count();
+    }
+    return identity;
+}
+
+int64_t ProbeCache::probeSize(const std::string& url, const Identity& identity)
+{
+    boost::lock_guard<boost::mutex> locker(m_mutex);
+    auto it = m_entries.find(url);
+    if (it == m_entries.end()
+        || it->second.identity.size != identity.size || it->second.identity.modified != identity.modified)
+    {
+        return 0;
+    }
+    it->second.lastUsed = ++m_useCounter;
+    return it->second.probeSize;
+}
+
+bool ProbeCache::apply(const std::string& url, AVFormatContext* formatContext)
+{
+    boost::lock_guard<boost::mutex> locker(m_mutex);
+    auto it = m_entries.find(url);
+    if (it == m_entries.end())
+    {
+        return false;
+    }
+    auto& entry = it->second;
+
+    bool matches = formatContext->nb_streams == entry.streams.size();
+    for (unsigned int i = 0; matches && i < formatContext->nb_streams; ++i)
+    {
+        const AVCodecParameters* codecpar = formatContext->streams[i]->codecpar;
+        const auto& cached = entry.streams[i];
+        matches = codecpar->codec_type == cached.codecType
+            && codecpar->codec_id == cached.codecId
+            && codecpar->format == cached.format
+            && codecpar->width == cached.width
+            && codecpar->height == cached.height
+            && codecpar->sample_rate == cached.sampleRate
+#if LIBAVUTIL_VERSION_MAJOR < 57
+            && codecpar->channels == cached.channels;
+#else
+            && codecpar->ch_layout.nb_channels == cached.channels;
+#endif
+    }
+
+    if (!matches)
+    {
+        // Some streams need more data to be found, so don't try as little again
+        entry.probeSize *= 4;
+        return false;
+    }
+
+    if (formatContext->duration == AV_NOPTS_VALUE)
+    {
+        formatContext->duration = entry.duration;
+    }
+    if (formatContext->start_time == AV_NOPTS_VALUE)
+    {
+        formatContext->start_time = entry.startTime;
+    }
+    return true;
+}
+
+void ProbeCache::store(const std::string& url, const Identity& identity, const AVFormatContext* formatContext)
+{
+    // Live and non-seekable inputs change all the time
+    if (identity.size < 0 || url.find_first_of("\t\r\n") != std::string::npos)
+    {
+        return;
+    }
+
+    Entry entry{ identity, MIN_PROBE_SIZE, formatContext->duration, formatContext->start_time, {}, 0 };
+    for (unsigned int i = 0; i < formatContext->nb_streams; ++i)
+    {
+        const AVCodecParameters* codecpar = formatContext->streams[i]->codecpar;
+        entry.streams.push_back({ codecpar->codec_type, codecpar->codec_id, codecpar->format,
+            codecpar->width, codecpar->height, codecpar->sample_rate,
+#if LIBAVUTIL_VERSION_MAJOR < 57
+            codecpar->channels });
+#else
+            codecpar->ch_layout.nb_channels });
+#endif
+    }
+
+    boost::lock_guard<boost::mutex> locker(m_mutex);
+
+    auto it = m_entries.find(url);
+    if (it != m_entries.end() && it->second.identity.size == identity.size
+        && it->second.identity.modified == identity.modified)
+    {
+        entry.probeSize = it->second.probeSize;
+    }
+    entry.lastUsed = ++m_useCounter;
+    m_entries[url] = std::move(entry);
+
+    while (m_entries.size() > MAX_ENTRIES)
+    {
+        m_entries.erase(std::min_element(m_entries.begin(), m_entries.end(),
+            [](const auto& left, const auto& right) { return left.second.lastUsed < right.second.lastUsed; }));
+    }
+
+    save();
+}
+
+// One line per entry: url, size, modification time, probe size, duration, start time, number of streams,
+// and then codec type, codec id, format, width, height, sample rate and channels of every stream; tab separated
+void ProbeCache::load()
+{
+    std::ifstream file(toPath(m_path));
+    std::string line;
+    if (!std::getline(file, line) || line != FILE_HEADER)
+    {
+        return;
+    }
+
+    while (std::getline(file, line))
+    {
+        std::istringstream fields(line);
+        std::string url;
+        Entry entry{};
+        size_t numStreams = 0;
+        if (!std::getline(fields, url, '\t')
+            || !(fields >> entry.identity.size >> entry.identity.modified >> entry.probeSize
+                >> entry.duration >> entry.startTime >> numStreams))
+        {
+            continue;
+        }
+        entry.streams.resize(std::min<size_t>(numStreams, 1024));
+        for (auto& stream : entry.streams)
+        {
+            fields >> stream.codecType >> stream.codecId >> stream.format >> stream.width >> stream.height
+                >> stream.sampleRate >> stream.channels;
+        }
+        if (fields && entry.streams.size() == numStreams)
+        {
+            entry.lastUsed = ++m_useCounter;
+            m_entries[url] = std::move(entry);
+        }
+    }
+}
+
+// Written aside and renamed, so that a crash doesn't leave a truncated file
+void ProbeCache::save() const
+{
+    const auto path = toPath(m_path);
+    auto tempPath = path;
+    tempPath += ".tmp";
+    {
+        std::ofstream file(tempPath, std::ios::trunc);
+        file << FILE_HEADER << '\n';
+        for (const auto& item : m_entries)
+        {
+            const auto& entry = item.second;
+            file << item.first << '\t' << entry.identity.size << '\t' << entry.identity.modified
+                << '\t' << entry.probeSize << '\t' << entry.duration << '\t' << entry.startTime
+                << '\t' << entry.streams.size();
+            for (const auto& stream : entry.streams)
+            {
+                file << '\t' << stream.codecType << '\t' << stream.codecId << '\t' << stream.format
+                    << '\t' << stream.width << '\t' << stream.height
+                    << '\t' << stream.sampleRate << '\t' << stream.channels;
+            }
+            file << '\n';
+        }
+        if (!file)
+        {
+            return;
+        }
+    }
+    std::error_code ec;
+    std::filesystem::rename(tempPath, path, ec);
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <boost/thread/mutex.hpp>
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+struct AVFormatContext;
+
+// Stream layouts of previously opened inputs, persisted in a text file.
+// An entry is keyed by the url and is valid as long as the size and the modification time
+// of the input stay the same; reopening such an input needs a minimal probe only.
+class ProbeCache
+{
+public:
+    enum { MIN_PROBE_SIZE = 128 * 1024, MAX_ENTRIES = 256 };
+
+    // What an entry is validated against; modified is 0 for remote inputs
+    struct Identity
+    {
+        int64_t size;
+        int64_t modified;
+    };
+
+    // Loads the entries from path, if it exists; path is UTF-8
+    explicit ProbeCache(std::string path);
+
+    // formatContext is opened from url, with no streams probed yet
+    static Identity identify(const std::string& url, AVFormatContext* formatContext);
+
+    // The probe size to look for the cached layout with; 0 if there is no valid entry
+    int64_t probeSize(const std::string& url, const Identity& identity);
+
+    // True if the streams of the minimally probed formatContext match the entry; then fills in
+    // the duration and the start time the probe has missed. Otherwise the next probe of the entry is made larger.
+    bool apply(const std::string& url, AVFormatContext* formatContext);
+
+    // Remembers the layout of the fully probed formatContext and saves the file
+    void store(const std::string& url, const Identity& identity, const AVFormatContext* formatContext);
+
+private:
+    struct StreamLayout
+    {
+        int codecType;
+        int codecId;
+        int format;
+        int width;
+        int height;
+        int sampleRate;
+        int channels;
+    };
+
+    struct Entry
+    {
+        Identity identity;
+        int64_t probeSize;
+        int64_t duration;
+        int64_t startTime;
+        std::vector<StreamLayout> streams;
+        uint64_t lastUsed;
+    };
+
+    void load();
+    void save() const;
+
+    const std::string m_path;
+    boost::mutex m_mutex;
+    std::map<std::string, Entry> m_entries;
+    uint64_t m_useCounter = 0;
+};
@@ -0,0 +1,200 @@
+#include "tracing.h"
+
+#include <boost/chrono.hpp>
+#include <boost/thread/lock_guard.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace tracing {
+
+boost::atomic_bool g_enabled{ false };
+
+namespace {
+
+enum { RING_SIZE = 1 << 16 };   // events per thread, a power of 2
+
+struct Event
+{
+    const char* name;
+    int64_t start;
+    int64_t end;
+    int tid;
+};
+
+// Written by one thread at a time; taken over by another thread once its owner exits
+struct ThreadBuffer
+{
+    std::vector<Event> events = std::vector<Event>(RING_SIZE);
+    boost::atomic<uint64_t> count{ 0 };
+};
+
+struct Registry
+{
+    boost::mutex mutex;
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+    std::vector<ThreadBuffer*> freeBuffers;
+    std::map<int, std::string> threadNames;
+    int lastTid = 0;
+};
+
+Registry& registry()
+{
+    static Registry instance;
+    return instance;
+}
+
+boost::atomic<int64_t> g_clearTime{ 0 };
+
+struct ThreadState
+{
+    ThreadBuffer* buffer = nullptr;
+    int tid = 0;
+    const char* name = nullptr;
+
+    ~ThreadState()
+    {
+        if (buffer != nullptr)
+        {
+            auto& r = registry();
+            boost::lock_guard<boost::mutex> locker(r.mutex);
+            r.freeBuffers.push_back(buffer);
+        }
+    }
+};
+
+thread_local ThreadState t_state;
+
+ThreadState& threadState()
+{
+    if (t_state.buffer == nullptr)
+    {
+        auto& r = registry();
+        boost::lock_guard<boost::mutex> locker(r.mutex);
+        if (!r.freeBuffers.empty())
+        {
+            t_state.buffer = r.freeBuffers.back();
+            r.freeBuffers.pop_back();
+        }
+        else
+        {
+            r.buffers.push_back(std::make_unique<ThreadBuffer>());
+            t_state.buffer = r.buffers.back().get();
+        }
+        t_state.tid = ++r.lastTid;
+        if (t_state.name != nullptr)
+        {
+            r.threadNames[t_state.tid] = t_state.name;
+        }
+    }
+    return t_state;
+}
+
+void writeEscaped(std::ostream& stream, const char* s)
+{
+    for (; *s != '\0'; ++s)
+    {
+        if (*s == '"' || *s == '\\')
+        {
+            stream << '\\';
+        }
+        stream << *s;
+    }
+}
+
+} // namespace
+
+void setEnabled(bool enabled)
+{
+    g_enabled = enabled;
+}
+
+void clear()
+{
+    g_clearTime = now();
+}
+
+void setThreadName(const char* name)
+{
+    t_state.name = name;
+    if (t_state.buffer != nullptr)
+    {
+        auto& r = registry();
+        boost::lock_guard<boost::mutex> locker(r.mutex);
+        r.threadNames[t_state.tid] = name;
+    }
+}
+
+int64_t now()
+{
+    return boost::chrono::duration_cast<boost::chrono::nanoseconds>(
+        boost::chrono::high_resolution_clock::now().time_since_epoch()).count();
+}
+
+void recordEvent(const char* name, int64_t start, int64_t end)
+{
+    auto& state = threadState();
+    auto& buffer = *state.buffer;
+    const auto count = buffer.count.load(boost::memory_order_relaxed);
+    buffer.events[count & (RING_SIZE - 1)] = { name, start, end, state.tid };
+    buffer.count.store(count + 1, boost::memory_order_release);
+}
+
+void writeChromeTrace(std::ostream& stream)
+{
+    auto& r = registry();
+    boost::lock_guard<boost::mutex> locker(r.mutex);
+
+    const int64_t clearTime = g_clearTime;
+    std::vector<Event> events;
+    for (const auto& buffer : r.buffers)
+    {
+        const uint64_t count = buffer->count.load(boost::memory_order_acquire);
+        const uint64_t first = (count > RING_SIZE) ? count - RING_SIZE : 0;
+        const auto offset = events.size();
+        for (uint64_t i = first; i < count; ++i)
+        {
+            events.push_back(buffer->events[i & (RING_SIZE - 1)]);
+        }
+
+        // Drop the events the owner thread may have overwritten meanwhile
+        const uint64_t recount = buffer->count.load(boost::memory_order_acquire);
+        if (recount > RING_SIZE && recount - RING_SIZE > first)
+        {
+            const auto overwritten = std::min<uint64_t>(recount - RING_SIZE - first, count - first);
+            events.erase(events.begin() + offset, events.begin() + offset + overwritten);
+        }
+    }
+
+    stream << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    const char* separator = "\n";
+    for (const auto& name : r.threadNames)
+    {
+        stream << separator << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << name.first
+            << ",\"args\":{\"name\":\"";
+        writeEscaped(stream, name.second.c_str());
+        stream << "\"}}";
+        separator = ",\n";
+    }
+    for (const auto& event : events)
+    {
+        if (event.start < clearTime)
+        {
+            continue;
+        }
+        stream << separator << "{\"name\":\"";
+        writeEscaped(stream, event.name);
+        stream << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << event.tid
+            << ",\"ts\":" << event.start / 1000 << '.' << event.start / 100 % 10
+            << ",\"dur\":" << (event.end - event.start) / 1000 << '.' << (event.end - event.start) / 100 % 10
+            << '}';
+        separator = ",\n";
+    }
+    stream << "\n]}\n";
+}
+
+} // namespace tracing
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <boost/atomic.hpp>
+
+#include <cstdint>
+#include <ostream>
+
+// Chrome trace event recording of the decoding pipeline, for chrome://tracing or ui.perfetto.dev.
+// Every thread records complete events into a ring buffer of its own, so recording takes no locks;
+// while tracing is disabled a scope costs a relaxed atomic load.
+namespace tracing {
+
+extern boost::atomic_bool g_enabled;
+
+inline bool isEnabled() { return g_enabled.load(boost::memory_order_relaxed); }
+
+// Ring buffers are allocated on the first event of each thread after enabling
+void setEnabled(bool enabled);
+
+// Events recorded so far are left out of later dumps
+void clear();
+
+// Names the calling thread in the trace; name must outlive the thread
+void setThreadName(const char* name);
+
+// Writes the events still held by the ring buffers as Chrome trace JSON; may be called while tracing
+void writeChromeTrace(std::ostream& stream);
+
+int64_t now(); // nanoseconds
+void recordEvent(const char* name, int64_t start, int64_t end);
+
+class Scope
+{
+public:
+    // name must be a string literal
+    explicit Scope(const char* name)
+        : m_name(isEnabled() ? name : nullptr), m_start(m_name != nullptr ? now() : 0) {}
+
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+    ~Scope()
+    {
+        if (m_name != nullptr)
+        {
+            recordEvent(m_name, m_start, now());
+        }
+    }
+
+private:
+    const char* m_name;
+    int64_t m_start;
+};
+
+// Records a single call
+template<typename F>
+auto traced(const char* name, F func)
+{
+    Scope scope(name);
+    return func();
+}
+
+} // namespace tracing
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+// Records the rest of the enclosing block
+#define TRACE_SCOPE(name) ::tracing::Scope TRACE_CONCAT(traceScope, __LINE__)(name)
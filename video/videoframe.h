@@ -1,7 +1,8 @@
 #pragma once
 
+#include "framebufferpool.h"
+
 #include <memory>
-#include <future>
 
 struct AVFrameDeleter
 {
@@ -10,12 +11,39 @@ struct AVFrameDeleter
 
 typedef std::unique_ptr<AVFrame, AVFrameDeleter> AVFramePtr;
 
+// Layout a display may take a decoded frame of this format in; LAYOUT_FRAME_FORMAT if none
+inline FrameRenderingData::Layout GetNativeFrameLayout(int format)
+{
+    switch (format)
+    {
+    case AV_PIX_FMT_NV12: return FrameRenderingData::LAYOUT_NV12;
+    case AV_PIX_FMT_P010LE:
+    case AV_PIX_FMT_P016LE: return FrameRenderingData::LAYOUT_P010;
+    case AV_PIX_FMT_YUV420P10LE: return FrameRenderingData::LAYOUT_YUV420P10;
+    case AV_PIX_FMT_YUV444P: return FrameRenderingData::LAYOUT_YUV444P;
+    case AV_PIX_FMT_YUV444P10LE: return FrameRenderingData::LAYOUT_YUV444P10;
+    default: return FrameRenderingData::LAYOUT_FRAME_FORMAT;
+    }
+}
+
+// An asynchronous conversion into a frame, see ConversionPool
+struct IFrameConversion
+{
+    // Waits for the conversion to finish and gives it up; returns whether it has succeeded
+    virtual bool finish() = 0;
+
+protected:
+    ~IFrameConversion() = default;
+};
+
 struct VideoFrame
 {
     double m_pts{0};
     int64_t m_duration{0};
+    unsigned int m_generation{0}; // decoding generation the frame was decoded in
     AVFramePtr m_image;
-    std::future<bool> m_convert;
+    IFrameConversion* m_convert{nullptr}; // pending until finished
+    FrameBufferPool* m_bufferPool{nullptr}; // set by the owning queue
 
     VideoFrame() 
         : m_image(av_frame_alloc()) 
@@ -26,7 +54,11 @@ struct VideoFrame
 
     void free()
     {
-        m_convert = {}; // Finish first
+        if (m_convert != nullptr)
+        {
+            m_convert->finish(); // Finish first
+            m_convert = nullptr;
+        }
         av_frame_unref(m_image.get());
     }
     void realloc(AVPixelFormat pix_fmt, int width, int height)
@@ -39,7 +71,10 @@ struct VideoFrame
             m_image->format = pix_fmt;
             m_image->width = width;
             m_image->height = height;
-            av_frame_get_buffer(m_image.get(), 16);
+            if (m_bufferPool == nullptr || !m_bufferPool->getBuffer(m_image.get()))
+            {
+                av_frame_get_buffer(m_image.get(), FrameBufferPool::ALIGN);
+            }
         }
     }
 };
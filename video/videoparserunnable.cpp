@@ -1,4 +1,5 @@
 #include "ffmpegdecoder.h"
+#include "frameconversion.h"
 #include "makeguard.h"
 #include "interlockedadd.h"
 
@@ -8,471 +9,120 @@ extern "C"
 }
 
 #include <boost/log/trivial.hpp>
+#include <algorithm>
+#include <limits>
 #include <tuple>
+#include <utility>
 
 namespace {
 
-#ifdef _MSC_VER
-
-#define SUBSAMPLE(v, a, s) (v < 0) ? (-((-v + a) >> s)) : ((v + a) >> s)
-
-inline uint8_t clamp255(uint32_t v) {
-    const uint8_t noOverflowCandidate = v;
-    return (noOverflowCandidate == v) ? noOverflowCandidate : 255;
-}
-
-#define C16TO8(v, scale) clamp255(((v) * (scale)) >> 16)
-
-/*
-asm volatile (
-  "movd      %3,%%xmm2                      \n"
-  "punpcklwd %%xmm2,%%xmm2                  \n"
-  "pshufd    $0x0,%%xmm2,%%xmm2             \n"
-
-  // 32 pixels per loop.
-  LABELALIGN
-  "1:                                       \n"
-  "movdqu    (%0),%%xmm0                    \n"
-  "movdqu    0x10(%0),%%xmm1                \n"
-  "add       $0x20,%0                       \n"
-  "pmulhuw   %%xmm2,%%xmm0                  \n"
-  "pmulhuw   %%xmm2,%%xmm1                  \n"
-  "packuswb  %%xmm1,%%xmm0                  \n"
-  "movdqu    %%xmm0,(%1)                    \n"
-  "add       $0x10,%1                       \n"
-  "sub       $0x10,%2                       \n"
-  "jg        1b                             \n"
-: "+r"(src_y),   // %0
-  "+r"(dst_y),   // %1
-  "+r"(width)    // %2
-: "r"(scale)     // %3
-: "memory", "cc", "xmm0", "xmm1", "xmm2");
-*/
-
-const auto DITHER_SCALE = 16352;
-
-// Use scale to convert lsb formats to msb, depending how many bits there are:
-// 32768 = 9 bits
-// 16384 = 10 bits (dither - 16352)
-// 4096 = 12 bits
-// 256 = 16 bits
-void Convert16To8Row_SSSE3(const __m128i* src_y,
-    __m128i* dst_y,
-    int scale,
-    int width,
-    int32_t odd_even_add /*either 0x00000002 or 0x00030001*/) {
-
-    // Load scale factor into SIMD register
-    __m128i s = _mm_cvtsi32_si128(scale);
-    s = _mm_unpacklo_epi16(s, s);
-    s = _mm_shuffle_epi32(s, 0);
-
-    // Broadcast 32-bit odd/even offset across the 128-bit register (four times)
-    __m128i odd_even_offset = _mm_set1_epi32(odd_even_add);
-
-    for (; width > 0; width -= 16)
-    {
-        // Load 16-bit grayscale values from the source buffer
-        __m128i a0 = *src_y++;
-        __m128i a1 = *src_y++;
-
-        // Apply alternating Bayer mask values using the fully populated 128-bit register
-        a0 = _mm_add_epi16(a0, odd_even_offset);
-        a1 = _mm_add_epi16(a1, odd_even_offset);
-
-        // Scale down from 16-bit to 8-bit using multiply-high
-        a0 = _mm_mulhi_epu16(a0, s);
-        a1 = _mm_mulhi_epu16(a1, s);
-
-        // Pack two 16-bit sets into one 8-bit register
-        a0 = _mm_packus_epi16(a0, a1);
-
-        // Store the final 8-bit pixels into the destination buffer
-        *dst_y++ = a0;
-    }
-}
-
-void ScaleRowDown2_16To8_C(const uint16_t* src_ptr,
-    ptrdiff_t src_stride,
-    uint8_t* dst,
-    int dst_width,
-    int scale) {
-    int x;
-    (void)src_stride;
-    assert(scale >= 256);
-    assert(scale <= 32768);
-    for (x = 0; x < dst_width - 1; x += 2) {
-        dst[0] = C16TO8(src_ptr[1], scale);
-        dst[1] = C16TO8(src_ptr[3], scale);
-        dst += 2;
-        src_ptr += 4;
-    }
-    if (dst_width & 1) {
-        dst[0] = C16TO8(src_ptr[1], scale);
-    }
-}
-
-void Convert16To8Row_Any_SSSE3(const uint16_t* src_ptr, uint8_t* dst_ptr, int scale, int width, int y) 
-{
-    enum {
-          SBPP = 2, 
-          BPP = 1,
-          MASK = 15,
-    };
-
-    const int r = width & MASK;                            
-    const int n = width & ~MASK;
-    const int32_t add = (scale != DITHER_SCALE) ? 0 : ((y & 1) ? 0x00000002 : 0x00030001);
-    if (n > 0) {                                     
-        Convert16To8Row_SSSE3((const __m128i*)src_ptr, (__m128i*)dst_ptr, scale, n, add);
-    }     
-    if (r > 0) {
-        __declspec(align(16)) uint16_t temp[32];
-        __declspec(align(16)) uint8_t out[32];
-        memset(temp, 0, 32 * SBPP); /* for msan */
-        memcpy(temp, src_ptr + n, r * SBPP);
-        Convert16To8Row_SSSE3((const __m128i*)temp, (__m128i*)out, scale, MASK + 1, add);
-        memcpy(dst_ptr + n, out, r * BPP);
-    }
-}
-
-void Convert16To8Plane(const uint16_t* src_y,
-                       int src_stride_y,
-                       uint8_t* dst_y,
-                       int dst_stride_y,
-                       int scale,  // 16384 for 10 bits
-                       int width,
-                       int height) 
+// Runs on a ConversionPool worker
+bool ConvertFrameAsync(ConversionPool::Job& job, ConversionPool::WorkerContext& context)
 {
-  // Negative height means invert the image.
-  if (height < 0) {
-    height = -height;
-    dst_y = dst_y + (height - 1) * dst_stride_y;
-    dst_stride_y = -dst_stride_y;
-  }
-  // Coalesce rows.
-  if (src_stride_y == width && dst_stride_y == width) {
-    width *= height;
-    height = 1;
-    src_stride_y = dst_stride_y = 0;
-  }
-
-  // Convert plane
-  for (int y = 0; y < height; ++y) {
-      Convert16To8Row_Any_SSSE3(src_y, dst_y, scale, width, y);
-    src_y += src_stride_y;
-    dst_y += dst_stride_y;
-  }
-}
+    // Waiting for the frame queue slot doesn't count
+    auto start = boost::chrono::high_resolution_clock::now();
+    boost::chrono::high_resolution_clock::duration conversionTime{};
 
-void ScalePlaneDown2_16To8(int dst_width,
-                        int dst_height,
-                        int src_stride,
-                        int dst_stride,
-                        const uint16_t* src_ptr,
-                        uint8_t* dst_ptr,
-                        int scale) {
-    int row_stride = src_stride * 2;
-    //if (!filtering) {
-        src_ptr += src_stride;  // Point to odd rows.
-        src_stride = 0;
-    //}
-
-    for (int y = 0; y < dst_height; ++y) {
-        ScaleRowDown2_16To8_C(src_ptr, src_stride, dst_ptr, dst_width, scale);
-        src_ptr += row_stride;
-        dst_ptr += dst_stride;
-    }
-}
-
-int I010ToI420(const uint16_t* src_y,
-               int src_stride_y,
-               const uint16_t* src_u,
-               int src_stride_u,
-               const uint16_t* src_v,
-               int src_stride_v,
-               uint8_t* dst_y,
-               int dst_stride_y,
-               uint8_t* dst_u,
-               int dst_stride_u,
-               uint8_t* dst_v,
-               int dst_stride_v,
-               int width,
-               int height)
-{
-  int halfwidth = (width + 1) >> 1;
-  int halfheight = (height + 1) >> 1;
-  if (!src_u || !src_v || !dst_u || !dst_v || width <= 0 || height == 0) {
-    return -1;
-  }
-  // Negative height means invert the image.
-  if (height < 0) {
-    height = -height;
-    halfheight = (height + 1) >> 1;
-    src_y = src_y + (height - 1) * src_stride_y;
-    src_u = src_u + (halfheight - 1) * src_stride_u;
-    src_v = src_v + (halfheight - 1) * src_stride_v;
-    src_stride_y = -src_stride_y;
-    src_stride_u = -src_stride_u;
-    src_stride_v = -src_stride_v;
-  }
-
-  // Convert Y plane.
-  Convert16To8Plane(src_y, src_stride_y, dst_y, dst_stride_y, DITHER_SCALE, width,
-                    height);
-  // Convert UV planes.
-  Convert16To8Plane(src_u, src_stride_u, dst_u, dst_stride_u, 16384, halfwidth,
-                    halfheight);
-  Convert16To8Plane(src_v, src_stride_v, dst_v, dst_stride_v, 16384, halfwidth,
-                    halfheight);
-  return 0;
-}
-
-int I410ToI420(const uint16_t* src_y,
-            int src_stride_y,
-            const uint16_t* src_u,
-            int src_stride_u,
-            const uint16_t* src_v,
-            int src_stride_v,
-            uint8_t* dst_y,
-            int dst_stride_y,
-            uint8_t* dst_u,
-            int dst_stride_u,
-            uint8_t* dst_v,
-            int dst_stride_v,
-            int width,
-            int height) {
-    const int depth = 10;
-    const int scale = 1 << (24 - depth);
-
-    if (width <= 0 || height == 0) {
-        return -1;
-    }
-    // Negative height means invert the image.
-    if (height < 0) {
-        height = -height;
-        src_y = src_y + (height - 1) * src_stride_y;
-        src_u = src_u + (height - 1) * src_stride_u;
-        src_v = src_v + (height - 1) * src_stride_v;
-        src_stride_y = -src_stride_y;
-        src_stride_u = -src_stride_u;
-        src_stride_v = -src_stride_v;
-    }
-
-    {
-        const int uv_width = SUBSAMPLE(width, 1, 1);
-        const int uv_height = SUBSAMPLE(height, 1, 1);
-
-        Convert16To8Plane(src_y, src_stride_y, dst_y, dst_stride_y, DITHER_SCALE, width,
-            height);
-        ScalePlaneDown2_16To8(uv_width, uv_height, src_stride_u,
-            dst_stride_u, src_u, dst_u, scale);
-        ScalePlaneDown2_16To8(uv_width, uv_height, src_stride_v,
-            dst_stride_v, src_v, dst_v, scale);
-    }
-    return 0;
-}
-
-#endif
+    try {
+        auto& input = job.input;
+        if (input->format == AV_PIX_FMT_NONE)
+            return false;
 
-bool frameToImage(
-    VideoFrame& videoFrameData,
-    AVFramePtr& videoFrame,
-    SwsContext*& imageCovertContext,
-    AVPixelFormat pixelFormat)
-{
-    if (videoFrame->format == AV_PIX_FMT_NONE)
-    {
-        return false;
-    }
+        const int stride = (input->width + 1) & ~1;
 
-    if (videoFrame->format == pixelFormat
-        || videoFrame->format == AV_PIX_FMT_DXVA2_VLD)
-    {
-        std::swap(videoFrame, videoFrameData.m_image);
-    }
-    else
-    {
-        const int width = videoFrame->width;
-        const int height = videoFrame->height;
+        auto& img = context.input;
+        img.resize(stride * (input->height + (input->height + 1) / 2));
 
-        videoFrameData.realloc(pixelFormat, width, height);
+        const auto data = img.data();
 
-#ifdef _MSC_VER
-        if ((videoFrame->format == AV_PIX_FMT_YUV420P10LE || videoFrame->format == AV_PIX_FMT_YUV444P10LE) && pixelFormat == AV_PIX_FMT_YUV420P
-            && !((intptr_t(videoFrame->data[0]) & 15) || (videoFrame->linesize[0] & 15)
-            || (intptr_t(videoFrame->data[1]) & 15) || (videoFrame->linesize[1] & 15)
-            || (intptr_t(videoFrame->data[2]) & 15) || (videoFrame->linesize[2] & 15)))
+        if (input->format == AV_PIX_FMT_NV12)
         {
-            if (videoFrame->format == AV_PIX_FMT_YUV420P10LE)
-            {
-                I010ToI420(
-                    (const uint16_t*)videoFrame->data[0],
-                    videoFrame->linesize[0] / 2,
-                    (const uint16_t*)videoFrame->data[1],
-                    videoFrame->linesize[1] / 2,
-                    (const uint16_t*)videoFrame->data[2],
-                    videoFrame->linesize[2] / 2,
-                    videoFrameData.m_image->data[0],
-                    videoFrameData.m_image->linesize[0],
-                    videoFrameData.m_image->data[1],
-                    videoFrameData.m_image->linesize[1],
-                    videoFrameData.m_image->data[2],
-                    videoFrameData.m_image->linesize[2],
-                    width, height
-                );
-            }
-            else
-            {
-                I410ToI420(
-                    (const uint16_t*)videoFrame->data[0],
-                    videoFrame->linesize[0] / 2,
-                    (const uint16_t*)videoFrame->data[1],
-                    videoFrame->linesize[1] / 2,
-                    (const uint16_t*)videoFrame->data[2],
-                    videoFrame->linesize[2] / 2,
-                    videoFrameData.m_image->data[0],
-                    videoFrameData.m_image->linesize[0],
-                    videoFrameData.m_image->data[1],
-                    videoFrameData.m_image->linesize[1],
-                    videoFrameData.m_image->data[2],
-                    videoFrameData.m_image->linesize[2],
-                    width, height
-                );
-            }
+            av_image_copy_plane(data, stride, input->data[0], input->linesize[0], input->width, input->height);
+            av_image_copy_plane(data + stride * input->height, stride, input->data[1], input->linesize[1], input->width, input->height / 2);
         }
         else
-#endif
         {
-            // Prepare image conversion
-            imageCovertContext =
-                sws_getCachedContext(imageCovertContext, videoFrame->width, videoFrame->height,
-                    static_cast<AVPixelFormat>(videoFrame->format), width, height, pixelFormat,
-                    0, nullptr, nullptr, nullptr);
-
-            assert(imageCovertContext != nullptr);
-
-            if (imageCovertContext == nullptr)
-            {
-                return false;
-            }
-
-            // Doing conversion
-            if (sws_scale(imageCovertContext, videoFrame->data, videoFrame->linesize, 0,
-                videoFrame->height, videoFrameData.m_image->data, videoFrameData.m_image->linesize) <= 0)
-            {
-                assert(false && "sws_scale failed");
-                BOOST_LOG_TRIVIAL(error) << "sws_scale failed";
-                return false;
-            }
-        }
-
-        videoFrameData.m_image->sample_aspect_ratio = videoFrame->sample_aspect_ratio;
-    }
-
-    return true;
-}
-
-auto GetAsyncConversionFunction(OrderedScopedTokenGenerator::Token t,
-    AVFramePtr input,
-    std::promise<VideoFrame *> &videoFramePromise,
-    boost::shared_ptr<IFrameDecoder::ImageConversionFunc> imageConversionFunc,
-    AVPixelFormat pixelFormat)
-{
-    return [t = std::move(t), input = std::move(input),
-        outputFut = videoFramePromise.get_future(),
-        imageConversionFunc = std::move(imageConversionFunc),
-        pixelFormat]() mutable
-    {
-        try {
-            if (input->format == AV_PIX_FMT_NONE)
+            context.toNV12 = sws_getCachedContext(
+                context.toNV12,
+                input->width,
+                input->height,
+                (AVPixelFormat)input->format,
+                input->width,
+                input->height,
+                AV_PIX_FMT_NV12,
+                SWS_FAST_BILINEAR, NULL, NULL, NULL);
+            if (context.toNV12 == nullptr)
                 return false;
 
-            const int stride = (input->width + 1) & ~1;
-
-            std::vector<uint8_t> img(stride * (input->height + (input->height + 1) / 2));
+            uint8_t* const dst[] = { data, data + stride * input->height };
+            const int dstStride[] = { stride, stride };
 
-            const auto data = img.data();
-
-            if (input->format == AV_PIX_FMT_NV12)
-            {
-                av_image_copy_plane(data, stride, input->data[0], input->linesize[0], input->width, input->height);
-                av_image_copy_plane(data + stride * input->height, stride, input->data[1], input->linesize[1], input->width, input->height / 2);
-            }
-            else
-            {
-                auto img_convert_ctx = sws_getContext(
-                    input->width,
-                    input->height,
-                    (AVPixelFormat)input->format,
-                    input->width,
-                    input->height,
-                    AV_PIX_FMT_NV12,
-                    SWS_FAST_BILINEAR, NULL, NULL, NULL);
-
-                uint8_t* const dst[] = { data, data + stride * input->height };
-                const int dstStride[] = { stride, stride };
-
-                sws_scale(img_convert_ctx, input->data, input->linesize, 0, input->height,
-                    dst, dstStride);
-
-                sws_freeContext(img_convert_ctx);
-            }
-
-            const auto width = input->width;
-            const auto height = input->height;
-            const auto pts = input->pts;
-
-            input.reset();  // Free input frame as soon as possible since it's not needed anymore
+            sws_scale(context.toNV12, input->data, input->linesize, 0, input->height,
+                dst, dstStride);
+        }
 
-            std::vector<uint8_t> outputImg;
+        const auto width = input->width;
+        const auto height = input->height;
+        const auto pts = input->pts;
 
-            int outputHeight{};
-            int outputWidth{};
+        av_frame_unref(input.get());  // Free input frame as soon as possible since it's not needed anymore
 
-            if (!(*imageConversionFunc)(std::move(t), data, stride, width, height,
-                pts, outputImg, outputWidth, outputHeight))
-            {
-                return false;
-            }
+        auto& outputImg = context.output;
 
-            const int outputStride = outputWidth;
+        int outputHeight{};
+        int outputWidth{};
 
-            auto output = outputFut.get();
-            if (!output)
-                return false;
+        if (!tracing::traced("ImageConversionFunc", [&] {
+                return (*job.imageConversionFunc)(std::move(job.token), data, stride, width, height,
+                    pts, outputImg, outputWidth, outputHeight); }))
+        {
+            return false;
+        }
 
-            output->realloc(pixelFormat, outputWidth, outputHeight);
+        const int outputStride = outputWidth;
 
-            auto img_convert_ctx = sws_getContext(
-                outputWidth,
-                outputHeight,
-                AV_PIX_FMT_NV12,
-                outputWidth,
-                outputHeight,
-                pixelFormat,
-                SWS_FAST_BILINEAR, NULL, NULL, NULL);
+        conversionTime = boost::chrono::high_resolution_clock::now() - start;
+        auto output = job.output();
+        if (!output)
+            return false;
+        start = boost::chrono::high_resolution_clock::now();
+
+        output->realloc(job.pixelFormat, outputWidth, outputHeight);
+
+        context.fromNV12 = sws_getCachedContext(
+            context.fromNV12,
+            outputWidth,
+            outputHeight,
+            AV_PIX_FMT_NV12,
+            outputWidth,
+            outputHeight,
+            job.pixelFormat,
+            SWS_FAST_BILINEAR, NULL, NULL, NULL);
+        if (context.fromNV12 == nullptr)
+            return false;
 
-            const auto outputData = outputImg.data();
+        const auto outputData = outputImg.data();
 
-            uint8_t* const src[] = { outputData, outputData + outputStride * outputHeight };
-            const int srcStride[] = { outputStride, outputStride };
+        uint8_t* const src[] = { outputData, outputData + outputStride * outputHeight };
+        const int srcStride[] = { outputStride, outputStride };
 
-            sws_scale(img_convert_ctx,
-                src, srcStride,
-                0, outputHeight,
-                output->m_image->data,
-                output->m_image->linesize);
+        sws_scale(context.fromNV12,
+            src, srcStride,
+            0, outputHeight,
+            output->m_image->data,
+            output->m_image->linesize);
+    }
+    catch (const std::exception& ex) {
+        CHANNEL_LOG(ffmpeg_sync) << "Exception in async converter: " << typeid(ex).name() << ": " << ex.what();
+        return false;
+    }
 
-            sws_freeContext(img_convert_ctx);
-        }
-        catch (const std::exception& ex) {
-            CHANNEL_LOG(ffmpeg_sync) << "Exception in async converter: " << typeid(ex).name() << ": " << ex.what();
-            return false;
-        }
+    if (job.conversionTime != nullptr)
+    {
+        job.conversionTime->add(conversionTime + (boost::chrono::high_resolution_clock::now() - start));
+    }
 
-        return true;
-    };
+    return true;
 }
 
 } // namespace
@@ -485,41 +135,180 @@ struct FFmpegDecoder::VideoParseContext
     AVFramePtr prevVideoFrame;
     double videoClock = 0; // pts of last decoded frame / predicted pts of next decoded frame
     double frameDelay = 0;
+    boost::chrono::high_resolution_clock::duration decodingTime{}; // not yet accounted to a frame
+    unsigned int generation = 0; // decoding generation of the packets being handled
+    double seekTarget = std::numeric_limits<double>::lowest(); // frames ending before it are not shown
 };
 
 void FFmpegDecoder::videoParseRunnable()
 {
     CHANNEL_LOG(ffmpeg_threads) << "Video thread started";
+    tracing::setThreadName("video");
     m_videoStartClock = VIDEO_START_CLOCK_NOT_INITIALIZED;
 
     VideoParseContext context{};
+    context.generation = m_decodingGeneration;
 
     while (!boost::this_thread::interruption_requested())
     {
         AVPacket packet;
-        if (!m_videoPacketsQueue.pop(packet))
+        unsigned int generation;
+        if (!m_videoPacketsQueue.pop(packet, generation))
         {
             break;
         }
 
         auto packetGuard = MakeGuard(&packet, av_packet_unref);
 
+        if (generation != m_decodingGeneration)
+        {
+            continue; // queued before the seek
+        }
+
+        if (generation != context.generation)
+        {
+            restartVideoDecoding();
+            context = VideoParseContext{};
+            context.generation = generation;
+            const int64_t exactSeekDuration = m_exactSeekDuration;
+            if (exactSeekDuration != AV_NOPTS_VALUE)
+            {
+                context.seekTarget = getDurationSecs(exactSeekDuration);
+            }
+        }
+
         handleVideoPacket(packet, context);
     }
 }
 
+void FFmpegDecoder::restartVideoDecoding()
+{
+    if (m_videoResetRequested.exchange(false))
+    {
+        // Frames of the previous generation may still refer to the codec context
+        {
+            boost::unique_lock<boost::mutex> locker(m_videoFramesMutex);
+            m_videoFramesCV.wait(locker, [this]
+            {
+                return !m_frameDisplayingRequested && !m_videoFramesQueue.canPop();
+            });
+        }
+
+        if (!resetVideoProcessing())
+        {
+            BOOST_LOG_TRIVIAL(error) << "resetVideoProcessing() failed";
+        }
+
+        m_videoResetting = false;
+    }
+    else if (m_videoCodecContext != nullptr)
+    {
+        if (!isVideoLowresPending())
+        {
+            avcodec_flush_buffers(m_videoCodecContext);
+        }
+        else if (!resetVideoProcessing()) // the flush loses the decoded frames anyway
+        {
+            BOOST_LOG_TRIVIAL(error) << "resetVideoProcessing() failed";
+        }
+    }
+}
+
+// Applied to the codec context before it is opened
+void FFmpegDecoder::setupVideoDecodeQuality()
+{
+    const auto level = m_decodeQualityGovernor.level();
+
+    // https://trac.kodi.tv/ticket/4943
+    m_videoCodecContext->skip_loop_filter
+        = (level >= DECODE_QUALITY_SKIP_LOOP_FILTER) ? AVDISCARD_ALL : AVDISCARD_DEFAULT;
+    m_videoCodecContext->skip_frame
+        = (level >= DECODE_QUALITY_SKIP_NONREF) ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+    m_videoCodecContext->skip_idct
+        = (level >= DECODE_QUALITY_SKIP_IDCT) ? AVDISCARD_NONKEY : AVDISCARD_DEFAULT;
+    m_videoCodecContext->lowres
+        = (level >= DECODE_QUALITY_LOWRES) ? std::min(1, int(m_videoCodec->max_lowres)) : 0;
+}
+
+// Lowres needs the codec to be reopened, so it lags behind the level until the next flush or keyframe
+bool FFmpegDecoder::isVideoLowresPending() const
+{
+    return (m_decodeQualityGovernor.level() >= DECODE_QUALITY_LOWRES) != (m_videoCodecContext->lowres != 0);
+}
+
+void FFmpegDecoder::updateDecodeQuality(double lateness)
+{
+    // Not available with hardware decoding
+    const bool canLowres = m_videoCodec->max_lowres > 0 && m_videoCodecContext->opaque == nullptr;
+    const auto prevLevel = m_decodeQualityGovernor.level();
+
+    if (!m_decodeQualityGovernor.update(lateness,
+            canLowres ? DECODE_QUALITY_LOWRES : DECODE_QUALITY_SKIP_IDCT))
+    {
+        return;
+    }
+
+    const auto level = m_decodeQualityGovernor.level();
+    CHANNEL_LOG(ffmpeg_sync) << "Decode quality level: " << prevLevel << " -> " << level;
+
+    const auto lowres = m_videoCodecContext->lowres;
+    setupVideoDecodeQuality();
+    m_videoCodecContext->lowres = lowres;
+
+    if (m_decoderListener != nullptr)
+    {
+        m_decoderListener->onDecodeQualityChanged(level);
+    }
+}
+
 bool FFmpegDecoder::handleVideoPacket(
     const AVPacket& packet,
     VideoParseContext& context)
 {
-    const int ret = avcodec_send_packet(m_videoCodecContext, &packet);
+    if (m_videoCodecContext == nullptr)
+    {
+        return false;
+    }
+
+    // Decoding time is accounted to the frames it yields
+    const auto timed = [&context](const char* name, auto func)
+    {
+        tracing::Scope scope(name);
+        const auto start = boost::chrono::high_resolution_clock::now();
+        const auto result = func();
+        context.decodingTime += boost::chrono::high_resolution_clock::now() - start;
+        return result;
+    };
+
+    if ((packet.flags & AV_PKT_FLAG_KEY) && packet.size > 0 && isVideoLowresPending())
+    {
+        // Drain the frames still held by the decoder and switch lowres at the keyframe, without a seek
+        AVPacket drainPacket{};
+        handleVideoPacket(drainPacket, context);
+        if (!resetVideoProcessing())
+        {
+            BOOST_LOG_TRIVIAL(error) << "resetVideoProcessing() failed";
+            return false;
+        }
+    }
+
+    const int ret = timed("avcodec_send_packet", [this, &packet] { return avcodec_send_packet(m_videoCodecContext, &packet); });
     if (ret < 0) {
         return false;
     }
 
     AVFramePtr videoFrame(av_frame_alloc());
-    while (avcodec_receive_frame(m_videoCodecContext, videoFrame.get()) == 0)
+    while (timed("avcodec_receive_frame", [this, &videoFrame] { return avcodec_receive_frame(m_videoCodecContext, videoFrame.get()); }) == 0)
     {
+        m_metrics.decoding.add(context.decodingTime);
+        context.decodingTime = {};
+
+        if (const double decodeCost = m_simulatedDecodeCost)
+        {
+            m_clock->sleepFor(boost::chrono::duration_cast<IClock::duration>(
+                boost::chrono::duration<double>(decodeCost)));
+        }
+
         if (context.prevVideoFrame)
         {
             handleVideoFrame(context.prevVideoFrame, context, videoFrame->best_effort_timestamp);
@@ -556,26 +345,36 @@ bool FFmpegDecoder::handleVideoFrame(
     int64_t next_timestamp)
 {
     enum { MAX_SKIPPED_TILL_REDRAW = 5 };
-    enum { SKIP_LOOP_FILTER_THRESHOLD = 50 };
     const double MAX_DELAY = 0.2;
 
     const auto best_effort_timestamp = videoFrame->best_effort_timestamp;
     const double pts = context.videoClock;
 
+    // Exact seek: skip frames between the keyframe and the seek position
+    if (pts + context.frameDelay <= context.seekTarget)
+    {
+        return true;
+    }
+
 restart:
 
-    boost::posix_time::time_duration td(boost::posix_time::pos_infin);
+    IClock::time_point deadline = IClock::time_point::max(); // of the frame queue wait
     bool inNextFrame = false;
     bool continueHandlingPrevTime = false;
 
     for (;;)
     {
         boost::unique_lock<boost::mutex> locker(m_isPausedMutex);
-        while (m_isPaused && !m_isVideoSeekingWhilePaused)
+        while (m_isPaused && !m_isVideoSeekingWhilePaused && context.generation == m_decodingGeneration)
         {
             m_isPausedCV.wait(locker);
         }
 
+        if (context.generation != m_decodingGeneration)
+        {
+            return true; // decoded before the seek
+        }
+
         const bool isPaused = m_isPaused;
         inNextFrame = isPaused && m_isVideoSeekingWhilePaused;
         if (!context.initialized || inNextFrame)
@@ -603,7 +402,8 @@ restart:
         }
 
         // Skipping frames
-        if (context.initialized && !inNextFrame && !m_videoPacketsQueue.empty())
+        if (context.initialized && !inNextFrame && !m_freeRunning && !m_videoPacketsQueue.empty()
+            && m_videoStartClock != VIDEO_START_CLOCK_NOT_INITIALIZED)
         {
             const double deltaTime = m_videoStartClock + pts - GetHiResTime();
             if (deltaTime <= 0)
@@ -613,19 +413,16 @@ restart:
                     InterLockedAdd(m_videoStartClock, MAX_DELAY);
                 }
 
+                updateDecodeQuality(-deltaTime);
+
+                // Dropping frames is the last resort once decoding can't get any cheaper,
+                // or while the cheaper decoding is yet to catch up with a frame period behind
                 ++context.numSkipped;
-                if (context.numSkipped == SKIP_LOOP_FILTER_THRESHOLD)
-                {
-                    if (m_videoCodecContext->skip_loop_filter != AVDISCARD_ALL)
-                    {
-                        // https://trac.kodi.tv/ticket/4943
-                        CHANNEL_LOG(ffmpeg_sync) << "skip_loop_filter = AVDISCARD_ALL";
-                        m_videoCodecContext->skip_loop_filter = AVDISCARD_ALL;
-                    }
-                }
-                if ((context.numSkipped % MAX_SKIPPED_TILL_REDRAW) != 0)
+                if ((m_decodeQualityGovernor.level() >= DECODE_QUALITY_SKIP_IDCT || -deltaTime > context.frameDelay)
+                    && (context.numSkipped % MAX_SKIPPED_TILL_REDRAW) != 0)
                 {
                     CHANNEL_LOG(ffmpeg_sync) << "Hard skip frame";
+                    DecoderMetricsCollector::increment(m_metrics.framesHardSkipped);
                     return true;
                 }
             }
@@ -634,14 +431,17 @@ restart:
                 if (deltaTime > 0.3 && m_formatContexts.size() == 1)
                 {
                     locker.unlock();
-                    boost::this_thread::sleep_for(boost::chrono::milliseconds(100));
+                    m_clock->sleepFor(boost::chrono::milliseconds(100));
                     continue;
                 }
 
+                updateDecodeQuality(-deltaTime);
+
                 const auto speed = getSpeedRational();
                 context.numSkipped = 0;
-                td = boost::posix_time::milliseconds(
-                    int(deltaTime * 1000.  * speed.denominator / speed.numerator) + 1);
+                deadline = m_clock->now() + boost::chrono::milliseconds(1)
+                    + boost::chrono::duration_cast<IClock::duration>(
+                        boost::chrono::duration<double>(deltaTime * speed.denominator / speed.numerator));
             }
         }
 
@@ -661,50 +461,62 @@ restart:
 
     handleDirect3dData(videoFrame.get(), useAsyncConversion);
 
-    std::future<bool> convert;
-    std::promise<VideoFrame*> videoFramePromise;
-
-    auto promGuard = MakeGuard(&videoFramePromise, [](auto promise) { promise->set_value(nullptr); });
+    // The submitted conversion is told the frame to write to once there is one, or that there is none
+    auto conversion = MakeGuard(static_cast<ConversionPool::Job*>(nullptr),
+        [](ConversionPool::Job* job) { job->setOutput(nullptr); });
 
     if (useAsyncConversion)
     {
-        AVFramePtr input(av_frame_alloc());
+        if (!m_conversionPool)
+        {
+            const unsigned int numThreads = std::clamp(boost::thread::hardware_concurrency(), 2u, 4u);
+            m_conversionPool = std::make_unique<ConversionPool>(ConvertFrameAsync, numThreads,
+                VQueue::MAX_QUEUE_SIZE + numThreads + 2);
+        }
+
+        ConversionPool::Job& job = m_conversionPool->acquire();
 
         //std::swap(input, videoFrame);
-        const auto res = av_frame_ref(input.get(), videoFrame.get());
+        const auto res = av_frame_ref(job.input.get(), videoFrame.get());
         assert(res == 0);
         if (res != 0)
         {
             CHANNEL_LOG(ffmpeg_sync) << "av_frame_ref failed with error code: " << res;
+            m_conversionPool->release(job);
             return true;
         }
 
-        auto asyncConversion = GetAsyncConversionFunction(
-            context.tokenGenerator.generate(),
-            std::move(input),
-            videoFramePromise,
-            std::move(imageConversionFunc),
-            m_pixelFormat);
-
-        convert = std::async(std::launch::async, std::move(asyncConversion));
+        job.token = context.tokenGenerator.generate();
+        job.imageConversionFunc = std::move(imageConversionFunc);
+        job.pixelFormat = m_pixelFormat;
+        job.conversionTime = &m_metrics.conversion;
+        m_conversionPool->submit(job);
+        conversion.reset(&job);
     }
 
     {
+        TRACE_SCOPE("frame queue wait");
         boost::unique_lock<boost::mutex> locker(m_videoFramesMutex);
 
-        if (!m_videoFramesCV.timed_wait(locker, td, [this]
+        if (!m_clock->waitUntil(m_videoFramesCV, locker, deadline, [this, &context]
         {
             return m_isPaused && !m_isVideoSeekingWhilePaused ||
-                m_videoFramesQueue.canPush();
+                m_videoFramesQueue.canPush() ||
+                context.generation != m_decodingGeneration;
         }))
         {
             CHANNEL_LOG(ffmpeg_sync) << "Frame wait abandoned";
+            DecoderMetricsCollector::increment(m_metrics.framesAbandoned);
             return true;
         }
     }
 
     {
         boost::lock_guard<boost::mutex> locker(m_isPausedMutex);
+        if (context.generation != m_decodingGeneration)
+        {
+            return true; // keep m_isVideoSeekingWhilePaused for the frame after the seek
+        }
         if (m_isPaused && !m_isVideoSeekingWhilePaused)
         {
             goto restart;
@@ -720,19 +532,30 @@ restart:
 
     VideoFrame& current_frame = m_videoFramesQueue.back();
 
-    if (!useAsyncConversion && !frameToImage(current_frame, videoFrame, m_imageCovertContext, m_pixelFormat))
+    // The slot may still be written by the conversion of a frame dropped unshown
+    if (current_frame.m_convert != nullptr)
     {
-        return true;
+        std::exchange(current_frame.m_convert, nullptr)->finish();
+    }
+
+    if (!useAsyncConversion)
+    {
+        ScopedTiming timing(m_metrics.conversion);
+        TRACE_SCOPE("frameToImage");
+        if (!frameToImage(current_frame, videoFrame, m_imageCovertContext, m_pixelFormat, m_nativeFrameLayouts))
+        {
+            return true;
+        }
     }
 
     current_frame.m_pts = pts;
     current_frame.m_duration = best_effort_timestamp;
+    current_frame.m_generation = context.generation;
 
     if (useAsyncConversion)
     {
-        promGuard.release();
-        videoFramePromise.set_value(&current_frame);
-        current_frame.m_convert = std::move(convert);
+        current_frame.m_convert = conversion.get();
+        conversion.release()->setOutput(&current_frame);
     }
 
     {
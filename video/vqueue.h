@@ -1,20 +1,28 @@
 #pragma once
 
+#include <algorithm>
 #include <cassert>
+#include <memory>
 
-// Video frame struct for RGB24 frame (used by displays)
+// A ring of decoded frames waiting for the display; frame pictures come from a shared buffer pool.
 class VQueue
 {
 public:
-    VQueue() = default;
+    enum
+    {
+        MIN_QUEUE_SIZE = 2, // enough for displaying one frame.
+        MAX_QUEUE_SIZE = 16,
+    };
+
+    explicit VQueue(int size = MIN_QUEUE_SIZE) { resize(size); }
     VQueue(const VQueue&) = delete;
     VQueue& operator=(const VQueue&) = delete;
 
     void clear()
     {
-        for (auto& frame : m_frames)
+        for (int i = 0; i < m_size; ++i)
         {
-            frame.free();
+            m_frames[i].free();
         }
 
         // Reset readers
@@ -23,13 +31,32 @@ public:
         m_busy = 0;
     }
 
-    bool canPush() const { return m_busy < QUEUE_SIZE; }
+    // Not thread safe: neither the decoder nor the display may hold a frame.
+    void resize(int size)
+    {
+        clear(); // waits for pending conversions
+
+        size = std::max<int>(MIN_QUEUE_SIZE, std::min<int>(size, MAX_QUEUE_SIZE));
+        if (size != m_size)
+        {
+            m_frames = std::make_unique<VideoFrame[]>(size);
+            m_size = size;
+            for (int i = 0; i < m_size; ++i)
+            {
+                m_frames[i].m_bufferPool = &m_bufferPool;
+            }
+        }
+    }
+
+    int size() const { return m_size; }
+
+    bool canPush() const { return m_busy < m_size; }
     VideoFrame& back() { return m_frames[m_write_counter]; }
     void pushBack()
     {
-        m_write_counter = (m_write_counter + 1) % QUEUE_SIZE;
+        m_write_counter = (m_write_counter + 1) % m_size;
         ++m_busy;
-        assert(m_busy <= VQueue::QUEUE_SIZE);
+        assert(m_busy <= m_size);
     }
 
     bool canPop() const { return m_busy > 0; }
@@ -38,13 +65,13 @@ public:
     {
         --m_busy;
         assert(m_busy >= 0);
-        m_read_counter = (m_read_counter + 1) % QUEUE_SIZE;
+        m_read_counter = (m_read_counter + 1) % m_size;
     }
 
 private:
-    enum { QUEUE_SIZE = 2 }; // enough for displaying one frame.
-
-    VideoFrame m_frames[QUEUE_SIZE];
+    FrameBufferPool m_bufferPool; // outlives the frames
+    std::unique_ptr<VideoFrame[]> m_frames;
+    int m_size = 0;
     int m_write_counter = 0;
     int m_read_counter = 0;
     int m_busy = 0;